@@ -0,0 +1,165 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Append-only storage for strings that must outlive the buffer they were read from. Stored views stay valid for the
+// lifetime of the arena.
+class StringArena {
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]> > blocks;
+    char *current = nullptr;
+    std::size_t block_used = 0;
+
+public:
+    std::string_view store(std::string_view str);
+};
+
+// View of a contiguous array that lives in an Arena.
+template <typename T> class Span {
+    T *items = nullptr;
+    std::size_t count = 0;
+
+public:
+    Span() = default;
+    Span(T *items, std::size_t count) : items(items), count(count)
+    {
+    }
+
+    T *begin() const noexcept
+    {
+        return items;
+    }
+    T *end() const noexcept
+    {
+        return items + count;
+    }
+    const T *cbegin() const noexcept
+    {
+        return items;
+    }
+    const T *cend() const noexcept
+    {
+        return items + count;
+    }
+    std::size_t size() const noexcept
+    {
+        return count;
+    }
+    bool empty() const noexcept
+    {
+        return count == 0;
+    }
+    T &front() const noexcept
+    {
+        return items[0];
+    }
+    T &back() const noexcept
+    {
+        return items[count - 1];
+    }
+    T &operator[](std::size_t index) const noexcept
+    {
+        return items[index];
+    }
+};
+
+// Growable array keeping its first `inline_size` elements in place, for collecting short lists before they are copied
+// into an Arena.
+template <typename T, std::size_t inline_size = 8> class SmallVector {
+    T inline_items[inline_size];
+    std::vector<T> spilled;
+    std::size_t count = 0;
+
+public:
+    void push_back(const T &item)
+    {
+        if (count < inline_size) {
+            inline_items[count] = item;
+        } else {
+            if (count == inline_size) {
+                spilled.assign(inline_items, inline_items + inline_size);
+            }
+            spilled.push_back(item);
+        }
+        ++count;
+    }
+    T *data() noexcept
+    {
+        return count > inline_size ? spilled.data() : inline_items;
+    }
+    const T *data() const noexcept
+    {
+        return count > inline_size ? spilled.data() : inline_items;
+    }
+    T *begin() noexcept
+    {
+        return data();
+    }
+    T *end() noexcept
+    {
+        return data() + count;
+    }
+    T &back() noexcept
+    {
+        return data()[count - 1];
+    }
+    std::size_t size() const noexcept
+    {
+        return count;
+    }
+    bool empty() const noexcept
+    {
+        return count == 0;
+    }
+};
+
+// Bump allocator for objects that are never destroyed one by one; all of them are released together with the arena, so
+// only trivially destructible types may be placed in it.
+class Arena {
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]> > blocks;
+    char *current = nullptr;
+    std::size_t block_used = 0;
+
+    void *allocate(std::size_t size, std::size_t alignment);
+
+public:
+    template <typename T, typename... Args> T *make(Args &&... args);
+    template <typename T> Span<T> copy(const T *items, std::size_t count);
+    template <typename T, std::size_t inline_size> Span<T> copy(const SmallVector<T, inline_size> &items);
+    // Takes over the blocks of `other`, so everything allocated there lives as long as this arena.
+    void adopt(Arena &other);
+};
+
+template <typename T, typename... Args> T *Arena::make(Args &&... args)
+{
+    static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+template <typename T> Span<T> Arena::copy(const T *items, std::size_t count)
+{
+    static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+    if (!count) {
+        return {};
+    }
+    T *copied = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+    std::uninitialized_copy(items, items + count, copied);
+    return Span<T>(copied, count);
+}
+
+template <typename T, std::size_t inline_size> Span<T> Arena::copy(const SmallVector<T, inline_size> &items)
+{
+    return copy(items.data(), items.size());
+}
+
+#endif
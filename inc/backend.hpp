@@ -2,7 +2,9 @@
 #define __BACKEND_HPP__
 
 #include "common.hpp"
+#include "flat_ast.hpp"
 #include "node.hpp"
+#include "traversal.hpp"
 #include "visitor.hpp"
 
 #include <deque>
@@ -20,7 +22,9 @@
 extern std::string default_data_layout;
 extern std::string default_target_triple;
 
-class LLVMCompiler : public Visitor {
+class LLVMCompiler : public Visitor, public StaticVisitor<LLVMCompiler> {
+    template <typename Expressions> friend class ExpressionWalker;
+
     static llvm::LLVMContext ctx;
     std::unique_ptr<llvm::Module> module;
     llvm::IRBuilder<> builder;
@@ -41,18 +45,25 @@ class LLVMCompiler : public Visitor {
         llvm::Value *ptr;
     };
 
-    std::stack<std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > > expressions;
-    std::deque<std::unordered_map<std::wstring, Variable> > scopes;
-    std::unordered_map<std::wstring, Function> functions;
-    std::unordered_map<std::wstring, Variable> global_vars;
+    std::stack<std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> >,
+               std::vector<std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > > >
+        expressions;
+    // Values of the finished children of the expressions being walked.
+    std::vector<llvm::Value *> operands;
+    ExpressionWalker<TreeExpressions> tree_walker;
+    ExpressionWalker<FlatExpressions> flat_walker;
+    std::deque<std::unordered_map<Symbol, Variable> > scopes;
+    std::unordered_map<Symbol, Function> functions;
+    std::unordered_map<Symbol, Variable> global_vars;
+    const FlatAst *ast = nullptr;
 
     void enter();
     void leave();
-    void create_variable(const std::wstring &name, llvm::Value *ptr, llvm::Type *type);
-    void declare_variable(const std::wstring &name, llvm::Value *ptr, llvm::Type *type);
-    llvm::Value *get_variable_ptr(const std::wstring &name);
-    llvm::Type *get_variable_type(const std::wstring &name);
-    const Variable &find_variable(const std::wstring &name);
+    void create_variable(Symbol name, llvm::Value *ptr, llvm::Type *type);
+    void declare_variable(Symbol name, llvm::Value *ptr, llvm::Type *type);
+    llvm::Value *get_variable_ptr(Symbol name);
+    llvm::Type *get_variable_type(Symbol name);
+    const Variable &find_variable(Symbol name);
 
     void yield(lazyValue<llvm::Value *> value, lazyValue<llvm::Value *> address = nullptr);
     llvm::Type *from_builtin_type(BuiltinType type);
@@ -61,22 +72,51 @@ class LLVMCompiler : public Visitor {
     std::wstring next_reg() noexcept;
     void reset_reg() noexcept;
 
-    template <typename Node> void compile(const std::unique_ptr<Node> &node);
-
-    template <typename Node> llvm::Value *compile_expr_val(const std::unique_ptr<Node> &node);
+    template <typename Node> void compile(const Node *node);
+    void compile(NodeIndex node);
 
-    template <typename Node> llvm::Value *compile_expr_ptr(const std::unique_ptr<Node> &node);
+    template <typename Node> llvm::Value *compile_expr_val(Node node);
 
-    template <typename Node>
-    std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > compile_expr(const std::unique_ptr<Node> &node);
+    template <typename Node> llvm::Value *compile_expr_ptr(Node node);
 
-    void declare_global_var(const std::unique_ptr<VariableDecl> &stmt);
-    void declare_global_var(const std::wstring &name, BuiltinType type);
+    template <typename Node> std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > compile_expr(Node node);
+    std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > pop_expr();
+    llvm::Value *pop_operand();
 
-    void process_parameters(const std::list<FunctionDecl::Parameter> &parameters, llvm::Function *function);
+    template <NodeKind kind, typename Expressions> void enter_node(const Expressions &, typename Expressions::Node)
+    {
+    }
+    template <NodeKind kind, typename Expressions>
+    void child_done(const Expressions &expressions, typename Expressions::Node node, std::size_t index);
+    template <NodeKind kind, typename Expressions>
+    void leave_node(const Expressions &expressions, typename Expressions::Node node);
+    void compile_expression(const Expression &expr);
+
+    void compile_unary(UnaryOperator op);
+    void compile_binary(BinaryOperator op, llvm::Value *lhs, llvm::Value *rhs);
+    void compile_index(llvm::Value *ptr, llvm::Value *index);
+    void compile_variable(Symbol name);
+    void compile_string(std::string_view value);
+    template <typename Node> void compile_local(Symbol name, BuiltinType type, Node initial_value, bool initialized);
+    template <typename Node> void compile_conditional_block(Node condition, Node block, llvm::BasicBlock *after_if);
+    template <typename Node>
+    void compile_for(Symbol loop_variable, Node start, Node end, Node increase, bool has_increase, Node block);
+    template <typename Node> void compile_while(Node condition, Node block);
+    void compile_function(NodeIndex node);
+    Function create_function(BuiltinType return_type, std::vector<llvm::Type *> parameters);
+    void finish_function(llvm::Function *function);
+
+    void declare_global_var(const VariableDecl *stmt);
+    void declare_global_var(NodeIndex stmt);
+    void declare_global_var(Symbol name, BuiltinType type);
+
+    void process_parameters(Span<FunctionDecl::Parameter> parameters, llvm::Function *function);
+    void store_parameter(Symbol name, llvm::Argument &value);
     void optimize();
-    void compile_entrypoint(const std::list<std::unique_ptr<VariableDecl> > &global_vars_decl);
-    void initialize_variables(const std::unique_ptr<VariableDecl> &decl);
+    template <typename Declarations> void compile_entrypoint(const Declarations &global_vars_decl);
+    void initialize_variables(const VariableDecl *decl);
+    void initialize_variables(NodeIndex decl);
+    void initialize_variable(Symbol name, llvm::Value *value);
     llvm::Value *convert_to_bool(llvm::Value *expr);
     void remove_dead_code(llvm::BasicBlock &block);
 
@@ -106,6 +146,9 @@ public:
     void visit(const Program &) override;
     void visit(const ExternFunctionDecl &) override;
 
+    // Generates the same module from the flat form of the program.
+    void compile(const FlatAst &program);
+
     void save_ir(const std::string &path);
     void save_bc(const std::string &path);
     void print_ir();
@@ -115,6 +158,8 @@ public:
 std::unique_ptr<LLVMCompiler> compile(const std::unique_ptr<Program> &program,
                                       const std::string &target = default_target_triple,
                                       const std::string &data_layout = default_data_layout);
+std::unique_ptr<LLVMCompiler> compile(const FlatAst &program, const std::string &target = default_target_triple,
+                                      const std::string &data_layout = default_data_layout);
 
 class CompilerException : public std::runtime_error {
     std::wstring msg;
@@ -135,29 +180,26 @@ public:
     }
 };
 
-template <typename Node> void LLVMCompiler::compile(const std::unique_ptr<Node> &node)
+template <typename Node> void LLVMCompiler::compile(const Node *node)
 {
-    node->accept(*this);
+    dispatch(*node);
 }
 
-template <typename Node> llvm::Value *LLVMCompiler::compile_expr_val(const std::unique_ptr<Node> &node)
+template <typename Node> llvm::Value *LLVMCompiler::compile_expr_val(Node node)
 {
     return compile_expr(node).first.get();
 }
 
-template <typename Node> llvm::Value *LLVMCompiler::compile_expr_ptr(const std::unique_ptr<Node> &node)
+template <typename Node> llvm::Value *LLVMCompiler::compile_expr_ptr(Node node)
 {
     return compile_expr(node).second.get();
 }
 
 template <typename Node>
-std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> >
-LLVMCompiler::compile_expr(const std::unique_ptr<Node> &node)
+std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > LLVMCompiler::compile_expr(Node node)
 {
-    node->accept(*this);
-    auto ret = expressions.top();
-    expressions.pop();
-    return ret;
+    compile(node);
+    return pop_expr();
 }
 
 #endif
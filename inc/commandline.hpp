@@ -19,6 +19,10 @@ public:
     static CommandLine parse(int argc, char *argv[]);
     std::optional<std::string> getInputFile() const noexcept;
     std::optional<std::string> getOutputFile() const noexcept;
+    std::size_t getStreamWindow() const noexcept;
+    std::optional<std::size_t> getMaxDepth() const noexcept;
+    bool runPipelined() const noexcept;
+    bool runLanguageServer() const noexcept;
     bool runJIT() const noexcept;
     bool compileToIr() const noexcept;
     bool compileToBc() const noexcept;
@@ -1,12 +1,15 @@
 #ifndef __COMMON_HPP__
 #define __COMMON_HPP__
 
+#include "utf8.hpp"
+
 #include <functional>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <type_traits>
 
 template <typename... StringElements> class StringBuilder {
     std::tuple<StringElements...> elements;
@@ -18,7 +21,12 @@ public:
     }
     template <std::size_t i = 0> void iterate()
     {
-        wss << std::get<i>(elements);
+        using Element = std::decay_t<std::tuple_element_t<i, std::tuple<StringElements...> > >;
+        if constexpr (std::is_same_v<Element, std::string> || std::is_same_v<Element, std::string_view>) {
+            wss << utf8_to_wstring(std::get<i>(elements));
+        } else {
+            wss << std::get<i>(elements);
+        }
         if constexpr (i < sizeof...(StringElements) - 1) {
             iterate<i + 1>();
         }
@@ -86,12 +94,7 @@ inline std::string to_ascii_string(const std::wstring &wstr)
     return std::string(wstr.begin(), wstr.end());
 }
 
-template <typename Class, typename... Elements> std::unique_ptr<Class> make(Elements &&... elements)
-{
-    return std::make_unique<Class>(std::move(elements)...);
-}
-
-class Position;
-std::wstring error_marker(const Position &pos);
+struct SourcePosition;
+std::wstring error_marker(const SourcePosition &pos);
 
 #endif
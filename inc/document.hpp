@@ -0,0 +1,91 @@
+#ifndef __DOCUMENT_HPP__
+#define __DOCUMENT_HPP__
+
+#include "arena.hpp"
+#include "interner.hpp"
+#include "node.hpp"
+#include "semantic.hpp"
+#include "source_manager.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A place in a document the way editors count it: lines from 0 and characters in UTF-16 code units.
+struct TextPosition {
+    std::size_t line;
+    std::size_t character;
+};
+
+struct Diagnostic {
+    TextPosition start;
+    TextPosition end;
+    std::wstring message;
+};
+
+// Text of a program kept lexed, parsed and analysed between edits. The text is split into items, runs of whole lines
+// starting at a top-level declaration, and every item is parsed on its own. An edit relexes and reparses only the items
+// it touches; the analyser then checks their functions again together with those using a name whose declaration
+// changed, everything else keeps its diagnostics. Each item reports its first syntax error and the first error of
+// every declaration in it, with the messages analyse() gives.
+class Document {
+    struct Error {
+        Position position;
+        std::wstring message;
+    };
+    struct Item {
+        std::string text;
+        // Line breaks in `text` and the location of its first byte.
+        std::size_t lines = 0;
+        std::uint32_t location = 0;
+        // Null when the text does not lex or parse. The nodes live in `nodes`, shared by the items parsed together.
+        std::shared_ptr<Arena> nodes;
+        std::unique_ptr<Program> program;
+        // An item whose text stopped parsing keeps the last program that did, so the rest of the document still sees
+        // its declarations; only the syntax error is reported for it.
+        bool outdated = false;
+        // Identifiers the item mentions, sorted by id.
+        std::vector<Symbol> names;
+        // See SemanticAnalyser::declared_functions.
+        std::size_t first_function = 0;
+        std::optional<Error> syntax_error;
+        std::vector<Error> declaration_errors;
+        std::vector<Error> function_errors;
+    };
+    // A declaration as seen from the rest of the program: its name and an encoding of its kind and types.
+    typedef std::pair<std::uint32_t, std::string> Signature;
+
+    std::shared_ptr<SourceManager> sources;
+    // Names of the identifiers lexed since the text was loaded, partly typed ones included; replaced with `sources`.
+    std::unique_ptr<Interner> names;
+    std::vector<Item> items;
+    SemanticAnalyser analyser{ nullptr };
+    // Bytes lexed since the text was loaded; every reparse adds a buffer to `sources`, which only grows.
+    std::size_t relexed = 0;
+
+    std::vector<Item> parse(const std::string &text);
+    std::pair<std::size_t, std::size_t> locate(const TextPosition &position) const;
+    void replace_items(std::size_t begin, std::size_t end, std::vector<Item> parsed);
+    static void collect_signatures(const Item &item, std::vector<Signature> &signatures);
+    void declare_all();
+    void check(Item &item);
+    template <typename Check> void run_check(const Item &item, std::vector<Error> &errors, Check &&check);
+    void recover();
+    static Diagnostic diagnostic(const Item &item, std::size_t line, const Error &error);
+
+public:
+    explicit Document(const std::string &text);
+
+    // Replaces the text between `start` and `end`, which are clamped to the document.
+    void edit(const TextPosition &start, const TextPosition &end, const std::string &text);
+    void reset(const std::string &text);
+    std::string text() const;
+    std::vector<Diagnostic> diagnostics() const;
+    // Identifiers interned since the text was loaded.
+    std::size_t interned() const noexcept;
+};
+
+#endif
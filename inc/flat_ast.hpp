@@ -0,0 +1,57 @@
+#ifndef __FLAT_AST_HPP__
+#define __FLAT_AST_HPP__
+
+#include "node.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+typedef std::uint32_t NodeIndex;
+constexpr NodeIndex no_node = UINT32_MAX;
+
+// Data-oriented copy of a Program: nodes are rows of parallel columns and refer to each other by 32-bit index.
+// Children are stored before their parents, so every subtree is a contiguous range that ends at its root.
+class FlatAst {
+public:
+    std::vector<NodeKind> kinds;
+    std::vector<std::uint8_t> ops;
+    std::vector<Position> positions;
+    std::vector<std::uint32_t> first;
+    std::vector<std::uint32_t> second;
+
+    // Every list is its length followed by its items.
+    std::vector<NodeIndex> lists;
+    std::vector<std::string_view> strings;
+
+    std::vector<NodeIndex> externs;
+    std::vector<NodeIndex> global_vars;
+    std::vector<NodeIndex> functions;
+
+    NodeIndex add(NodeKind kind, std::uint8_t op, const Position &position, std::uint32_t first_value,
+                  std::uint32_t second_value);
+    std::uint32_t add_list(const NodeIndex *items, std::size_t count);
+
+    std::size_t size() const noexcept
+    {
+        return kinds.size();
+    }
+    std::size_t memory_usage() const noexcept;
+
+    Span<const NodeIndex> list(std::uint32_t offset) const noexcept
+    {
+        return Span<const NodeIndex>(lists.data() + offset + 1, lists[offset]);
+    }
+    Symbol symbol(NodeIndex node) const noexcept
+    {
+        return Symbol{ first[node] };
+    }
+    template <typename Enum> Enum op(NodeIndex node) const noexcept
+    {
+        return static_cast<Enum>(ops[node]);
+    }
+};
+
+FlatAst flatten(const Program &program);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __INTERNER_HPP__
+#define __INTERNER_HPP__
+
+#include "arena.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Identifier names are interned once by the lexer; every later phase compares and hashes the 32-bit id instead of
+// the text, and only diagnostics and code generation resolve it back to a string.
+struct Symbol {
+    std::uint32_t id = 0;
+
+    std::string_view str() const;
+
+    bool operator==(const Symbol &other) const noexcept
+    {
+        return id == other.id;
+    }
+    bool operator!=(const Symbol &other) const noexcept
+    {
+        return id != other.id;
+    }
+};
+
+namespace std {
+template <> struct hash<Symbol> {
+    std::size_t operator()(const Symbol &symbol) const noexcept
+    {
+        return symbol.id;
+    }
+};
+}
+
+// Names every interner starts with, in this order, so their symbols are the same in all of them.
+constexpr Symbol int_symbol{ 1 };
+constexpr Symbol string_symbol{ 2 };
+constexpr Symbol main_symbol{ 3 };
+
+// Symbols of one compilation. There is no locking: a single thread interns into an interner at a time, while threads
+// handed symbols from it may look their names up, as stored names never move. Threads lexing on their own intern into
+// interners of their own and the symbols are carried over where their tokens are stitched back together.
+class Interner {
+    static constexpr std::uint32_t empty_slot = UINT32_MAX;
+    static constexpr std::size_t block_count = 32;
+
+    // Open-addressing table; the cached hash lets most probes skip comparing the text.
+    struct Slot {
+        std::uint32_t hash;
+        std::uint32_t id;
+    };
+
+    StringArena arena;
+    // Block k holds the names of ids 2^k - 1 up to 2^(k+1) - 2, so growing never moves a stored name.
+    std::unique_ptr<std::string_view[]> blocks[block_count];
+    std::atomic<std::uint32_t> count;
+    std::vector<Slot> slots;
+
+    Interner(const Interner &) = delete;
+    Interner &operator=(const Interner &) = delete;
+
+    std::string_view &entry(std::uint32_t id) const noexcept;
+    const Slot *find(std::string_view str, std::uint32_t hash) const;
+    void grow();
+
+public:
+    Interner();
+
+    Symbol intern(std::string_view str);
+    std::string_view name(Symbol symbol) const;
+    std::size_t size() const noexcept;
+
+    // The interner of the calling thread: the innermost one a Scope made current, otherwise one the thread owns.
+    static Interner &current();
+
+    class Scope {
+        Interner *previous;
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    public:
+        explicit Scope(Interner &interner);
+        ~Scope();
+    };
+};
+
+inline Symbol intern(std::string_view str)
+{
+    return Interner::current().intern(str);
+}
+
+std::wostream &operator<<(std::wostream &os, const Symbol &symbol);
+
+#endif
@@ -3,56 +3,100 @@
 
 #include "common.hpp"
 #include "source.hpp"
+#include "source_manager.hpp"
 #include "token.hpp"
 
+#include <locale>
+#include <optional>
 #include <stdexcept>
-#include <unordered_map>
-#include <unordered_set>
 
 class Lexer {
-    std::unique_ptr<Source> source;
-    std::optional<wchar_t> ch_opt;
+    std::shared_ptr<SourceManager> sources;
+    SourceManager::BufferId buffer;
+    Source *source;
+    std::uint32_t base;
+    std::string_view chunk;
+    std::size_t chunk_start;
+    std::size_t index;
     std::locale locale;
     Position position;
 
-    static const std::unordered_map<std::wstring, TokenType> keywords;
-    static const std::unordered_set<wchar_t> operator_chars;
+    // Result of lexing one slice of the input on a worker thread; `stop` is where the next token would start. Its
+    // identifiers are interned into `names` until the slice is known to be in phase. A slice that `failed` keeps no
+    // error: workers have no SourceManager to point into the source with, so the serial lexer lexes that token again.
+    struct Slice {
+        TokenBuffer tokens;
+        std::unique_ptr<Interner> names;
+        std::size_t stop = 0;
+        bool failed = false;
+    };
+
+    Lexer(std::string_view input, std::uint32_t base, std::size_t begin);
+    Slice lex_slice(std::size_t begin, std::size_t end) const;
 
     Token keyword_or_identifier();
     Token operator_lexem();
     Token int_const();
     Token string_const();
-    wchar_t escape_char(wchar_t ch);
-
-    template <typename... Options> Token choose_operator_on(wchar_t chr, TokenType on_match, Options &&... options);
-    Token choose_operator_on(TokenType on_mismatch);
+    Token lexem(TokenType type, std::uint32_t payload = 0) const noexcept;
+    std::uint32_t add_literal(std::string_view raw, bool copy);
+    std::string lexem_text();
+
+    bool refill();
+    std::optional<char> peek();
+    void advance() noexcept;
+    std::size_t offset() const noexcept;
+    wchar_t current_char() const noexcept;
+    std::size_t non_ascii_length(std::ctype_base::mask mask);
+    template <typename Scanner> void skip_run(Scanner scanner);
+    template <typename Predicate> void collect_while(std::string &out, Predicate predicate);
 
     bool skip_space();
     bool skip_comment();
+    void skip_trivia();
 
     [[noreturn]] void report_error(const Position &error_position, const std::wstring &error_msg, wchar_t bad_char);
     [[noreturn]] void report_error(const Position &error_position, const std::wstring &error_msg,
-                                   const std::wstring &bad_lexem);
+                                   const std::string &bad_lexem);
 
 public:
     Lexer(std::unique_ptr<Source> source = nullptr);
+    Lexer(std::shared_ptr<SourceManager> sources, SourceManager::BufferId buffer);
 
     Token next();
-
-    std::unique_ptr<Source> change_source(std::unique_ptr<Source> source = nullptr) noexcept;
-    std::wstring source_between(const Position &start, const Position &end);
+    TokenBuffer tokenize_all();
+    TokenBuffer tokenize_parallel(std::size_t threads);
+
+    SourceManager::BufferId change_source(std::unique_ptr<Source> source, std::string name = "");
+    void change_source(SourceManager::BufferId buffer);
+    const std::shared_ptr<SourceManager> &source_manager() const noexcept;
+    std::string source_between(const Position &start, const Position &end);
+    // Keeps the text from `position` on for diagnostics while the lexer reads ahead, possibly on another thread.
+    void retain_from(const Position &position) noexcept;
+    // Lets the lexer read past retained text while whoever retained it has run out of tokens.
+    void wait_for_input(bool waiting) noexcept;
     std::wstring get_lines(std::size_t from, std::size_t to);
+    std::wstring get_line(std::size_t line);
 
     static std::unique_ptr<Lexer> from_source(std::unique_ptr<Source> source);
+    static std::unique_ptr<Lexer> from_source(std::shared_ptr<SourceManager> sources, SourceManager::BufferId buffer);
 };
 
 class LexerException : public std::runtime_error {
     std::wstring msg;
     std::string ascii_msg;
+    std::wstring error;
+    std::optional<Position> where;
 
 public:
     LexerException(const std::wstring &error)
-        : std::runtime_error("LexerException"), msg(error), ascii_msg(to_ascii_string(msg))
+        : std::runtime_error("LexerException"), msg(error), ascii_msg(to_ascii_string(msg)), error(error)
+    {
+    }
+    // `error` is the message without the part of the source it points at.
+    LexerException(const std::wstring &message, const std::wstring &error, const Position &position)
+        : std::runtime_error("LexerException"), msg(message), ascii_msg(to_ascii_string(msg)), error(error),
+          where(position)
     {
     }
     const char *what() const noexcept override
@@ -63,16 +107,58 @@ public:
     {
         return msg;
     }
+    const std::wstring &description() const noexcept
+    {
+        return error;
+    }
+    const std::optional<Position> &position() const noexcept
+    {
+        return where;
+    }
 };
 
-template <typename... Options> Token Lexer::choose_operator_on(wchar_t chr, TokenType on_match, Options &&... options)
+inline std::optional<char> Lexer::peek()
 {
-    if (ch_opt && *ch_opt == chr) {
-        ch_opt = source->next();
-        return make_token(on_match, position);
-    } else {
-        return choose_operator_on(std::forward<Options>(options)...);
+    if (index < chunk.size() || refill()) {
+        return chunk[index];
     }
+    return {};
+}
+
+inline void Lexer::advance() noexcept
+{
+    ++index;
+}
+
+inline std::size_t Lexer::offset() const noexcept
+{
+    return chunk_start + index;
+}
+
+inline Token Lexer::lexem(TokenType type, std::uint32_t payload) const noexcept
+{
+    return Token{ type, position, base + static_cast<std::uint32_t>(offset()) - position.location, payload };
+}
+
+template <typename Scanner> void Lexer::skip_run(Scanner scanner)
+{
+    do {
+        index = scanner(chunk.data(), index, chunk.size());
+    } while (index == chunk.size() && refill());
+}
+
+template <typename Predicate> void Lexer::collect_while(std::string &out, Predicate predicate)
+{
+    do {
+        const char *begin = chunk.data() + index;
+        const char *it = begin;
+        const char *end = chunk.data() + chunk.size();
+        while (it != end && predicate(*it)) {
+            ++it;
+        }
+        out.append(begin, it);
+        index = it - chunk.data();
+    } while (index == chunk.size() && refill());
 }
 
 #endif
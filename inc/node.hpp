@@ -1,21 +1,56 @@
 #ifndef __NODE_HPP__
 #define __NODE_HPP__
 
+#include "arena.hpp"
 #include "source.hpp"
 #include "token.hpp"
 #include "visitor.hpp"
 
-#include <list>
+#include <cstdint>
+#include <iterator>
 #include <memory>
-#include <optional>
 #include <string>
 #include <utility>
 
+// Nodes are allocated in the Arena owned by their Program and are never destroyed one by one. Children are plain
+// pointers into the same arena, null where a child is optional and absent.
+// Every node carries its kind in place of a vtable, and StaticVisitor and node_cast() dispatch on it. The same tags
+// name the rows of a FlatAst; the comments say what its `first` and `second` columns hold for each of them, a list
+// being an offset into FlatAst::lists. Variable and Parameter only exist in the flat form and Program only in the tree.
+enum class NodeKind : std::uint8_t {
+    IntConst,            // first: value
+    StringConst,         // first: index into strings
+    VariableRef,         // first: name
+    FunctionCall,        // first: name, second: list of arguments
+    UnaryExpression,     // op: UnaryOperator, first: operand
+    BinaryExpression,    // op: BinaryOperator, first: lhs, second: rhs
+    IndexExpression,     // first: pointer, second: index
+    Block,               // first: list of statements
+    VariableDecl,        // first: list of Variable nodes
+    Variable,            // op: BuiltinType, first: name, second: initial value or no_node
+    AssignmentStatement, // first: list of assigned expressions followed by the value
+    ReturnStatement,     // first: value
+    ExpressionStatement, // first: expression
+    IfStatement,         // first: list of condition and block pairs, second: else block or no_node
+    ForStatement,        // position: loop variable, first: its name, second: list of start, end, increase, block
+    WhileStatement,      // first: condition, second: block
+    Parameter,           // op: BuiltinType, first: name
+    FunctionDecl,        // op: return type, first: name, second: list of the block followed by the parameters
+    ExternFunctionDecl,  // op: return type, first: name, second: list of parameters
+    Program,
+};
+
 struct ASTNode {
-    virtual ~ASTNode()
+    const NodeKind kind;
+
+    // Compatibility path for visitors written against the Visitor interface, see StaticVisitor for the direct one.
+    void accept(Visitor &visitor) const;
+
+protected:
+    ASTNode(NodeKind kind) : kind(kind)
     {
     }
-    virtual void accept(Visitor &) const = 0;
+    ~ASTNode() = default;
 };
 
 enum class BinaryOperator {
@@ -69,136 +104,114 @@ struct Expression : public ASTNode {
     {
         return pos;
     }
-    Expression(const Position &position) : pos(position)
-    {
-    }
-    virtual ~Expression()
+    Expression(NodeKind kind, const Position &position) : ASTNode(kind), pos(position)
     {
     }
 };
 
 struct UnaryExpression : public Expression {
+    static constexpr NodeKind node_kind = NodeKind::UnaryExpression;
+
     UnaryOperator op;
-    std::unique_ptr<Expression> rhs;
+    Expression *rhs;
 
 public:
-    UnaryExpression(const Position &position, UnaryOperator op, std::unique_ptr<Expression> rhs)
-        : Expression(position), op(op), rhs(std::move(rhs))
+    UnaryExpression(const Position &position, UnaryOperator op, Expression *rhs)
+        : Expression(node_kind, position), op(op), rhs(rhs)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct BinaryExpression : public Expression {
+    static constexpr NodeKind node_kind = NodeKind::BinaryExpression;
+
     BinaryOperator op;
-    std::unique_ptr<Expression> lhs;
-    std::unique_ptr<Expression> rhs;
+    Expression *lhs;
+    Expression *rhs;
 
 public:
-    BinaryExpression(const Position &position, BinaryOperator op, std::unique_ptr<Expression> lhs,
-                     std::unique_ptr<Expression> rhs)
-        : Expression(position), op(op), lhs(std::move(lhs)), rhs(std::move(rhs))
+    BinaryExpression(const Position &position, BinaryOperator op, Expression *lhs, Expression *rhs)
+        : Expression(node_kind, position), op(op), lhs(lhs), rhs(rhs)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct IndexExpression : public Expression {
-    std::unique_ptr<Expression> ptr;
-    std::unique_ptr<Expression> index;
+    static constexpr NodeKind node_kind = NodeKind::IndexExpression;
+
+    Expression *ptr;
+    Expression *index;
 
 public:
-    IndexExpression(const Position &position, std::unique_ptr<Expression> ptr, std::unique_ptr<Expression> index)
-        : Expression(position), ptr(std::move(ptr)), index(std::move(index))
-    {
-    }
-    void accept(Visitor &visitor) const override
+    IndexExpression(const Position &position, Expression *ptr, Expression *index)
+        : Expression(node_kind, position), ptr(ptr), index(index)
     {
-        visitor.visit(*this);
     }
 };
 
 struct VariableRef : public Expression {
-    std::wstring var_name;
+    static constexpr NodeKind node_kind = NodeKind::VariableRef;
+
+    Symbol var_name;
 
 public:
-    VariableRef(const Position &position, std::wstring name) : Expression(position), var_name(name)
-    {
-    }
-    void accept(Visitor &visitor) const override
+    VariableRef(const Position &position, Symbol name) : Expression(node_kind, position), var_name(name)
     {
-        visitor.visit(*this);
     }
 };
 
 struct FunctionCall : public Expression {
-    std::wstring func_name;
-    std::list<std::unique_ptr<Expression> > arguments;
+    static constexpr NodeKind node_kind = NodeKind::FunctionCall;
+
+    Symbol func_name;
+    Span<Expression *> arguments;
 
 public:
-    FunctionCall(const Position &position, std::wstring func_name, std::list<std::unique_ptr<Expression> > arguments)
-        : Expression(position), func_name(std::move(func_name)), arguments(std::move(arguments))
+    FunctionCall(const Position &position, Symbol func_name, Span<Expression *> arguments)
+        : Expression(node_kind, position), func_name(func_name), arguments(arguments)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct IntConst : public Expression {
+    static constexpr NodeKind node_kind = NodeKind::IntConst;
+
     int value;
 
 public:
-    IntConst(const Position &position, int value) : Expression(position), value(value)
-    {
-    }
-    void accept(Visitor &visitor) const override
+    IntConst(const Position &position, int value) : Expression(node_kind, position), value(value)
     {
-        visitor.visit(*this);
     }
 };
 
 struct StringConst : public Expression {
-    std::wstring value;
+    static constexpr NodeKind node_kind = NodeKind::StringConst;
+
+    std::string_view value; // escape sequences are decoded by unescape()
 
 public:
-    StringConst(const Position &position, std::wstring value) : Expression(position), value(std::move(value))
-    {
-    }
-    void accept(Visitor &visitor) const override
+    StringConst(const Position &position, std::string_view value) : Expression(node_kind, position), value(value)
     {
-        visitor.visit(*this);
     }
 };
 
 struct Statement : public ASTNode {
-    virtual ~Statement()
-    {
-    }
+    using ASTNode::ASTNode;
 };
 
 struct Block : public ASTNode {
-    std::list<std::unique_ptr<Statement> > statements;
+    static constexpr NodeKind node_kind = NodeKind::Block;
+
+    Span<Statement *> statements;
 
 public:
-    Block(std::list<std::unique_ptr<Statement> > statements) : statements(std::move(statements))
+    Block(Span<Statement *> statements) : ASTNode(node_kind), statements(statements)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct ParameterDef {
-    std::wstring name;
+    Symbol name;
     BuiltinType type;
     Position pos;
     const Position &position() const
@@ -208,44 +221,40 @@ struct ParameterDef {
 };
 
 struct ExternFunctionDecl : public Statement {
+    static constexpr NodeKind node_kind = NodeKind::ExternFunctionDecl;
+
     Position pos;
-    std::wstring func_name;
+    Symbol func_name;
     typedef ParameterDef Parameter;
     BuiltinType return_type;
-    std::list<Parameter> parameters;
-    ExternFunctionDecl(const Position &pos, std::wstring name, BuiltinType return_type, std::list<Parameter> parameters)
-        : pos(pos), func_name(std::move(name)), return_type(return_type), parameters(parameters)
+    Span<Parameter> parameters;
+    ExternFunctionDecl(const Position &pos, Symbol name, BuiltinType return_type, Span<Parameter> parameters)
+        : Statement(node_kind), pos(pos), func_name(name), return_type(return_type), parameters(parameters)
     {
     }
     const Position &position() const
     {
         return pos;
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct FunctionDecl : public Statement {
+    static constexpr NodeKind node_kind = NodeKind::FunctionDecl;
+
     Position pos;
-    std::wstring func_name;
+    Symbol func_name;
     BuiltinType return_type;
     typedef ParameterDef Parameter;
-    std::list<Parameter> parameters;
-    std::unique_ptr<Block> block;
+    Span<Parameter> parameters;
+    Block *block;
 
 public:
-    FunctionDecl(const Position &position, std::wstring func_name, BuiltinType return_type, std::list<Parameter> params,
-                 std::unique_ptr<Block> block)
-        : pos(position), func_name(std::move(func_name)), return_type(return_type), parameters(std::move(params)),
-          block(std::move(block))
+    FunctionDecl(const Position &position, Symbol func_name, BuiltinType return_type, Span<Parameter> params,
+                 Block *block)
+        : Statement(node_kind), pos(position), func_name(func_name), return_type(return_type),
+          parameters(params), block(block)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
     const Position &position() const
     {
         return pos;
@@ -253,138 +262,198 @@ public:
 };
 
 struct VariableDecl : public Statement {
+    static constexpr NodeKind node_kind = NodeKind::VariableDecl;
+
     struct SingleVarDecl {
         Position pos;
-        std::wstring name;
+        Symbol name;
         BuiltinType type;
-        std::optional<std::unique_ptr<Expression> > initial_value;
+        Expression *initial_value = nullptr;
         const Position &position() const
         {
             return pos;
         }
     };
 
-    std::list<SingleVarDecl> var_decls;
+    Span<SingleVarDecl> var_decls;
 
-    typedef std::list<SingleVarDecl> VarDeclList;
+    typedef Span<SingleVarDecl> VarDeclList;
 
 public:
-    VariableDecl(std::list<SingleVarDecl> var_decls) : var_decls(std::move(var_decls))
+    VariableDecl(Span<SingleVarDecl> var_decls) : Statement(node_kind), var_decls(var_decls)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct AssignmentStatement : public Statement {
-    std::list<std::unique_ptr<Expression> > parts;
+    static constexpr NodeKind node_kind = NodeKind::AssignmentStatement;
+
+    Span<Expression *> parts;
 
 public:
-    AssignmentStatement(std::list<std::unique_ptr<Expression> > parts) : parts(std::move(parts))
+    AssignmentStatement(Span<Expression *> parts) : Statement(node_kind), parts(parts)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct ReturnStatement : public Statement {
-    std::unique_ptr<Expression> expr;
+    static constexpr NodeKind node_kind = NodeKind::ReturnStatement;
+
+    Expression *expr;
 
 public:
-    ReturnStatement(std::unique_ptr<Expression> expr) : expr(std::move(expr))
-    {
-    }
-    void accept(Visitor &visitor) const override
+    ReturnStatement(Expression *expr) : Statement(node_kind), expr(expr)
     {
-        visitor.visit(*this);
     }
 };
 
 struct ExpressionStatement : public Statement {
-    std::unique_ptr<Expression> expr;
+    static constexpr NodeKind node_kind = NodeKind::ExpressionStatement;
+
+    Expression *expr;
 
 public:
-    ExpressionStatement(std::unique_ptr<Expression> expr) : expr(std::move(expr))
+    ExpressionStatement(Expression *expr) : Statement(node_kind), expr(expr)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct IfStatement : public Statement {
-    std::list<std::pair<std::unique_ptr<Expression>, std::unique_ptr<Block> > > blocks;
-    std::optional<std::unique_ptr<Block> > else_statement;
+    static constexpr NodeKind node_kind = NodeKind::IfStatement;
+
+    typedef std::pair<Expression *, Block *> ConditionalBlock;
+    Span<ConditionalBlock> blocks;
+    Block *else_statement;
 
 public:
-    IfStatement(std::list<std::pair<std::unique_ptr<Expression>, std::unique_ptr<Block> > > blocks,
-                std::optional<std::unique_ptr<Block> > else_statement)
-        : blocks(std::move(blocks)), else_statement(std::move(else_statement))
+    IfStatement(Span<ConditionalBlock> blocks, Block *else_statement)
+        : Statement(node_kind), blocks(blocks), else_statement(else_statement)
     {
     }
-    void accept(Visitor &visitor) const override
-    {
-        visitor.visit(*this);
-    }
 };
 
 struct ForStatement : public Statement {
-    std::wstring loop_variable;
+    static constexpr NodeKind node_kind = NodeKind::ForStatement;
+
+    Symbol loop_variable;
     Position loop_variable_pos;
-    std::unique_ptr<Expression> start;
-    std::unique_ptr<Expression> end;
-    std::optional<std::unique_ptr<Expression> > increase;
-    std::unique_ptr<Block> block;
+    Expression *start;
+    Expression *end;
+    Expression *increase;
+    Block *block;
 
 public:
-    ForStatement(std::wstring loop_variable, const Position &loop_variable_pos, std::unique_ptr<Expression> start,
-                 std::unique_ptr<Expression> end, std::optional<std::unique_ptr<Expression> > increase,
-                 std::unique_ptr<Block> block)
-        : loop_variable(std::move(loop_variable)), loop_variable_pos(loop_variable_pos), start(std::move(start)),
-          end(std::move(end)), increase(std::move(increase)), block(std::move(block))
+    ForStatement(Symbol loop_variable, const Position &loop_variable_pos, Expression *start, Expression *end,
+                 Expression *increase, Block *block)
+        : Statement(node_kind), loop_variable(loop_variable), loop_variable_pos(loop_variable_pos),
+          start(start), end(end), increase(increase), block(block)
     {
     }
-    void accept(Visitor &visitor) const override
+};
+
+struct WhileStatement : public Statement {
+    static constexpr NodeKind node_kind = NodeKind::WhileStatement;
+
+    Expression *condition;
+    Block *block;
+
+public:
+    WhileStatement(Expression *condition, Block *block) : Statement(node_kind), condition(condition), block(block)
     {
-        visitor.visit(*this);
     }
 };
 
-struct WhileStatement : public Statement {
-    std::unique_ptr<Expression> condition;
-    std::unique_ptr<Block> block;
+// The root owns the arena holding every other node, so dropping the program frees the whole tree at once. Programs
+// from Parser::parse_part() share an arena owned by whoever parsed them.
+struct Program : public ASTNode {
+    static constexpr NodeKind node_kind = NodeKind::Program;
+
+    std::unique_ptr<Arena> nodes;
+    Span<VariableDecl *> global_vars;
+    Span<FunctionDecl *> functions;
+    Span<ExternFunctionDecl *> externs;
 
 public:
-    WhileStatement(std::unique_ptr<Expression> condition, std::unique_ptr<Block> block)
-        : condition(std::move(condition)), block(std::move(block))
+    Program(std::unique_ptr<Arena> nodes, Span<VariableDecl *> global_vars, Span<FunctionDecl *> functions,
+            Span<ExternFunctionDecl *> externs)
+        : ASTNode(node_kind), nodes(std::move(nodes)), global_vars(global_vars), functions(functions), externs(externs)
+    {
+    }
+};
+
+// Visits a node through a table indexed by its kind. Derived provides visit() for every node type and the calls are
+// qualified, so each one is bound at compile time and dispatch() costs one indirect call per node. That call keeps the
+// visit() bodies out of line; a switch that inlines them into each other measured slower on deep trees.
+template <typename Derived> class StaticVisitor {
+    template <typename Node> static void visit_as(Derived &visitor, const ASTNode &node)
     {
+        visitor.Derived::visit(static_cast<const Node &>(node));
     }
-    void accept(Visitor &visitor) const override
+    static void skip(Derived &, const ASTNode &)
     {
-        visitor.visit(*this);
     }
+
+public:
+    void dispatch(const ASTNode &node);
 };
 
-struct Program : public ASTNode {
-    std::list<std::unique_ptr<VariableDecl> > global_vars;
-    std::list<std::unique_ptr<FunctionDecl> > functions;
-    std::list<std::unique_ptr<ExternFunctionDecl> > externs;
+template <typename Derived> inline void StaticVisitor<Derived>::dispatch(const ASTNode &node)
+{
+    // In the order of NodeKind.
+    static constexpr void (*const table[])(Derived &, const ASTNode &) = {
+        &StaticVisitor::visit_as<IntConst>,
+        &StaticVisitor::visit_as<StringConst>,
+        &StaticVisitor::visit_as<VariableRef>,
+        &StaticVisitor::visit_as<FunctionCall>,
+        &StaticVisitor::visit_as<UnaryExpression>,
+        &StaticVisitor::visit_as<BinaryExpression>,
+        &StaticVisitor::visit_as<IndexExpression>,
+        &StaticVisitor::visit_as<Block>,
+        &StaticVisitor::visit_as<VariableDecl>,
+        &StaticVisitor::skip, // Variable
+        &StaticVisitor::visit_as<AssignmentStatement>,
+        &StaticVisitor::visit_as<ReturnStatement>,
+        &StaticVisitor::visit_as<ExpressionStatement>,
+        &StaticVisitor::visit_as<IfStatement>,
+        &StaticVisitor::visit_as<ForStatement>,
+        &StaticVisitor::visit_as<WhileStatement>,
+        &StaticVisitor::skip, // Parameter
+        &StaticVisitor::visit_as<FunctionDecl>,
+        &StaticVisitor::visit_as<ExternFunctionDecl>,
+        &StaticVisitor::visit_as<Program>,
+    };
+    static_assert(std::size(table) == static_cast<std::size_t>(NodeKind::Program) + 1);
+    table[static_cast<std::size_t>(node.kind)](static_cast<Derived &>(*this), node);
+}
+
+// Forwards to the virtual Visitor interface, which costs a second indirect call per node.
+class VisitorAdapter : public StaticVisitor<VisitorAdapter> {
+    Visitor &visitor;
 
 public:
-    Program(std::list<std::unique_ptr<VariableDecl> > global_vars, std::list<std::unique_ptr<FunctionDecl> > functions,
-            std::list<std::unique_ptr<ExternFunctionDecl> > externs)
-        : global_vars(std::move(global_vars)), functions(std::move(functions)), externs(std::move(externs))
+    VisitorAdapter(Visitor &visitor) : visitor(visitor)
     {
     }
-    void accept(Visitor &visitor) const override
+    template <typename Node> void visit(const Node &node)
     {
-        visitor.visit(*this);
+        visitor.visit(node);
     }
 };
 
+inline void ASTNode::accept(Visitor &visitor) const
+{
+    VisitorAdapter{ visitor }.dispatch(*this);
+}
+
+// Checked downcast, null when the node is of another kind.
+template <typename Node> Node *node_cast(ASTNode *node) noexcept
+{
+    return node && node->kind == Node::node_kind ? static_cast<Node *>(node) : nullptr;
+}
+
+template <typename Node> const Node *node_cast(const ASTNode *node) noexcept
+{
+    return node && node->kind == Node::node_kind ? static_cast<const Node *>(node) : nullptr;
+}
+
 #endif
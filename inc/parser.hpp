@@ -3,101 +3,220 @@
 
 #include "lexer.hpp"
 #include "node.hpp"
+#include "spsc_queue.hpp"
 
-#include <stack>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Receives top-level declarations in source order as soon as they are parsed. The nodes stay owned by the parser until
+// parse() returns the program; cancel() is called before they are destroyed when parsing fails.
+class DeclarationSink {
+public:
+    virtual void declare(const ExternFunctionDecl &decl) = 0;
+    virtual void declare(const VariableDecl &decl) = 0;
+    virtual void declare(const FunctionDecl &decl) = 0;
+    virtual void cancel() noexcept = 0;
+    virtual ~DeclarationSink() = default;
+};
 
 class Parser {
     std::unique_ptr<Lexer> lexer;
+    std::shared_ptr<SourceManager> sources;
+    TokenBuffer tokens;
+    // The tokens being read: `tokens`, or those of the parser that handed this one a slice in parse_concurrently().
+    const TokenBuffer *stream = &tokens;
+    std::size_t cursor = 0;
     Token token;
+    DeclarationSink *sink = nullptr;
+    // Nodes of the program being parsed; handed over to the Program once parsing succeeds.
+    std::unique_ptr<Arena> nodes = std::make_unique<Arena>();
+
+    // A pipelined lexer runs on `producer` and hands tokens over in batches; the last batch ends with END_OF_FILE or
+    // carries the lexer's exception. It interns into the parsing thread's interner, which nothing else writes to
+    // meanwhile.
+    struct TokenBatch {
+        TokenBuffer tokens;
+        std::exception_ptr error;
+        bool last = false;
+    };
+    std::unique_ptr<SpscQueue<TokenBatch> > batches;
+    std::thread producer;
+    std::atomic<bool> stop_producer{ false };
+
+    // Top-level declarations in source order, one list per kind.
+    struct Declarations {
+        SmallVector<VariableDecl *> global_vars;
+        SmallVector<FunctionDecl *> functions;
+        SmallVector<ExternFunctionDecl *> externs;
+
+        void append(Declarations &other);
+    };
+
+    // Nesting of the part being parsed: enclosing blocks and the parentheses, call arguments and indices still open.
+    // Recursion in the parser and in the passes over statements is bounded by `depth_limit`; operator chains are not
+    // nesting, the passes walk expressions without recursing.
+    std::size_t depth_limit = default_depth_limit;
+    std::size_t depth = 0;
+
+    // Counts a level of nesting in `depth` for its lifetime.
+    class NestingGuard {
+        Parser &parser;
+
+    public:
+        NestingGuard(Parser &parser, const Position &position);
+        ~NestingGuard()
+        {
+            --parser.depth;
+        }
+    };
+
+    // Explicit stacks of parse_BinaryExpression(); a nested call only works above the entries of the one enclosing it.
+    struct PendingOperator {
+        // Binary waits for its right operand, Prefix and Negation for their operand and Paren for its `)`.
+        enum Kind : std::uint8_t { Binary, Prefix, Negation, Paren } kind;
+        // Binding strength of a Binary; for the others, the weakest operator allowed in what follows them.
+        int precedence;
+        BinaryOperator binary_op;
+        UnaryOperator unary_op;
+        Position position;
+    };
+    std::vector<Expression *> operands;
+    std::vector<PendingOperator> operators;
 
 private:
-    std::unique_ptr<Program> parse_Program();
-    std::unique_ptr<ExternFunctionDecl> parse_ExternFunctionDecl();
-    std::unique_ptr<FunctionDecl> parse_FunctionDecl();
-    std::unique_ptr<VariableDecl> parse_VariableDecl();
+    std::unique_ptr<Program> parse_Program(std::size_t threads);
+    std::unique_ptr<Program> make_program(const Declarations &declarations);
+    bool parse_Declaration(Declarations &declarations);
+    void parse_concurrently(Declarations &declarations, std::size_t threads);
+    bool parse_slice(const Parser &parent, std::size_t begin, std::size_t end, Declarations &declarations) noexcept;
+    std::vector<std::size_t> split_declarations(std::size_t parts) const;
+    ExternFunctionDecl *parse_ExternFunctionDecl();
+    FunctionDecl *parse_FunctionDecl();
+    VariableDecl *parse_VariableDecl();
     VariableDecl::SingleVarDecl parse_SingleVarDecl();
     BuiltinType parse_Type();
-    std::list<FunctionDecl::Parameter> parse_ParameterList();
+    Span<FunctionDecl::Parameter> parse_ParameterList();
     std::optional<FunctionDecl::Parameter> parse_SingleParameter();
-    std::unique_ptr<Block> parse_Block();
-
-    std::unique_ptr<Expression> parse_ConditionalExpression();
-    std::unique_ptr<Expression> parse_UnaryLogicalExpr();
-    std::unique_ptr<Expression> parse_LogicalExpr();
-    std::unique_ptr<Expression> parse_ArithmeticalExpr();
-    std::unique_ptr<Expression> parse_AdditiveExpr();
-    std::unique_ptr<Expression> parse_MultiplicativeExpr();
-    std::unique_ptr<Expression> parse_UnaryExpression();
-    std::unique_ptr<Expression> parse_Factor();
-    std::unique_ptr<FunctionCall> parse_FunctionCall(const Position &position, std::wstring name);
-    std::list<std::unique_ptr<Expression> > parse_CallArgumentList();
-    std::unique_ptr<Expression> parse_IndexExpression();
-    std::unique_ptr<ExpressionStatement> parse_ExpressionStatement();
-    std::pair<std::unique_ptr<Expression>, std::unique_ptr<Block> > parse_ConditionalBlock();
-
-    std::unique_ptr<IntConst> parse_IntConst();
-    std::unique_ptr<StringConst> parse_StringConst();
-    std::unique_ptr<Expression> parse_FuncCallOrVariableRef();
-    std::unique_ptr<Expression> parse_NestedExpression();
-
-    std::unique_ptr<Statement> parse_Statement();
-    std::unique_ptr<IfStatement> parse_IfStatement();
-    std::unique_ptr<ForStatement> parse_ForStatement();
-    std::tuple<std::unique_ptr<Expression>, std::unique_ptr<Expression>, std::optional<std::unique_ptr<Expression> > >
-    parse_Range();
-    std::unique_ptr<WhileStatement> parse_WhileStatement();
-    std::unique_ptr<ReturnStatement> parse_ReturnSatetemnt();
-    std::unique_ptr<Statement> parse_AssignStatement();
-
-    void advance() noexcept;
-    BuiltinType get_builtin_type(const std::wstring &wstr) const;
+    Block *parse_Block();
+
+    Expression *parse_ConditionalExpression();
+    Expression *parse_ArithmeticalExpr();
+    Expression *parse_BinaryExpression(int min_precedence);
+    Expression *parse_Factor();
+    FunctionCall *parse_FunctionCall(const Position &position, Symbol name);
+    Span<Expression *> parse_CallArgumentList();
+    Expression *parse_IndexExpression();
+    ExpressionStatement *parse_ExpressionStatement();
+    IfStatement::ConditionalBlock parse_ConditionalBlock();
+
+    IntConst *parse_IntConst();
+    StringConst *parse_StringConst();
+    Expression *parse_FuncCallOrVariableRef();
+
+    Statement *parse_Statement();
+    IfStatement *parse_IfStatement();
+    ForStatement *parse_ForStatement();
+    std::tuple<Expression *, Expression *, Expression *> parse_Range();
+    WhileStatement *parse_WhileStatement();
+    ReturnStatement *parse_ReturnSatetemnt();
+    Statement *parse_AssignStatement();
+
+    template <typename Node, typename... Args> Node *make(Args &&... args)
+    {
+        return nodes->make<Node>(std::forward<Args>(args)...);
+    }
+
+    void advance();
+    Token peek(std::size_t distance = 1);
+    BuiltinType get_builtin_type(Symbol name);
+
+    void produce_tokens(Lexer &lex, Interner &names);
+    void receive_tokens();
+    void stop_lexing() noexcept;
+    std::wstring snippet(const Position &position);
 
     [[noreturn]] void report_unexpected_token(const std::wstring &msg);
     [[noreturn]] void report_expected_expression();
-    [[noreturn]] void report_invalid_type() const;
+    [[noreturn]] void report_invalid_type();
     [[noreturn]] void report_expected_parameter();
+    [[noreturn]] void report_nested_too_deeply(const Position &position);
 
     [[noreturn]] void report_error(const Position &start, const Position &end, const std::wstring &error_msg);
 
-    template <typename... Types> void expect(const std::wstring &msg, Types &&... types);
+    template <typename... Types> void expect(const wchar_t *msg, Types &&... types);
 
-    template <typename... Types> void eat(const std::wstring &msg, Types &&... types);
+    template <typename... Types> void eat(const wchar_t *msg, Types &&... types);
 
 public:
+    // Deep enough for any hand-written program while the recursive passes over it stay within a default thread stack,
+    // sanitizers included.
+    static constexpr std::size_t default_depth_limit = 2000;
+
     Parser() = default;
+    ~Parser();
 
-    std::unique_ptr<Lexer> attach_lexer(std::unique_ptr<Lexer> lex) noexcept;
+    std::unique_ptr<Lexer> attach_lexer(std::unique_ptr<Lexer> lex, bool pipelined = false);
+    // Replays tokens recorded from `lex` earlier; they must end with END_OF_FILE.
+    std::unique_ptr<Lexer> attach_lexer(std::unique_ptr<Lexer> lex, TokenBuffer recorded);
     std::unique_ptr<Lexer> detach_lexer() noexcept;
-    std::unique_ptr<Program> parse();
+    // Programs nested deeper than `limit` levels are rejected with a ParserException instead of overflowing the stack.
+    void set_depth_limit(std::size_t limit) noexcept;
+    // Parses the bodies of top-level declarations on up to `threads` threads once all tokens are known; with a
+    // pipelined lexer or a sink the declarations are parsed in order on the calling thread.
+    std::unique_ptr<Program> parse(std::size_t threads = std::thread::hardware_concurrency());
+    std::unique_ptr<Program> parse(DeclarationSink &declarations);
+    // Parses like parse() but leaves the nodes in the parser's arena, so that the programs parsed from one input after
+    // another share it; they do not own it and must not outlive what take_nodes() returns. A part that fails to parse
+    // leaves the nodes of the others intact.
+    std::unique_ptr<Program> parse_part();
+    std::unique_ptr<Arena> take_nodes() noexcept;
 };
 
 class ParserException : public std::runtime_error {
     std::wstring msg;
     std::string ascii_msg;
+    std::wstring error;
+    std::optional<Position> where;
 
 public:
     ParserException(const std::wstring &wstr)
-        : std::runtime_error("ParserException"), msg(wstr), ascii_msg(to_ascii_string(msg))
+        : std::runtime_error("ParserException"), msg(wstr), ascii_msg(to_ascii_string(msg)), error(wstr)
+    {
+    }
+    // `error` is the message without the excerpt of the source.
+    ParserException(const std::wstring &wstr, const std::wstring &error, const Position &position)
+        : std::runtime_error("ParserException"), msg(wstr), ascii_msg(to_ascii_string(msg)), error(error),
+          where(position)
     {
     }
     const std::wstring &message() const noexcept
     {
         return msg;
     }
+    const std::wstring &description() const noexcept
+    {
+        return error;
+    }
+    const std::optional<Position> &position() const noexcept
+    {
+        return where;
+    }
     const char *what() const noexcept override
     {
         return ascii_msg.c_str();
     }
 };
 
-template <typename... Types> void Parser::expect(const std::wstring &msg, Types &&... types)
+template <typename... Types> void Parser::expect(const wchar_t *msg, Types &&... types)
 {
     if (!is_one_of(token, std::forward<Types>(types)...)) {
         report_unexpected_token(msg);
     }
 }
 
-template <typename... Types> void Parser::eat(const std::wstring &msg, Types &&... types)
+template <typename... Types> void Parser::eat(const wchar_t *msg, Types &&... types)
 {
     expect(msg, std::forward<Types>(types)...);
     advance();
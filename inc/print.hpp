@@ -6,7 +6,7 @@
 
 #include <string>
 
-class PrintVisitor : public Visitor {
+class PrintVisitor : public Visitor, public StaticVisitor<PrintVisitor> {
     std::size_t ident;
     std::wstring str;
 
@@ -2,19 +2,32 @@
 #define __SEMANTIC_HPP__
 
 #include "common.hpp"
+#include "flat_ast.hpp"
 #include "node.hpp"
+#include "parser.hpp"
+#include "source_manager.hpp"
+#include "spsc_queue.hpp"
+#include "traversal.hpp"
 #include "visitor.hpp"
 
 #include <algorithm>
 #include <deque>
+#include <list>
 #include <memory>
 #include <optional>
 #include <stack>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <variant>
 
-class SemanticAnalyser : public Visitor {
-    std::unique_ptr<Source> source;
+class SemanticAnalyser : public Visitor, public StaticVisitor<SemanticAnalyser> {
+    friend class IncrementalAnalyser;
+    friend class Document;
+    template <typename Expressions> friend class ExpressionWalker;
+    std::shared_ptr<SourceManager> sources;
+    const FlatAst *ast = nullptr;
 
 public:
     enum class ExprType { Int, String, IntPointer, IntPointerReference, IntReference, StringReference, Bool };
@@ -24,13 +37,35 @@ private:
 
     struct Function {
         BuiltinType return_type;
-        std::list<std::pair<std::wstring, BuiltinType> > parameters;
+        std::list<std::pair<Symbol, BuiltinType> > parameters;
+        std::size_t order = 0;
     };
 
-    std::stack<std::pair<ExprType, Position> > stack;
+    std::stack<std::pair<ExprType, Position>, std::vector<std::pair<ExprType, Position> > > stack;
     std::stack<bool> has_return;
-    std::deque<std::unordered_map<std::wstring, BuiltinType> > scopes;
-    std::unordered_map<std::wstring, Function> functions;
+    std::deque<std::unordered_map<Symbol, BuiltinType> > scopes;
+    std::unordered_map<Symbol, Function> functions;
+    // Functions are numbered in declaration order and only those below `declared_functions` are visible. Document keeps
+    // every function of a program in `functions` and checks them one at a time by moving this back to their number.
+    std::size_t declared_functions = 0;
+
+    // Expressions are walked without recursion; a call being walked keeps its callee and the parameter of the next
+    // argument here.
+    struct Call {
+        const Function *function;
+        std::list<std::pair<Symbol, BuiltinType> >::const_iterator parameter;
+    };
+    std::vector<Call> calls;
+    ExpressionWalker<TreeExpressions> tree_walker;
+    ExpressionWalker<FlatExpressions> flat_walker;
+
+    template <NodeKind kind, typename Expressions>
+    void enter_node(const Expressions &expressions, typename Expressions::Node node);
+    template <NodeKind kind, typename Expressions>
+    void child_done(const Expressions &expressions, typename Expressions::Node node, std::size_t index);
+    template <NodeKind kind, typename Expressions>
+    void leave_node(const Expressions &expressions, typename Expressions::Node node);
+    void analyse_expression(const Expression &expr);
 
     void ignore_return(std::size_t depth);
     void yield_return();
@@ -39,13 +74,15 @@ private:
     void yield_return_one(std::size_t depth);
     void assert_returns(const Position &pos);
 
-    template <typename Node> void analyse(const std::unique_ptr<Node> &node);
+    template <typename Node> void analyse(const Node *node);
+    void analyse(NodeIndex node);
+    void analyse_function(NodeIndex node);
     template <typename... Types> void require(Types &&... types);
     void ignore();
     template <typename... Types> bool is_one_of(ExprType first, Types &&... types);
     bool is_one_of(ExprType allowed);
     ExprType pop();
-    void check_id(const std::wstring &name, const Position &position) const;
+    void check_id(Symbol name, const Position &position) const;
 
     void yield(ExprType type, const Position &pos);
 
@@ -53,36 +90,48 @@ private:
     void leave();
     ExprType from_builtin_type(BuiltinType type);
     ExprType from_builtin_type_value(BuiltinType type);
-    BuiltinType get_var(const VariableRef &var) const;
-    void declare_var(const VariableDecl::SingleVarDecl &expr);
-    bool check_var_name(const std::wstring &name);
-    bool is_in_scope(const std::wstring &name, const std::unordered_map<std::wstring, BuiltinType> &variables) const;
-    BuiltinType var_from_scope(const std::wstring &name,
-                               const std::unordered_map<std::wstring, BuiltinType> &scope) const;
-    const Function &function_from_name(const std::wstring &name, const Position &pos);
-    void check_assignable_by(const std::unique_ptr<Expression> &expr, SemanticAnalyser::ExprType rhs);
-    void check_assignable_by(BuiltinType type, const std::unique_ptr<Expression> &expr);
-    void check_main_function(const FunctionDecl &decl);
+    BuiltinType get_var(Symbol name, const Position &position) const;
+    void declare_var(Symbol name, BuiltinType type, const Position &position);
+    bool check_var_name(Symbol name);
+    bool is_in_scope(Symbol name, const std::unordered_map<Symbol, BuiltinType> &variables) const;
+    BuiltinType var_from_scope(Symbol name, const std::unordered_map<Symbol, BuiltinType> &scope) const;
+    const Function &function_from_name(Symbol name, const Position &pos);
+    const Function &callee(Symbol name, std::size_t arguments, const Position &position);
+    void check_unary(UnaryOperator op, const Position &pos);
+    void check_binary(BinaryOperator op, const Position &pos);
+    void require_pointer();
+    void require_index(const Position &pos);
+    template <typename Node> void check_assignable_by(Node expr, SemanticAnalyser::ExprType rhs);
+    template <typename Node> void check_assignable_by(BuiltinType type, Node expr);
+    void require_assignable_from(SemanticAnalyser::ExprType rhs);
+    void require_assignable_to(BuiltinType type);
+    void check_function_name(Symbol name, const Position &position);
+    void declare_function(Symbol name, Function declaration);
+    void declare_parameter(Function &function, Symbol name, BuiltinType type, const Position &position);
+    void check_main_function(Symbol name, BuiltinType return_type, const Position &position,
+                             const Position *first_parameter);
 
+    std::wstring snippet(const Position &position) const;
     template <typename... Types>[[noreturn]] void report_bad_type(Types &&... allowed) const;
-    [[noreturn]] void report_reserved_word(const std::wstring &word, const Position &pos) const;
-    [[noreturn]] void report_undefined_variable(const std::wstring &name, const Position &pos) const;
-    [[noreturn]] void report_undefined_function(const std::wstring &name, const Position &pos) const;
+    [[noreturn]] void report_reserved_word(Symbol word, const Position &pos) const;
+    [[noreturn]] void report_undefined_variable(Symbol name, const Position &pos) const;
+    [[noreturn]] void report_undefined_function(Symbol name, const Position &pos) const;
     [[noreturn]] void report_invalid_argument(ExprType expected, const Position &pos) const;
     [[noreturn]] void report_argument_number_mismatch(std::size_t expected, std::size_t got, const Position &pos) const;
-    [[noreturn]] void report_variable_redeclaration(const std::wstring &name, const Position &pos) const;
-    [[noreturn]] void report_function_redeclaration(const std::wstring &name, const Position &pos) const;
-    [[noreturn]] void report_parameter_redeclaration(const std::wstring &name, const Position &pos) const;
+    [[noreturn]] void report_variable_redeclaration(Symbol name, const Position &pos) const;
+    [[noreturn]] void report_function_redeclaration(Symbol name, const Position &pos) const;
+    [[noreturn]] void report_parameter_redeclaration(Symbol name, const Position &pos) const;
     [[noreturn]] void report_no_return(const Position &position) const;
     [[noreturn]] void report_main_bad_params(const Position &pos) const;
     [[noreturn]] void report_main_bad_return_type(const Position &pos) const;
+    [[noreturn]] void report_error(const Position &position, const std::wstring &error) const;
 
     template <typename... Types> static std::wstring repr(ExprType first, Types &&... types);
     static std::wstring repr(ExprType type);
-    static const std::unordered_set<std::wstring> reserved_words;
+    static const std::unordered_set<Symbol> reserved_words;
 
 public:
-    SemanticAnalyser(std::unique_ptr<Source> source) : source(std::move(source))
+    SemanticAnalyser(std::shared_ptr<SourceManager> sources) : sources(std::move(sources))
     {
     }
     void visit(const UnaryExpression &) override;
@@ -103,23 +152,78 @@ public:
     void visit(const WhileStatement &) override;
     void visit(const Program &) override;
     void visit(const ExternFunctionDecl &) override;
+
+    // Same checks, in the same order, on the flat form of the program.
+    void analyse(const FlatAst &program);
 };
 
-void analyse(const std::unique_ptr<Program> &program, std::unique_ptr<Source> source);
+void analyse(const std::unique_ptr<Program> &program, std::shared_ptr<SourceManager> sources);
+void analyse(const FlatAst &program, std::shared_ptr<SourceManager> sources);
+
+// Checks top-level declarations on a worker thread while the parser is still producing them. They are checked in
+// source order, which agrees with analyse() as long as every extern and global variable comes before the first
+// function. Otherwise, or when a check fails, finish() analyses the whole program again so the verdict and the error
+// message are exactly those of analyse().
+class IncrementalAnalyser : public DeclarationSink {
+    typedef std::variant<std::monostate, const ExternFunctionDecl *, const VariableDecl *, const FunctionDecl *>
+        Declaration;
+
+    std::shared_ptr<SourceManager> sources;
+    // That of the thread which made the analyser; the worker only reads names from it.
+    Interner &names;
+    SemanticAnalyser analyser;
+    SpscQueue<Declaration> declarations;
+    std::thread worker;
+    bool seen_function;
+    bool valid;
+
+    void run();
+    void check(std::monostate);
+    void check(const ExternFunctionDecl *decl);
+    void check(const VariableDecl *decl);
+    void check(const FunctionDecl *decl);
+    void stop() noexcept;
+
+public:
+    IncrementalAnalyser(std::shared_ptr<SourceManager> sources);
+    ~IncrementalAnalyser();
+
+    void declare(const ExternFunctionDecl &decl) override;
+    void declare(const VariableDecl &decl) override;
+    void declare(const FunctionDecl &decl) override;
+    void cancel() noexcept override;
+    void finish(const std::unique_ptr<Program> &program);
+};
 
 class SemanticException : public std::runtime_error {
     std::wstring msg;
     std::string ascii_msg;
+    std::wstring error;
+    std::optional<Position> where;
 
 public:
     SemanticException(const std::wstring &wstr)
-        : std::runtime_error("ParserException"), msg(wstr), ascii_msg(to_ascii_string(msg))
+        : std::runtime_error("ParserException"), msg(wstr), ascii_msg(to_ascii_string(msg)), error(wstr)
+    {
+    }
+    // `error` is the message without the excerpt of the source.
+    SemanticException(const std::wstring &wstr, const std::wstring &error, const Position &position)
+        : std::runtime_error("ParserException"), msg(wstr), ascii_msg(to_ascii_string(msg)), error(error),
+          where(position)
     {
     }
     const std::wstring &message() const noexcept
     {
         return msg;
     }
+    const std::wstring &description() const noexcept
+    {
+        return error;
+    }
+    const std::optional<Position> &position() const noexcept
+    {
+        return where;
+    }
     const char *what() const noexcept override
     {
         return ascii_msg.c_str();
@@ -153,15 +257,29 @@ template <typename... Types> std::wstring SemanticAnalyser::repr(SemanticAnalyse
 template <typename... Allowed> void SemanticAnalyser::report_bad_type(Allowed &&... allowed) const
 {
     const auto [got, position] = stack.top();
-    throw SemanticException{ concat(position_in_file(position), L"\n In \n",
-                                    source->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                    error_marker(position), L"\n\n", L"Error expected one of type `", repr(allowed...),
-                                    L"` but instead got `", repr(got), L"`\n") };
+    report_error(position, concat(L"Error expected one of type `", repr(allowed...), L"` but instead got `", repr(got),
+                                  L"`\n"));
+}
+
+template <typename Node> void SemanticAnalyser::analyse(const Node *node)
+{
+    if constexpr (std::is_same_v<Node, Expression>) {
+        tree_walker.walk(*this, TreeExpressions{}, node);
+    } else {
+        dispatch(*node);
+    }
+}
+
+template <typename Node> void SemanticAnalyser::check_assignable_by(Node expr, SemanticAnalyser::ExprType rhs)
+{
+    analyse(expr);
+    require_assignable_from(rhs);
 }
 
-template <typename Node> void SemanticAnalyser::analyse(const std::unique_ptr<Node> &node)
+template <typename Node> void SemanticAnalyser::check_assignable_by(BuiltinType type, Node expr)
 {
-    node->accept(*this);
+    analyse(expr);
+    require_assignable_to(type);
 }
 
 #endif
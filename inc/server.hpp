@@ -0,0 +1,37 @@
+#ifndef __SERVER_HPP__
+#define __SERVER_HPP__
+
+#include "document.hpp"
+
+#include <boost/property_tree/ptree.hpp>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Language server speaking LSP over a pair of streams: JSON-RPC messages framed by Content-Length headers. Documents
+// are synchronised incrementally and every change is answered with the diagnostics of the whole document.
+class LanguageServer {
+    std::istream &in;
+    std::ostream &out;
+    std::unordered_map<std::string, std::unique_ptr<Document> > documents;
+    bool shut_down = false;
+    std::optional<int> exit_code;
+
+    std::optional<std::string> read_message();
+    void write_message(const std::string &content);
+    void handle(const boost::property_tree::ptree &message);
+    void respond(const std::optional<std::string> &id, const std::string &result);
+    void respond_error(const std::optional<std::string> &id, int code, const std::string &message);
+    void change(const boost::property_tree::ptree &params);
+    void publish(const std::string &uri, const Document *document);
+
+public:
+    LanguageServer(std::istream &in, std::ostream &out);
+    // Serves until the client asks the server to exit or closes the input and returns the exit code the protocol
+    // prescribes for that.
+    int run();
+};
+
+#endif
@@ -1,78 +1,224 @@
 #ifndef __SOURCE_HPP__
 #define __SOURCE_HPP__
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
 
 struct Position {
+    std::uint32_t location;
+};
+
+// `line_number` and `column_number` count from 1. Both are 0 when the line holding the offset is no longer kept, as
+// happens behind a stream window; only `stream_position` is known then.
+struct SourcePosition {
+    std::string file;
     std::size_t stream_position;
     std::size_t line_number;
     std::size_t column_number;
 };
 
 std::wstring to_wstring(const Position &position);
+std::wstring to_wstring(const SourcePosition &position);
 
 class Source {
-    Position current_position;
-    std::unordered_map<std::size_t, Position> line_position;
+    std::vector<std::size_t> line_starts;
+    std::size_t forgotten_lines;
+    // Text before this offset has been dropped.
+    std::size_t forgotten_bytes;
+    std::atomic<std::size_t> retained;
+    std::atomic<bool> consumer_waiting;
+    std::mutex retention;
+    std::condition_variable released;
+    mutable std::size_t line_hint;
+    std::atomic<std::size_t> consumed;
     Source(const Source &) = delete;
 
+    void index_lines(std::string_view chunk);
+
 protected:
+    static constexpr std::size_t chunk_size = 1 << 16;
+
     Source();
-    void update_position(wchar_t ch);
+    virtual std::string_view read_chunk() = 0;
+    void forget_lines_before(std::size_t offset);
+    // Start of the line holding the retained offset; text from there on has to be kept. SIZE_MAX when nothing is.
+    std::size_t retained_line_start() const;
+    // How much of the text before `offset` may be dropped. While the consumer still has input, this waits for it to
+    // release the text rather than let the reader outrun it.
+    std::size_t wait_for_release(std::size_t offset);
+    void validate(std::string_view chunk) const;
 
 public:
-    virtual std::optional<wchar_t> next() noexcept = 0;
-    const Position &get_position() const noexcept;
-    virtual std::wstring input_between(const Position &start, const Position &end) = 0;
+    std::string_view next_chunk();
+    std::size_t consumed_size() const noexcept;
+    // Keeps the lines from `offset` on however far reading gets past them, so that diagnostics can still show them.
+    // Meant for a consumer on another thread than the reader; the offset only ever moves forward.
+    void retain_from(std::size_t offset) noexcept;
+    // Set by the consumer while it has nothing left to read, so that the reader goes on past retained text.
+    void wait_for_input(bool waiting) noexcept;
+    virtual std::string input_between(std::size_t start, std::size_t end) const = 0;
+    // Whether every returned chunk stays valid for the lifetime of the source.
+    virtual bool keeps_chunks() const noexcept;
+    // Total input size in bytes when known up front, otherwise 0.
+    virtual std::size_t size_hint() const noexcept;
     std::wstring get_lines(std::size_t from, std::size_t to);
+    std::wstring get_line(std::size_t line);
+
+    std::size_t line_count() const noexcept;
+    std::size_t line_offset(std::size_t line) const;
+    SourcePosition position_of(std::size_t offset) const;
 
     virtual ~Source();
 
     static void report_error(const std::string &msg);
-    static std::unique_ptr<Source> from_file(const std::string &path);
-    static std::unique_ptr<Source> from_stdin();
+    static std::unique_ptr<Source> from_file(const std::string &path, std::size_t window_size = 0);
+    static std::unique_ptr<Source> from_stdin(std::size_t window_size = 0);
+    static std::unique_ptr<Source> from_string(const std::string &str);
     static std::unique_ptr<Source> from_wstring(const std::wstring &str);
 };
 
-class FileSource : public Source {
-    std::wfstream file;
+class StreamSource : public Source {
+    std::string window;
+    std::size_t window_start;
+    std::size_t window_size;
+    std::size_t tail;
+
+protected:
+    StreamSource(std::size_t window_size);
+    std::string_view read_chunk() override;
+    virtual std::istream &stream() noexcept = 0;
+
+public:
+    std::string input_between(std::size_t start, std::size_t end) const override;
+};
+
+class FileSource : public StreamSource {
+    std::ifstream file;
     FileSource(const FileSource &) = delete;
 
+protected:
+    std::istream &stream() noexcept override;
+
 public:
-    FileSource(const std::string &path);
+    FileSource(const std::string &path, std::size_t window_size = 0);
     ~FileSource();
+};
+
+class MappedFileSource : public Source {
+    const char *data;
+    std::size_t size;
+    bool done;
+    MappedFileSource(const MappedFileSource &) = delete;
+
+protected:
+    std::string_view read_chunk() override;
 
-    std::optional<wchar_t> next() noexcept override;
-    std::wstring input_between(const Position &start, const Position &end) override;
+public:
+    MappedFileSource(const std::string &path);
+    ~MappedFileSource();
+
+    std::string input_between(std::size_t start, std::size_t end) const override;
+    bool keeps_chunks() const noexcept override;
+    std::size_t size_hint() const noexcept override;
+};
+
+struct gzFile_s;
+
+class GzipBuffer : public std::streambuf {
+    gzFile_s *file;
+    std::vector<char> buffer;
+    GzipBuffer(const GzipBuffer &) = delete;
+
+protected:
+    int_type underflow() override;
+
+public:
+    GzipBuffer(const std::string &path, std::size_t buffer_size);
+    ~GzipBuffer();
 };
 
-class StdInSource : public Source {
-    std::wstring source_code;
-    std::wistream source_stream;
+class GzipSource : public StreamSource {
+    GzipBuffer buffer;
+    std::istream source_stream;
+    GzipSource(const GzipSource &) = delete;
+
+protected:
+    std::istream &stream() noexcept override;
+
+public:
+    GzipSource(const std::string &path, std::size_t window_size = 0);
+};
+
+#ifdef HAVE_ZSTD
+struct ZSTD_DCtx_s;
+
+class ZstdBuffer : public std::streambuf {
+    std::ifstream file;
+    ZSTD_DCtx_s *context;
+    std::vector<char> input;
+    std::size_t input_pos;
+    std::size_t input_size;
+    std::vector<char> buffer;
+    bool frame_done;
+    bool output_full;
+    ZstdBuffer(const ZstdBuffer &) = delete;
+
+protected:
+    int_type underflow() override;
+
+public:
+    ZstdBuffer(const std::string &path, std::size_t buffer_size);
+    ~ZstdBuffer();
+};
+
+class ZstdSource : public StreamSource {
+    ZstdBuffer buffer;
+    std::istream source_stream;
+    ZstdSource(const ZstdSource &) = delete;
+
+protected:
+    std::istream &stream() noexcept override;
+
+public:
+    ZstdSource(const std::string &path, std::size_t window_size = 0);
+};
+#endif
+
+class StdInSource : public StreamSource {
+    std::istream source_stream;
     StdInSource(const StdInSource &) = delete;
 
+protected:
+    std::istream &stream() noexcept override;
+
 public:
-    StdInSource();
+    StdInSource(std::size_t window_size = 0);
     ~StdInSource();
-
-    std::optional<wchar_t> next() noexcept override;
-    std::wstring input_between(const Position &start, const Position &end) override;
 };
 
 class StringSource : public Source {
-    std::wstringstream source_stream;
+    std::string source_code;
+    bool done;
+
+protected:
+    std::string_view read_chunk() override;
 
 public:
-    StringSource(const std::wstring &source);
+    StringSource(const std::string &source);
     ~StringSource();
 
-    std::optional<wchar_t> next() noexcept override;
-    std::wstring input_between(const Position &start, const Position &end) override;
+    std::string input_between(std::size_t start, std::size_t end) const override;
+    bool keeps_chunks() const noexcept override;
+    std::size_t size_hint() const noexcept override;
 };
 
 class SourceException : public std::runtime_error {
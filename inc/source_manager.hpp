@@ -0,0 +1,50 @@
+#ifndef __SOURCE_MANAGER_HPP__
+#define __SOURCE_MANAGER_HPP__
+
+#include "arena.hpp"
+#include "source.hpp"
+#include "token.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// Buffers share one 32-bit location space; every buffer is assigned the range right after the previous one, so a
+// buffer must be fully consumed before the next one is added.
+class SourceManager {
+    struct Buffer {
+        std::string name;
+        std::unique_ptr<Source> source;
+        std::uint32_t base;
+    };
+    std::vector<Buffer> buffers;
+    std::vector<std::string_view> literals;
+    StringArena literal_copies;
+    mutable std::shared_mutex literal_mutex;
+
+    const Buffer &buffer_of(const Position &position) const;
+
+public:
+    typedef std::size_t BufferId;
+    static constexpr std::uint32_t max_location = UINT32_MAX;
+
+    BufferId add(std::unique_ptr<Source> source, std::string name = "");
+    std::size_t buffer_count() const noexcept;
+    Source &source(BufferId id) const;
+    const std::string &name(BufferId id) const;
+    std::uint32_t base(BufferId id) const;
+
+    SourcePosition decode(const Position &position) const;
+    std::string input_between(const Position &start, const Position &end) const;
+    std::wstring get_line(const Position &position) const;
+    std::wstring snippet(const Position &position) const;
+
+    // String literal text is kept with its escape sequences; views into sources that keep their chunks are stored
+    // as is, anything else is copied. A pipelined lexer adds literals while the parser reads them.
+    std::uint32_t add_literal(std::string_view raw, bool copy);
+    std::string_view literal(const Token &token) const;
+};
+
+#endif
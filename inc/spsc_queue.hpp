@@ -0,0 +1,107 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded lock-free ring for exactly one producer and one consumer thread. An end that finds the ring full or empty
+// yields for a few rounds, which is enough when the stages keep pace with each other, and then sleeps until the other
+// end pops or pushes, so that a stage that falls behind gets the core to itself.
+template <typename Value> class SpscQueue {
+    static constexpr int spin_rounds = 64;
+
+    std::vector<Value> slots;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+    // Set by an end about to sleep; the other end takes the mutex to wake it only then.
+    alignas(64) std::atomic<bool> producer_sleeps;
+    std::atomic<bool> consumer_sleeps;
+    std::mutex mutex;
+    std::condition_variable popped;
+    std::condition_variable pushed;
+
+    template <typename Ready> void wait(std::atomic<bool> &sleeps, std::condition_variable &woken, Ready ready);
+    void wake(std::atomic<bool> &sleeps, std::condition_variable &woken);
+
+public:
+    explicit SpscQueue(std::size_t capacity);
+
+    void push(Value value);
+    Value pop();
+    // Only meaningful on the consumer's thread.
+    bool empty() const noexcept;
+};
+
+template <typename Value>
+SpscQueue<Value>::SpscQueue(std::size_t capacity)
+    : head(0), tail(0), producer_sleeps(false), consumer_sleeps(false)
+{
+    std::size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots.resize(size);
+    mask = size - 1;
+}
+
+// `sleeps` is raised before `ready` is checked for the last time and the other end changes the ring before it looks at
+// `sleeps`, both sequentially consistent, so either this end sees the change or the other one sees it sleeping.
+template <typename Value>
+template <typename Ready>
+void SpscQueue<Value>::wait(std::atomic<bool> &sleeps, std::condition_variable &woken, Ready ready)
+{
+    for (int round = 0; round < spin_rounds; ++round) {
+        if (ready()) {
+            return;
+        }
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    sleeps.store(true);
+    woken.wait(lock, ready);
+    sleeps.store(false, std::memory_order_relaxed);
+}
+
+template <typename Value> void SpscQueue<Value>::wake(std::atomic<bool> &sleeps, std::condition_variable &woken)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeps.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        woken.notify_one();
+    }
+}
+
+template <typename Value> void SpscQueue<Value>::push(Value value)
+{
+    const auto position = tail.load(std::memory_order_relaxed);
+    if (position - head.load(std::memory_order_acquire) == slots.size()) {
+        wait(producer_sleeps, popped, [&] { return position - head.load() != slots.size(); });
+    }
+    slots[position & mask] = std::move(value);
+    tail.store(position + 1, std::memory_order_release);
+    wake(consumer_sleeps, pushed);
+}
+
+template <typename Value> Value SpscQueue<Value>::pop()
+{
+    const auto position = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == position) {
+        wait(consumer_sleeps, pushed, [&] { return tail.load() != position; });
+    }
+    Value value = std::move(slots[position & mask]);
+    head.store(position + 1, std::memory_order_release);
+    wake(producer_sleeps, popped);
+    return value;
+}
+
+template <typename Value> bool SpscQueue<Value>::empty() const noexcept
+{
+    return tail.load(std::memory_order_acquire) == head.load(std::memory_order_relaxed);
+}
+
+#endif
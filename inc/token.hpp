@@ -1,15 +1,18 @@
 #ifndef __TOKEN_HPP__
 #define __TOKEN_HPP__
 
+#include "interner.hpp"
 #include "source.hpp"
 
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
-#include <variant>
+#include <vector>
 
-enum class TokenType {
+enum class TokenType : std::uint16_t {
     IDENTIFIER = 0,
     KEYWORD,
     INTCONST,
@@ -73,13 +76,64 @@ enum class TokenType {
     INVALID = 0x1'000
 };
 
+// Trivially copyable; the text of a lexeme is recovered from its position and length.
 struct Token {
     TokenType type;
     Position position;
-    std::variant<int, // INT_CONST
-                 std::wstring // STRING_CONST
-                 >
-        value;
+    std::uint32_t length;
+    std::uint32_t payload; // INTCONST value, IDENTIFIER symbol id or STRINGCONST literal index
+};
+static_assert(std::is_trivially_copyable_v<Token> && sizeof(Token) == 16);
+
+// Structure-of-arrays token stream filled by Lexer::tokenize_all(); the last token is always END_OF_FILE.
+class TokenBuffer {
+    std::vector<TokenType> types;
+    std::vector<std::uint32_t> locations;
+    std::vector<std::uint32_t> lengths;
+    std::vector<std::uint32_t> payloads;
+
+public:
+    void push_back(const Token &token)
+    {
+        types.push_back(token.type);
+        locations.push_back(token.position.location);
+        lengths.push_back(token.length);
+        payloads.push_back(token.payload);
+    }
+    void append(const TokenBuffer &other, std::size_t from)
+    {
+        append(other, from, other.size());
+    }
+    void append(const TokenBuffer &other, std::size_t from, std::size_t to)
+    {
+        types.insert(types.end(), other.types.begin() + from, other.types.begin() + to);
+        locations.insert(locations.end(), other.locations.begin() + from, other.locations.begin() + to);
+        lengths.insert(lengths.end(), other.lengths.begin() + from, other.lengths.begin() + to);
+        payloads.insert(payloads.end(), other.payloads.begin() + from, other.payloads.begin() + to);
+    }
+    void set_payload(std::size_t index, std::uint32_t payload) noexcept
+    {
+        payloads[index] = payload;
+    }
+    void reserve(std::size_t count)
+    {
+        types.reserve(count);
+        locations.reserve(count);
+        lengths.reserve(count);
+        payloads.reserve(count);
+    }
+    std::size_t size() const noexcept
+    {
+        return types.size();
+    }
+    TokenType type(std::size_t index) const noexcept
+    {
+        return types[index];
+    }
+    Token operator[](std::size_t index) const noexcept
+    {
+        return Token{ types[index], Position{ locations[index] }, lengths[index], payloads[index] };
+    }
 };
 
 bool is_expr_operator(const Token &token);
@@ -107,14 +161,15 @@ inline bool is_one_of(const Token &)
 }
 
 std::optional<int> get_int(const Token &token);
-std::optional<std::wstring> get_string(const Token &token);
+std::optional<Symbol> get_symbol(const Token &token);
 
 Token make_token(TokenType type, const Position &position);
 Token make_token(TokenType type, const Position &position, int value);
-Token make_token(TokenType type, const Position &position, std::wstring value);
+Token make_token(TokenType type, const Position &position, Symbol value);
+
+std::string unescape(std::string_view literal);
 
-std::wstring position_in_file(const Token &token);
-std::wstring position_in_file(const Position &position);
+std::wstring position_in_file(const SourcePosition &position);
 
 std::wstring repr(const Token &token);
 std::wstring repr(TokenType type);
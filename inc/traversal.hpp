@@ -0,0 +1,283 @@
+#ifndef __TRAVERSAL_HPP__
+#define __TRAVERSAL_HPP__
+
+#include "flat_ast.hpp"
+#include "node.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Expressions of a Program as seen by ExpressionWalker.
+struct TreeExpressions {
+    typedef const Expression *Node;
+
+    NodeKind kind(Node node) const noexcept
+    {
+        return node->kind;
+    }
+    const Position &position(Node node) const noexcept
+    {
+        return node->position();
+    }
+    template <NodeKind kind> std::size_t child_count(Node node) const noexcept
+    {
+        if constexpr (kind == NodeKind::UnaryExpression) {
+            return 1;
+        } else if constexpr (kind == NodeKind::BinaryExpression || kind == NodeKind::IndexExpression) {
+            return 2;
+        } else if constexpr (kind == NodeKind::FunctionCall) {
+            return static_cast<const FunctionCall *>(node)->arguments.size();
+        } else {
+            return 0;
+        }
+    }
+    template <NodeKind kind> Node child(Node node, std::size_t index) const noexcept
+    {
+        if constexpr (kind == NodeKind::UnaryExpression) {
+            return static_cast<const UnaryExpression *>(node)->rhs;
+        } else if constexpr (kind == NodeKind::BinaryExpression) {
+            const auto expr = static_cast<const BinaryExpression *>(node);
+            return index ? expr->rhs : expr->lhs;
+        } else if constexpr (kind == NodeKind::IndexExpression) {
+            const auto expr = static_cast<const IndexExpression *>(node);
+            return index ? expr->index : expr->ptr;
+        } else {
+            return static_cast<const FunctionCall *>(node)->arguments[index];
+        }
+    }
+    // Name of a VariableRef or FunctionCall.
+    Symbol name(Node node) const noexcept
+    {
+        return node->kind == NodeKind::VariableRef ? static_cast<const VariableRef *>(node)->var_name
+                                                   : static_cast<const FunctionCall *>(node)->func_name;
+    }
+    UnaryOperator unary_op(Node node) const noexcept
+    {
+        return static_cast<const UnaryExpression *>(node)->op;
+    }
+    BinaryOperator binary_op(Node node) const noexcept
+    {
+        return static_cast<const BinaryExpression *>(node)->op;
+    }
+    int value(Node node) const noexcept
+    {
+        return static_cast<const IntConst *>(node)->value;
+    }
+    std::string_view string(Node node) const noexcept
+    {
+        return static_cast<const StringConst *>(node)->value;
+    }
+};
+
+// The same for the rows of a FlatAst.
+struct FlatExpressions {
+    typedef NodeIndex Node;
+
+    const FlatAst &ast;
+
+    NodeKind kind(Node node) const noexcept
+    {
+        return ast.kinds[node];
+    }
+    const Position &position(Node node) const noexcept
+    {
+        return ast.positions[node];
+    }
+    template <NodeKind kind> std::size_t child_count(Node node) const noexcept
+    {
+        if constexpr (kind == NodeKind::UnaryExpression) {
+            return 1;
+        } else if constexpr (kind == NodeKind::BinaryExpression || kind == NodeKind::IndexExpression) {
+            return 2;
+        } else if constexpr (kind == NodeKind::FunctionCall) {
+            return ast.lists[ast.second[node]];
+        } else {
+            return 0;
+        }
+    }
+    template <NodeKind kind> Node child(Node node, std::size_t index) const noexcept
+    {
+        if constexpr (kind == NodeKind::FunctionCall) {
+            return ast.lists[ast.second[node] + 1 + index];
+        } else {
+            return index ? ast.second[node] : ast.first[node];
+        }
+    }
+    Symbol name(Node node) const noexcept
+    {
+        return ast.symbol(node);
+    }
+    UnaryOperator unary_op(Node node) const noexcept
+    {
+        return ast.op<UnaryOperator>(node);
+    }
+    BinaryOperator binary_op(Node node) const noexcept
+    {
+        return ast.op<BinaryOperator>(node);
+    }
+    int value(Node node) const noexcept
+    {
+        return static_cast<int>(ast.first[node]);
+    }
+    std::string_view string(Node node) const noexcept
+    {
+        return ast.strings[ast.first[node]];
+    }
+};
+
+// Walks an expression tree depth first for a pass, which is called back with enter_node<kind>(expressions, node)
+// before the children of a node, with child_done<kind>(expressions, node, index) after each of them and with
+// leave_node<kind>(expressions, node) at the end. The kind of a node is switched on once per step and the callbacks are
+// instantiated per kind, so each compiles down to the code for that kind alone. Passes keep the values of finished
+// children on stacks of their own.
+//
+// The top levels of a tree are walked by plain recursion, which is the cheapest per node; below recursion_limit levels
+// the rest of the subtree goes over an explicit stack, so trees of any height take a bounded amount of native stack.
+template <typename Expressions> class ExpressionWalker {
+    typedef typename Expressions::Node Node;
+
+    static constexpr std::size_t recursion_limit = 64;
+
+    struct Frame {
+        Node node;
+        std::uint32_t next;
+        std::uint32_t count;
+    };
+    // Walks never nest, so each one starts on an empty stack and drops whatever a walk that threw left behind.
+    std::vector<Frame> frames;
+
+    template <NodeKind kind> using Kind = std::integral_constant<NodeKind, kind>;
+    template <typename Step> static bool with_kind(NodeKind kind, Step &&step);
+    template <typename Pass> void descend(Pass &pass, const Expressions &expressions, Node node, std::size_t levels);
+    template <NodeKind kind, typename Pass>
+    void descend(Pass &pass, const Expressions &expressions, Node node, std::size_t levels);
+    template <typename Pass> void walk_iteratively(Pass &pass, const Expressions &expressions, Node root);
+
+public:
+    template <typename Pass> void walk(Pass &pass, const Expressions &expressions, Node root)
+    {
+        frames.clear();
+        descend(pass, expressions, root, recursion_limit);
+    }
+};
+
+template <typename Expressions>
+template <typename Step>
+bool ExpressionWalker<Expressions>::with_kind(NodeKind kind, Step &&step)
+{
+    switch (kind) {
+    case NodeKind::IntConst:
+        return step(Kind<NodeKind::IntConst>{});
+    case NodeKind::StringConst:
+        return step(Kind<NodeKind::StringConst>{});
+    case NodeKind::VariableRef:
+        return step(Kind<NodeKind::VariableRef>{});
+    case NodeKind::FunctionCall:
+        return step(Kind<NodeKind::FunctionCall>{});
+    case NodeKind::UnaryExpression:
+        return step(Kind<NodeKind::UnaryExpression>{});
+    case NodeKind::BinaryExpression:
+        return step(Kind<NodeKind::BinaryExpression>{});
+    case NodeKind::IndexExpression:
+        return step(Kind<NodeKind::IndexExpression>{});
+    default:
+        return false;
+    }
+}
+
+template <typename Expressions>
+template <typename Pass>
+void ExpressionWalker<Expressions>::descend(Pass &pass, const Expressions &expressions, Node node, std::size_t levels)
+{
+    switch (expressions.kind(node)) {
+    case NodeKind::IntConst:
+        return descend<NodeKind::IntConst>(pass, expressions, node, levels);
+    case NodeKind::StringConst:
+        return descend<NodeKind::StringConst>(pass, expressions, node, levels);
+    case NodeKind::VariableRef:
+        return descend<NodeKind::VariableRef>(pass, expressions, node, levels);
+    case NodeKind::FunctionCall:
+        return descend<NodeKind::FunctionCall>(pass, expressions, node, levels);
+    case NodeKind::UnaryExpression:
+        return descend<NodeKind::UnaryExpression>(pass, expressions, node, levels);
+    case NodeKind::BinaryExpression:
+        return descend<NodeKind::BinaryExpression>(pass, expressions, node, levels);
+    case NodeKind::IndexExpression:
+        return descend<NodeKind::IndexExpression>(pass, expressions, node, levels);
+    default:
+        return;
+    }
+}
+
+template <typename Expressions>
+template <NodeKind kind, typename Pass>
+void ExpressionWalker<Expressions>::descend(Pass &pass, const Expressions &expressions, Node node, std::size_t levels)
+{
+    if constexpr (kind == NodeKind::IntConst || kind == NodeKind::StringConst || kind == NodeKind::VariableRef) {
+        pass.template enter_node<kind>(expressions, node);
+        pass.template leave_node<kind>(expressions, node);
+    } else if (levels) {
+        pass.template enter_node<kind>(expressions, node);
+        const std::size_t count = expressions.template child_count<kind>(node);
+        for (std::size_t i = 0; i < count; ++i) {
+            descend(pass, expressions, expressions.template child<kind>(node, i), levels - 1);
+            pass.template child_done<kind>(expressions, node, i);
+        }
+        pass.template leave_node<kind>(expressions, node);
+    } else {
+        walk_iteratively(pass, expressions, node);
+    }
+}
+
+template <typename Expressions>
+template <typename Pass>
+void ExpressionWalker<Expressions>::walk_iteratively(Pass &pass, const Expressions &expressions, Node root)
+{
+    const std::size_t base = frames.size();
+    Node node = root;
+    for (;;) {
+        // Go down the first children until a leaf.
+        const bool descended = with_kind(expressions.kind(node), [&](auto tag) {
+            constexpr NodeKind kind = decltype(tag)::value;
+            pass.template enter_node<kind>(expressions, node);
+            const auto count = static_cast<std::uint32_t>(expressions.template child_count<kind>(node));
+            if (!count) {
+                pass.template leave_node<kind>(expressions, node);
+                return false;
+            }
+            frames.push_back(Frame{ node, 0, count });
+            node = expressions.template child<kind>(node, 0);
+            return true;
+        });
+        if (descended) {
+            continue;
+        }
+
+        // Go back up until a node with children left to walk.
+        for (;;) {
+            if (frames.size() == base) {
+                return;
+            }
+            const bool resumed = with_kind(expressions.kind(frames.back().node), [&](auto tag) {
+                constexpr NodeKind kind = decltype(tag)::value;
+                auto &frame = frames.back();
+                pass.template child_done<kind>(expressions, frame.node, frame.next);
+                if (++frame.next < frame.count) {
+                    node = expressions.template child<kind>(frame.node, frame.next);
+                    return true;
+                }
+                const Node parent = frame.node;
+                frames.pop_back();
+                pass.template leave_node<kind>(expressions, parent);
+                return false;
+            });
+            if (resumed) {
+                break;
+            }
+        }
+    }
+}
+
+#endif
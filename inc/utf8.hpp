@@ -0,0 +1,112 @@
+#ifndef __UTF8_HPP__
+#define __UTF8_HPP__
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+constexpr wchar_t utf8_replacement_char = L'\xFFFD';
+
+inline std::size_t utf8_decode(const char *begin, const char *end, wchar_t &ch) noexcept
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(begin);
+    const unsigned char lead = bytes[0];
+
+    if (lead < 0x80) {
+        ch = lead;
+        return 1;
+    }
+
+    std::size_t length;
+    wchar_t value;
+    wchar_t min_value;
+    if ((lead & 0xE0) == 0xC0) {
+        length = 2;
+        value = lead & 0x1F;
+        min_value = 0x80;
+    } else if ((lead & 0xF0) == 0xE0) {
+        length = 3;
+        value = lead & 0x0F;
+        min_value = 0x800;
+    } else if ((lead & 0xF8) == 0xF0) {
+        length = 4;
+        value = lead & 0x07;
+        min_value = 0x10000;
+    } else {
+        ch = utf8_replacement_char;
+        return 1;
+    }
+
+    if (static_cast<std::size_t>(end - begin) < length) {
+        ch = utf8_replacement_char;
+        return 1;
+    }
+    for (std::size_t i = 1; i < length; ++i) {
+        if ((bytes[i] & 0xC0) != 0x80) {
+            ch = utf8_replacement_char;
+            return 1;
+        }
+        value = (value << 6) | (bytes[i] & 0x3F);
+    }
+    if (value < min_value || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) {
+        ch = utf8_replacement_char;
+        return 1;
+    }
+
+    ch = value;
+    return length;
+}
+
+// Code points in valid UTF-8 text, which is the length utf8_to_wstring() gives it.
+inline std::size_t utf8_length(std::string_view str) noexcept
+{
+    std::size_t length = 0;
+    for (const char ch : str) {
+        length += (static_cast<unsigned char>(ch) & 0xC0) != 0x80;
+    }
+    return length;
+}
+
+inline std::wstring utf8_to_wstring(std::string_view str)
+{
+    std::wstring ret;
+    ret.reserve(str.size());
+    const char *it = str.data();
+    const char *end = it + str.size();
+    while (it < end) {
+        wchar_t ch;
+        it += utf8_decode(it, end, ch);
+        ret.push_back(ch);
+    }
+    return ret;
+}
+
+inline std::string wstring_to_utf8(std::wstring_view wstr)
+{
+    std::string ret;
+    ret.reserve(wstr.size());
+    for (const wchar_t wch : wstr) {
+        const auto ch = static_cast<unsigned long>(wch);
+        if (ch < 0x80) {
+            ret.push_back(static_cast<char>(ch));
+        } else if (ch < 0x800) {
+            ret.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+            ret.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+        } else if (ch < 0x10000) {
+            ret.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+            ret.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+            ret.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+        } else {
+            ret.push_back(static_cast<char>(0xF0 | (ch >> 18)));
+            ret.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3F)));
+            ret.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+            ret.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+        }
+    }
+    return ret;
+}
+
+std::size_t utf8_validate(const char *data, std::size_t size) noexcept;
+std::size_t utf8_incomplete_tail(const char *data, std::size_t size) noexcept;
+
+#endif
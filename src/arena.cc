@@ -0,0 +1,48 @@
+#include "arena.hpp"
+
+#include <cstring>
+#include <iterator>
+
+std::string_view StringArena::store(std::string_view str)
+{
+    char *data;
+    if (str.size() > block_size / 4) {
+        blocks.push_back(std::make_unique<char[]>(str.size()));
+        data = blocks.back().get();
+    } else {
+        if (!current || block_size - block_used < str.size()) {
+            blocks.push_back(std::make_unique<char[]>(block_size));
+            current = blocks.back().get();
+            block_used = 0;
+        }
+        data = current + block_used;
+        block_used += str.size();
+    }
+    std::memcpy(data, str.data(), str.size());
+    return std::string_view(data, str.size());
+}
+
+void *Arena::allocate(std::size_t size, std::size_t alignment)
+{
+    if (size > block_size / 4) {
+        blocks.emplace_back(new char[size]);
+        return blocks.back().get();
+    }
+    std::size_t offset = (block_used + alignment - 1) & ~(alignment - 1);
+    if (!current || offset + size > block_size) {
+        blocks.emplace_back(new char[block_size]);
+        current = blocks.back().get();
+        offset = 0;
+    }
+    block_used = offset + size;
+    return current + offset;
+}
+
+void Arena::adopt(Arena &other)
+{
+    blocks.insert(blocks.end(), std::make_move_iterator(other.blocks.begin()),
+                  std::make_move_iterator(other.blocks.end()));
+    other.blocks.clear();
+    other.current = nullptr;
+    other.block_used = 0;
+}
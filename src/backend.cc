@@ -19,7 +19,14 @@ std::unique_ptr<LLVMCompiler> compile(const std::unique_ptr<Program> &program, c
                                       const std::string &data_layout)
 {
     auto compiler = std::make_unique<LLVMCompiler>(target, data_layout);
-    program->accept(*compiler);
+    compiler->dispatch(*program);
+    return compiler;
+}
+
+std::unique_ptr<LLVMCompiler> compile(const FlatAst &program, const std::string &target, const std::string &data_layout)
+{
+    auto compiler = std::make_unique<LLVMCompiler>(target, data_layout);
+    compiler->compile(program);
     return compiler;
 }
 
@@ -66,7 +73,7 @@ int LLVMCompiler::execute()
     return static_cast<int>(execution_engine->runFunction(entrypoint_function, noargs).IntVal.getLimitedValue());
 }
 
-void LLVMCompiler::declare_global_var(const std::wstring &name, BuiltinType type)
+void LLVMCompiler::declare_global_var(Symbol name, BuiltinType type)
 {
     auto llvm_type = from_builtin_type(type);
     auto var = new llvm::GlobalVariable(*module, llvm_type, false, llvm::GlobalValue::CommonLinkage,
@@ -74,13 +81,20 @@ void LLVMCompiler::declare_global_var(const std::wstring &name, BuiltinType type
     global_vars.insert(std::make_pair(name, LLVMCompiler::Variable{ llvm_type, var }));
 }
 
-void LLVMCompiler::declare_global_var(const std::unique_ptr<VariableDecl> &stmt)
+void LLVMCompiler::declare_global_var(const VariableDecl *stmt)
 {
     for (const auto &var : stmt->var_decls) {
         declare_global_var(var.name, var.type);
     }
 }
 
+void LLVMCompiler::declare_global_var(NodeIndex stmt)
+{
+    for (const auto var : ast->list(ast->first[stmt])) {
+        declare_global_var(ast->symbol(var), ast->op<BuiltinType>(var));
+    }
+}
+
 llvm::Type *LLVMCompiler::from_builtin_type(BuiltinType type)
 {
     switch (type) {
@@ -99,21 +113,94 @@ void LLVMCompiler::yield(lazyValue<llvm::Value *> value, lazyValue<llvm::Value *
     expressions.push(std::make_pair(value, address));
 }
 
+std::pair<lazyValue<llvm::Value *>, lazyValue<llvm::Value *> > LLVMCompiler::pop_expr()
+{
+    auto ret = expressions.top();
+    expressions.pop();
+    return ret;
+}
+
+llvm::Value *LLVMCompiler::pop_operand()
+{
+    auto ret = operands.back();
+    operands.pop_back();
+    return ret;
+}
+
+void LLVMCompiler::compile_expression(const Expression &expr)
+{
+    tree_walker.walk(*this, TreeExpressions{}, &expr);
+}
+
+// Children are turned into values as soon as they are compiled, so instructions come out in the same order as they
+// would from a recursive descent.
+template <NodeKind kind, typename Expressions>
+void LLVMCompiler::child_done(const Expressions &expressions, typename Expressions::Node node, std::size_t)
+{
+    if constexpr (kind == NodeKind::UnaryExpression) {
+        switch (expressions.unary_op(node)) {
+        case UnaryOperator::Addrof:
+            operands.push_back(pop_expr().second.get());
+            break;
+        case UnaryOperator::Deref:
+            break;
+        default:
+            operands.push_back(pop_expr().first.get());
+            break;
+        }
+    } else {
+        operands.push_back(pop_expr().first.get());
+    }
+}
+
+template <NodeKind kind, typename Expressions>
+void LLVMCompiler::leave_node(const Expressions &expressions, typename Expressions::Node node)
+{
+    if constexpr (kind == NodeKind::IntConst) {
+        yield(llvm::ConstantInt::get(builder.getInt32Ty(), expressions.value(node)));
+    } else if constexpr (kind == NodeKind::StringConst) {
+        compile_string(expressions.string(node));
+    } else if constexpr (kind == NodeKind::VariableRef) {
+        compile_variable(expressions.name(node));
+    } else if constexpr (kind == NodeKind::FunctionCall) {
+        const auto &function = functions.at(expressions.name(node));
+        const auto count = expressions.template child_count<kind>(node);
+        const auto values = llvm::ArrayRef<llvm::Value *>(operands).take_back(count);
+        yield(builder.CreateCall(function.llvm_ptr, values));
+        operands.resize(operands.size() - count);
+    } else if constexpr (kind == NodeKind::UnaryExpression) {
+        compile_unary(expressions.unary_op(node));
+    } else if constexpr (kind == NodeKind::BinaryExpression) {
+        auto rhs = pop_operand();
+        auto lhs = pop_operand();
+        compile_binary(expressions.binary_op(node), lhs, rhs);
+    } else if constexpr (kind == NodeKind::IndexExpression) {
+        auto index = pop_operand();
+        auto ptr = pop_operand();
+        compile_index(ptr, index);
+    }
+}
+
 void LLVMCompiler::visit(const UnaryExpression &expr)
 {
-    switch (expr.op) {
+    compile_expression(expr);
+}
+
+void LLVMCompiler::compile_unary(UnaryOperator op)
+{
+    switch (op) {
     case UnaryOperator::Minus:
-        yield(builder.CreateNeg(compile_expr_val(expr.rhs)));
+        yield(builder.CreateNeg(pop_operand()));
         break;
     case UnaryOperator::BooleanNeg:
     case UnaryOperator::Neg:
-        yield(builder.CreateNot(compile_expr_val(expr.rhs)));
+        yield(builder.CreateNot(pop_operand()));
         break;
     case UnaryOperator::Addrof:
-        yield(compile_expr_ptr(expr.rhs));
+        yield(pop_operand());
         break;
     case UnaryOperator::Deref:
-        auto [value, address] = compile_expr(expr.rhs);
+        auto [value, address] = pop_expr();
         auto lazy_value = lazyValue<llvm::Value *>([this, value]() { return builder.CreateLoad(value.get()); });
         yield(lazy_value, value);
         break;
@@ -122,10 +209,12 @@ void LLVMCompiler::visit(const UnaryExpression &expr)
 
 void LLVMCompiler::visit(const BinaryExpression &expr)
 {
-    auto lhs = compile_expr_val(expr.lhs);
-    auto rhs = compile_expr_val(expr.rhs);
+    compile_expression(expr);
+}
 
-    switch (expr.op) {
+void LLVMCompiler::compile_binary(BinaryOperator op, llvm::Value *lhs, llvm::Value *rhs)
+{
+    switch (op) {
     case BinaryOperator::Plus:
         yield(builder.CreateAdd(lhs, rhs));
         break;
@@ -181,8 +270,11 @@ void LLVMCompiler::visit(const BinaryExpression &expr)
 
 void LLVMCompiler::visit(const IndexExpression &expr)
 {
-    auto ptr = compile_expr_val(expr.ptr);
-    auto index = compile_expr_val(expr.index);
+    compile_expression(expr);
+}
+
+void LLVMCompiler::compile_index(llvm::Value *ptr, llvm::Value *index)
+{
     auto address = builder.CreateGEP(ptr, index);
     auto lazy_value = lazyValue<llvm::Value *>(
         [this, address]() { return builder.CreateSExtOrTrunc(builder.CreateLoad(address), builder.getInt32Ty()); });
@@ -200,30 +292,36 @@ llvm::Value *LLVMCompiler::convert_to_bool(llvm::Value *expr)
 
 void LLVMCompiler::visit(const VariableRef &expr)
 {
-    auto address = get_variable_ptr(expr.var_name);
+    compile_expression(expr);
+}
+
+void LLVMCompiler::compile_variable(Symbol name)
+{
+    auto address = get_variable_ptr(name);
     auto lazy_value = lazyValue<llvm::Value *>([this, address]() { return builder.CreateLoad(address); });
     yield(lazy_value, address);
 }
 
 void LLVMCompiler::visit(const FunctionCall &expr)
 {
-    const auto &function = functions.at(expr.func_name);
-    std::vector<llvm::Value *> values;
-    for (const auto &argument : expr.arguments) {
-        values.push_back(compile_expr_val(argument));
-    }
-    yield(builder.CreateCall(function.llvm_ptr, values));
+    compile_expression(expr);
 }
 
 void LLVMCompiler::visit(const IntConst &expr)
 {
-    yield(llvm::ConstantInt::get(builder.getInt32Ty(), expr.value));
+    compile_expression(expr);
 }
 
 void LLVMCompiler::visit(const StringConst &expr)
 {
-    const char *ptr = reinterpret_cast<const char *>(expr.value.c_str());
-    std::size_t size = (expr.value.length() + 1) * sizeof(wchar_t);
+    compile_expression(expr);
+}
+
+void LLVMCompiler::compile_string(std::string_view literal)
+{
+    const std::wstring value = utf8_to_wstring(unescape(literal));
+    const char *ptr = reinterpret_cast<const char *>(value.c_str());
+    std::size_t size = (value.length() + 1) * sizeof(wchar_t);
     yield(builder.CreateBitCast(builder.CreateGlobalStringPtr(llvm::StringRef(ptr, size)),
                                 llvm::Type::getInt32PtrTy(ctx)));
 }
@@ -239,58 +337,68 @@ void LLVMCompiler::visit(const Block &block)
 
 void LLVMCompiler::visit(const ExternFunctionDecl &decl)
 {
-    Function function;
-    std::vector<llvm::Type *> parameter_types;
+    std::vector<llvm::Type *> parameters;
     for (const auto &param : decl.parameters) {
-        function.parameters.push_back(from_builtin_type(param.type));
+        parameters.push_back(from_builtin_type(param.type));
     }
-    llvm::ArrayRef<llvm::Type *> params_ref{ function.parameters };
-    function.type = llvm::FunctionType::get(from_builtin_type(decl.return_type), params_ref, false);
-    function.llvm_ptr = llvm::Function::Create(function.type, llvm::Function::ExternalLinkage, "", *module);
-    function.llvm_ptr->setCallingConv(llvm::CallingConv::C);
-    std::string ascii_name(decl.func_name.begin(), decl.func_name.end());
-    function.llvm_ptr->setName(ascii_name);
+    auto function = create_function(decl.return_type, std::move(parameters));
+    function.llvm_ptr->setName(decl.func_name.str());
     functions.insert(std::make_pair(decl.func_name, std::move(function)));
 }
 
 void LLVMCompiler::visit(const FunctionDecl &decl)
 {
-    Function function;
-    std::vector<llvm::Type *> parameter_types;
+    std::vector<llvm::Type *> parameters;
     for (const auto &param : decl.parameters) {
-        function.parameters.push_back(from_builtin_type(param.type));
+        parameters.push_back(from_builtin_type(param.type));
     }
-    llvm::ArrayRef<llvm::Type *> params_ref{ function.parameters };
-    function.type = llvm::FunctionType::get(from_builtin_type(decl.return_type), params_ref, false);
-    function.llvm_ptr = llvm::Function::Create(function.type, llvm::Function::ExternalLinkage, "", *module);
-    function.llvm_ptr->setCallingConv(llvm::CallingConv::C);
-    function.llvm_ptr->arg_begin();
+    auto function = create_function(decl.return_type, std::move(parameters));
     llvm::BasicBlock *entry = llvm::BasicBlock::Create(ctx, "entry", function.llvm_ptr);
     builder.SetInsertPoint(entry);
-    functions.insert(std::make_pair(decl.func_name, std::move(function)));
+    functions.insert(std::make_pair(decl.func_name, function));
     enter();
     process_parameters(decl.parameters, function.llvm_ptr);
     current_function = function.llvm_ptr;
     compile(decl.block);
     leave();
+    finish_function(function.llvm_ptr);
+}
 
-    for (auto it = function.llvm_ptr->begin(); it != function.llvm_ptr->end(); ++it) {
+LLVMCompiler::Function LLVMCompiler::create_function(BuiltinType return_type, std::vector<llvm::Type *> parameters)
+{
+    Function function;
+    function.parameters = std::move(parameters);
+    llvm::ArrayRef<llvm::Type *> params_ref{ function.parameters };
+    function.type = llvm::FunctionType::get(from_builtin_type(return_type), params_ref, false);
+    function.llvm_ptr = llvm::Function::Create(function.type, llvm::Function::ExternalLinkage, "", *module);
+    function.llvm_ptr->setCallingConv(llvm::CallingConv::C);
+    return function;
+}
+
+void LLVMCompiler::finish_function(llvm::Function *function)
+{
+    for (auto it = function->begin(); it != function->end(); ++it) {
         remove_dead_code(*it);
     }
 }
 
-void LLVMCompiler::process_parameters(const std::list<FunctionDecl::Parameter> &parameters, llvm::Function *function)
+void LLVMCompiler::process_parameters(Span<FunctionDecl::Parameter> parameters, llvm::Function *function)
 {
     auto param_it = function->arg_begin();
     for (const auto &param : parameters) {
-        auto type = param_it->getType();
-        auto ptr = builder.CreateAlloca(type);
-        declare_variable(param.name, ptr, type);
-        builder.CreateStore(param_it, ptr);
+        store_parameter(param.name, *param_it);
         std::advance(param_it, 1);
     }
 }
 
+void LLVMCompiler::store_parameter(Symbol name, llvm::Argument &value)
+{
+    auto type = value.getType();
+    auto ptr = builder.CreateAlloca(type);
+    declare_variable(name, ptr, type);
+    builder.CreateStore(&value, ptr);
+}
+
 void LLVMCompiler::enter()
 {
     scopes.push_back({});
@@ -301,12 +409,12 @@ void LLVMCompiler::leave()
     scopes.pop_back();
 }
 
-void LLVMCompiler::declare_variable(const std::wstring &name, llvm::Value *ptr, llvm::Type *type)
+void LLVMCompiler::declare_variable(Symbol name, llvm::Value *ptr, llvm::Type *type)
 {
     scopes.back().insert(std::make_pair(name, LLVMCompiler::Variable{ type, ptr }));
 }
 
-const LLVMCompiler::Variable &LLVMCompiler::find_variable(const std::wstring &name)
+const LLVMCompiler::Variable &LLVMCompiler::find_variable(Symbol name)
 {
     for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
         auto it = scope->find(name);
@@ -318,12 +426,12 @@ const LLVMCompiler::Variable &LLVMCompiler::find_variable(const std::wstring &na
     // after semantic analysys should never reach here
 }
 
-llvm::Value *LLVMCompiler::get_variable_ptr(const std::wstring &name)
+llvm::Value *LLVMCompiler::get_variable_ptr(Symbol name)
 {
     return find_variable(name).ptr;
 }
 
-llvm::Type *LLVMCompiler::get_variable_type(const std::wstring &name)
+llvm::Type *LLVMCompiler::get_variable_type(Symbol name)
 {
     return find_variable(name).type;
 }
@@ -345,14 +453,20 @@ void LLVMCompiler::remove_dead_code(llvm::BasicBlock &block)
 void LLVMCompiler::visit(const VariableDecl &stmt)
 {
     for (const auto &var : stmt.var_decls) {
-        auto type = from_builtin_type(var.type);
-        auto ptr = builder.CreateAlloca(type);
-        if (var.initial_value) {
-            auto value = compile_expr_val(*var.initial_value);
-            builder.CreateStore(value, ptr);
-        }
-        declare_variable(var.name, ptr, type);
+        compile_local(var.name, var.type, var.initial_value, var.initial_value);
+    }
+}
+
+template <typename Node>
+void LLVMCompiler::compile_local(Symbol name, BuiltinType builtin_type, Node initial_value, bool initialized)
+{
+    auto type = from_builtin_type(builtin_type);
+    auto ptr = builder.CreateAlloca(type);
+    if (initialized) {
+        auto value = compile_expr_val(initial_value);
+        builder.CreateStore(value, ptr);
     }
+    declare_variable(name, ptr, type);
 }
 
 void LLVMCompiler::visit(const AssignmentStatement &stmt)
@@ -379,40 +493,50 @@ void LLVMCompiler::visit(const ExpressionStatement &stmt)
 void LLVMCompiler::visit(const IfStatement &stmt)
 {
     llvm::BasicBlock *after_if = llvm::BasicBlock::Create(ctx, "after_if", current_function);
-    llvm::BasicBlock *cond_true;
-    llvm::BasicBlock *cond_false;
-    for (const auto &element : stmt.blocks) {
-        const auto &[condition, block] = element;
-        auto value = compile_expr_val(condition);
-        cond_true = llvm::BasicBlock::Create(ctx, "cond_true", current_function);
-        cond_false = llvm::BasicBlock::Create(ctx, "cond_false", current_function);
-        builder.CreateCondBr(convert_to_bool(value), cond_true, cond_false);
-        builder.SetInsertPoint(cond_true);
-        compile(block);
-        builder.CreateBr(after_if);
-        builder.SetInsertPoint(cond_false);
+    for (const auto &[condition, block] : stmt.blocks) {
+        compile_conditional_block<const ASTNode *>(condition, block, after_if);
     }
     if (stmt.else_statement) {
-        compile(*stmt.else_statement);
+        compile(stmt.else_statement);
     }
     builder.CreateBr(after_if);
     builder.SetInsertPoint(after_if);
 }
 
+template <typename Node>
+void LLVMCompiler::compile_conditional_block(Node condition, Node block, llvm::BasicBlock *after_if)
+{
+    auto value = compile_expr_val(condition);
+    llvm::BasicBlock *cond_true = llvm::BasicBlock::Create(ctx, "cond_true", current_function);
+    llvm::BasicBlock *cond_false = llvm::BasicBlock::Create(ctx, "cond_false", current_function);
+    builder.CreateCondBr(convert_to_bool(value), cond_true, cond_false);
+    builder.SetInsertPoint(cond_true);
+    compile(block);
+    builder.CreateBr(after_if);
+    builder.SetInsertPoint(cond_false);
+}
+
 void LLVMCompiler::visit(const ForStatement &stmt)
 {
-    auto start = compile_expr_val(stmt.start);
-    auto end = compile_expr_val(stmt.end);
+    compile_for<const ASTNode *>(stmt.loop_variable, stmt.start, stmt.end, stmt.increase, stmt.increase, stmt.block);
+}
+
+template <typename Node>
+void LLVMCompiler::compile_for(Symbol loop_variable, Node start_expr, Node end_expr, Node increase_expr,
+                               bool has_increase, Node block)
+{
+    auto start = compile_expr_val(start_expr);
+    auto end = compile_expr_val(end_expr);
     llvm::Value *increase;
-    if (stmt.increase) {
-        increase = compile_expr_val(*stmt.increase);
+    if (has_increase) {
+        increase = compile_expr_val(increase_expr);
     } else {
         increase = llvm::ConstantInt::get(builder.getInt32Ty(), 1);
     }
     enter();
     auto ptr = builder.CreateAlloca(builder.getInt32Ty());
     builder.CreateStore(start, ptr);
-    declare_variable(stmt.loop_variable, ptr, builder.getInt32Ty());
+    declare_variable(loop_variable, ptr, builder.getInt32Ty());
     llvm::BasicBlock *loop_condition = llvm::BasicBlock::Create(ctx, "loop_condition", current_function);
     llvm::BasicBlock *loop_body = llvm::BasicBlock::Create(ctx, "loop_body", current_function);
     llvm::BasicBlock *after_loop = llvm::BasicBlock::Create(ctx, "after_loop", current_function);
@@ -422,7 +546,7 @@ void LLVMCompiler::visit(const ForStatement &stmt)
     auto condition = builder.CreateICmpSLT(iterator, end);
     builder.CreateCondBr(convert_to_bool(condition), loop_body, after_loop);
     builder.SetInsertPoint(loop_body);
-    compile(stmt.block);
+    compile(block);
     iterator = builder.CreateLoad(ptr);
     auto new_iterator = builder.CreateAdd(iterator, increase);
     builder.CreateStore(new_iterator, ptr);
@@ -432,21 +556,26 @@ void LLVMCompiler::visit(const ForStatement &stmt)
 }
 
 void LLVMCompiler::visit(const WhileStatement &stmt)
+{
+    compile_while<const ASTNode *>(stmt.condition, stmt.block);
+}
+
+template <typename Node> void LLVMCompiler::compile_while(Node condition_expr, Node block)
 {
     llvm::BasicBlock *loop_condition = llvm::BasicBlock::Create(ctx, "loop_condition", current_function);
     llvm::BasicBlock *loop_body = llvm::BasicBlock::Create(ctx, "loop_body", current_function);
     llvm::BasicBlock *after_loop = llvm::BasicBlock::Create(ctx, "after_loop", current_function);
     builder.CreateBr(loop_condition);
     builder.SetInsertPoint(loop_condition);
-    auto condition = compile_expr_val(stmt.condition);
+    auto condition = compile_expr_val(condition_expr);
     builder.CreateCondBr(convert_to_bool(condition), loop_body, after_loop);
     builder.SetInsertPoint(loop_body);
-    compile(stmt.block);
+    compile(block);
     builder.CreateBr(loop_condition);
     builder.SetInsertPoint(after_loop);
 }
 
-void LLVMCompiler::compile_entrypoint(const std::list<std::unique_ptr<VariableDecl> > &global_vars_decl)
+template <typename Declarations> void LLVMCompiler::compile_entrypoint(const Declarations &global_vars_decl)
 {
     llvm::FunctionType *type = llvm::FunctionType::get(builder.getInt32Ty(), false);
     llvm::Function *function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, "main", *module);
@@ -456,24 +585,37 @@ void LLVMCompiler::compile_entrypoint(const std::list<std::unique_ptr<VariableDe
     for (const auto &vars : global_vars_decl) {
         initialize_variables(vars);
     }
-    auto main_it = functions.find(L"main");
+    auto main_it = functions.find(main_symbol);
     if (main_it == functions.end()) {
         report_undefined_main();
     }
     builder.CreateRet(builder.CreateCall(main_it->second.llvm_ptr));
 }
 
-void LLVMCompiler::initialize_variables(const std::unique_ptr<VariableDecl> &decl)
+void LLVMCompiler::initialize_variables(const VariableDecl *decl)
 {
     for (const auto &var : decl->var_decls) {
         if (var.initial_value) {
-            auto value = compile_expr_val(*var.initial_value);
-            auto address = get_variable_ptr(var.name);
-            builder.CreateStore(value, address);
+            initialize_variable(var.name, compile_expr_val(var.initial_value));
         }
     }
 }
 
+void LLVMCompiler::initialize_variables(NodeIndex decl)
+{
+    for (const auto var : ast->list(ast->first[decl])) {
+        if (ast->second[var] != no_node) {
+            initialize_variable(ast->symbol(var), compile_expr_val(ast->second[var]));
+        }
+    }
+}
+
+void LLVMCompiler::initialize_variable(Symbol name, llvm::Value *value)
+{
+    auto address = get_variable_ptr(name);
+    builder.CreateStore(value, address);
+}
+
 void LLVMCompiler::visit(const Program &program)
 {
     for (const auto &extern_func : program.externs) {
@@ -490,6 +632,132 @@ void LLVMCompiler::visit(const Program &program)
     optimize();
 }
 
+void LLVMCompiler::compile(const FlatAst &program)
+{
+    ast = &program;
+    for (const auto extern_func : program.externs) {
+        compile(extern_func);
+    }
+    for (const auto stmt : program.global_vars) {
+        declare_global_var(stmt);
+    }
+    for (const auto function : program.functions) {
+        compile(function);
+    }
+    compile_entrypoint(program.global_vars);
+    ast = nullptr;
+    llvm::verifyModule(*module, &llvm::errs());
+    optimize();
+}
+
+void LLVMCompiler::compile(NodeIndex node)
+{
+    const auto first = ast->first[node];
+    const auto second = ast->second[node];
+
+    switch (ast->kinds[node]) {
+    case NodeKind::IntConst:
+    case NodeKind::StringConst:
+    case NodeKind::VariableRef:
+    case NodeKind::FunctionCall:
+    case NodeKind::UnaryExpression:
+    case NodeKind::BinaryExpression:
+    case NodeKind::IndexExpression:
+        flat_walker.walk(*this, FlatExpressions{ *ast }, node);
+        break;
+    case NodeKind::Block:
+        enter();
+        for (const auto stmt : ast->list(first)) {
+            compile(stmt);
+        }
+        leave();
+        break;
+    case NodeKind::VariableDecl:
+        for (const auto var : ast->list(first)) {
+            compile_local(ast->symbol(var), ast->op<BuiltinType>(var), ast->second[var], ast->second[var] != no_node);
+        }
+        break;
+    case NodeKind::AssignmentStatement: {
+        const auto parts = ast->list(first);
+        auto value = compile_expr_val(parts.back());
+        for (std::size_t i = 0; i < parts.size() - 1; ++i) {
+            builder.CreateStore(value, compile_expr_ptr(parts[i]));
+        }
+        break;
+    }
+    case NodeKind::ReturnStatement:
+        builder.CreateRet(compile_expr_val(first));
+        break;
+    case NodeKind::ExpressionStatement:
+        compile_expr_val(first);
+        break;
+    case NodeKind::IfStatement: {
+        llvm::BasicBlock *after_if = llvm::BasicBlock::Create(ctx, "after_if", current_function);
+        const auto blocks = ast->list(first);
+        for (std::size_t i = 0; i < blocks.size(); i += 2) {
+            compile_conditional_block(blocks[i], blocks[i + 1], after_if);
+        }
+        if (second != no_node) {
+            compile(second);
+        }
+        builder.CreateBr(after_if);
+        builder.SetInsertPoint(after_if);
+        break;
+    }
+    case NodeKind::ForStatement: {
+        const auto parts = ast->list(second);
+        compile_for(ast->symbol(node), parts[0], parts[1], parts[2], parts[2] != no_node, parts[3]);
+        break;
+    }
+    case NodeKind::WhileStatement:
+        compile_while(first, second);
+        break;
+    case NodeKind::FunctionDecl:
+        compile_function(node);
+        break;
+    case NodeKind::ExternFunctionDecl: {
+        std::vector<llvm::Type *> parameters;
+        for (const auto param : ast->list(second)) {
+            parameters.push_back(from_builtin_type(ast->op<BuiltinType>(param)));
+        }
+        auto function = create_function(ast->op<BuiltinType>(node), std::move(parameters));
+        function.llvm_ptr->setName(ast->symbol(node).str());
+        functions.insert(std::make_pair(ast->symbol(node), std::move(function)));
+        break;
+    }
+    case NodeKind::Variable:
+    case NodeKind::Parameter:
+        // Compiled as part of the declaration they belong to.
+        break;
+    case NodeKind::Program:
+        // Never flattened: its declarations are the roots of the FlatAst.
+        break;
+    }
+}
+
+void LLVMCompiler::compile_function(NodeIndex node)
+{
+    const auto parts = ast->list(ast->second[node]);
+    std::vector<llvm::Type *> parameters;
+    for (std::size_t i = 1; i < parts.size(); ++i) {
+        parameters.push_back(from_builtin_type(ast->op<BuiltinType>(parts[i])));
+    }
+    auto function = create_function(ast->op<BuiltinType>(node), std::move(parameters));
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(ctx, "entry", function.llvm_ptr);
+    builder.SetInsertPoint(entry);
+    functions.insert(std::make_pair(ast->symbol(node), function));
+    enter();
+    auto param_it = function.llvm_ptr->arg_begin();
+    for (std::size_t i = 1; i < parts.size(); ++i) {
+        store_parameter(ast->symbol(parts[i]), *param_it);
+        std::advance(param_it, 1);
+    }
+    current_function = function.llvm_ptr;
+    compile(parts[0]);
+    leave();
+    finish_function(function.llvm_ptr);
+}
+
 void LLVMCompiler::optimize()
 {
     auto FPM = std::make_unique<llvm::legacy::FunctionPassManager>(module.get());
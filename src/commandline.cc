@@ -8,7 +8,11 @@ po::options_description CommandLine::make_options()
     po::options_description desc("Allowed options");
     desc.add_options()("help,h", "produce help message")("input-file,i", po::value<std::string>(), "set input file")(
         "output-file,o", po::value<std::string>(), "set output file")("jit", "execute compiled program")(
-        "ir", "compile to llvm's IR")("bc", "compile to llvm's bytecode")("print-ir,p", "print llvm's IR");
+        "ir", "compile to llvm's IR")("bc", "compile to llvm's bytecode")("print-ir,p", "print llvm's IR")(
+        "stream-window", po::value<std::size_t>(), "keep only the last N KiB of input for error messages; implies --pipeline")(
+        "pipeline", "lex, parse and analyse on separate threads")(
+        "max-depth", po::value<std::size_t>(), "reject programs nested deeper than N levels")(
+        "lsp", "serve diagnostics to an editor over the language server protocol on stdin and stdout");
     return desc;
 }
 
@@ -36,6 +40,9 @@ CommandLine CommandLine::parse(int argc, char *argv[])
     conflicting_options(cmd.options, "print-ir", "it");
     conflicting_options(cmd.options, "output-file", "print-ir");
     conflicting_options(cmd.options, "output-file", "jit");
+    conflicting_options(cmd.options, "lsp", "input-file");
+    conflicting_options(cmd.options, "lsp", "jit");
+    conflicting_options(cmd.options, "lsp", "stream-window");
     return cmd;
 }
 
@@ -57,6 +64,34 @@ std::optional<std::string> CommandLine::getOutputFile() const noexcept
     }
 }
 
+std::size_t CommandLine::getStreamWindow() const noexcept
+{
+    if (options.count("stream-window")) {
+        return options["stream-window"].as<std::size_t>() * 1024;
+    } else {
+        return 0;
+    }
+}
+
+std::optional<std::size_t> CommandLine::getMaxDepth() const noexcept
+{
+    if (options.count("max-depth")) {
+        return options["max-depth"].as<std::size_t>();
+    } else {
+        return {};
+    }
+}
+
+bool CommandLine::runPipelined() const noexcept
+{
+    return options.count("pipeline");
+}
+
+bool CommandLine::runLanguageServer() const noexcept
+{
+    return options.count("lsp");
+}
+
 bool CommandLine::runJIT() const noexcept
 {
     return options.count("jit");
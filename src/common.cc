@@ -1,12 +1,8 @@
 #include "common.hpp"
 #include "source.hpp"
 
-std::wstring error_marker(const Position &pos)
+std::wstring error_marker(const SourcePosition &pos)
 {
-    std::wstring ret = L"\033[1;32m";
-    for (std::size_t i = 1; i < pos.column_number - 1; ++i) {
-        ret += L"-";
-    }
-    ret += L"\033[1;31m^\033[0m";
-    return ret;
+    const std::size_t padding = pos.column_number > 0 ? pos.column_number - 1 : 0;
+    return concat(L"\033[1;32m", std::wstring(padding, L'-'), L"\033[1;31m^\033[0m");
 }
@@ -0,0 +1,438 @@
+#include "document.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// Editors count characters in UTF-16 code units: two for those outside the basic plane, one for the rest.
+std::size_t utf16_length(std::string_view text)
+{
+    std::size_t length = 0;
+    for (const unsigned char byte : text) {
+        if ((byte & 0xC0) != 0x80) {
+            length += byte >= 0xF0 ? 2 : 1;
+        }
+    }
+    return length;
+}
+
+// Offset of the character `character` UTF-16 units into the line starting `text`; the end of the line if it is shorter.
+std::size_t utf8_offset(std::string_view text, std::size_t character)
+{
+    std::size_t offset = 0;
+    while (character && offset < text.size() && text[offset] != '\n') {
+        const unsigned char byte = text[offset];
+        character -= std::min<std::size_t>(character, byte >= 0xF0 ? 2 : 1);
+        offset += byte < 0x80 ? 1 : byte < 0xE0 ? 2 : byte < 0xF0 ? 3 : 4;
+    }
+    return std::min(offset, text.size());
+}
+
+bool is_word_char(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+char type_code(BuiltinType type)
+{
+    return static_cast<char>('0' + static_cast<int>(type));
+}
+
+}
+
+Document::Document(const std::string &text)
+{
+    reset(text);
+}
+
+void Document::reset(const std::string &text)
+{
+    names = std::make_unique<Interner>();
+    Interner::Scope scope{ *names };
+    sources = std::make_shared<SourceManager>();
+    relexed = 0;
+    items = parse(text);
+    declare_all();
+    for (auto &item : items) {
+        check(item);
+    }
+}
+
+std::string Document::text() const
+{
+    std::string text;
+    for (const auto &item : items) {
+        text += item.text;
+    }
+    return text;
+}
+
+void Document::edit(const TextPosition &start, const TextPosition &end, const std::string &text)
+{
+    {
+        Interner::Scope scope{ *names };
+        const auto [first, from] = locate(start);
+        auto [last, to] = locate(end);
+        if (last < first || (last == first && to < from)) {
+            last = first;
+            to = from;
+        }
+        std::string region;
+        for (std::size_t i = first; i < last; ++i) {
+            region += items[i].text;
+        }
+        to += region.size();
+        region += items[last].text;
+        region.replace(from, to - from, text);
+        replace_items(first, last + 1, parse(region));
+    }
+
+    // Loading the text again lets the buffers and names of replaced items go once they outweigh the document
+    // severalfold.
+    constexpr std::size_t min_reload = 16 << 20;
+    if (relexed > min_reload) {
+        const auto current = this->text();
+        if (relexed > min_reload + 4 * current.size()) {
+            reset(current);
+        }
+    }
+}
+
+std::size_t Document::interned() const noexcept
+{
+    return names->size();
+}
+
+// Returns the item holding `position` and its offset in the text of the item.
+std::pair<std::size_t, std::size_t> Document::locate(const TextPosition &position) const
+{
+    std::size_t index = 0;
+    std::size_t line = 0;
+    while (index + 1 < items.size() && line + items[index].lines <= position.line) {
+        line += items[index].lines;
+        ++index;
+    }
+    const std::string_view text = items[index].text;
+    std::size_t offset = 0;
+    for (; line < position.line; ++line) {
+        const auto next = text.find('\n', offset);
+        if (next == std::string_view::npos) {
+            return { index, text.size() };
+        }
+        offset = next + 1;
+    }
+    return { index, offset + utf8_offset(text.substr(offset), position.character) };
+}
+
+// Lexes `text` into a buffer of its own and splits it at the lines of the top-level declarations after the first one
+// that start outside of any braces; declarations sharing a line stay in one item. Every item is parsed from its own
+// tokens, so a syntax error stays in the item it is in.
+std::vector<Document::Item> Document::parse(const std::string &text)
+{
+    const auto buffer = sources->add(Source::from_string(text));
+    const auto base = sources->base(buffer);
+    relexed += text.size();
+
+    std::vector<Item> parsed(1);
+    auto lexer = Lexer::from_source(sources, buffer);
+    TokenBuffer tokens;
+    try {
+        tokens = lexer->tokenize_all();
+    } catch (const LexerException &e) {
+        parsed.front().syntax_error = Error{ e.position().value_or(Position{ base }), e.description() };
+    } catch (const SourceException &e) {
+        parsed.front().syntax_error = Error{ Position{ base }, utf8_to_wstring(e.message()) };
+    }
+    if (!tokens.size()) {
+        auto &item = parsed.front();
+        item.text = text;
+        item.lines = std::count(text.begin(), text.end(), '\n');
+        item.location = base;
+        return parsed;
+    }
+
+    const std::size_t last = tokens.size() - 1;
+    std::vector<std::size_t> starts{ 0 };
+    std::vector<std::size_t> offsets{ 0 };
+    std::size_t depth = 0;
+    bool declared = false;
+    for (std::size_t i = 0; i < last; ++i) {
+        const auto type = tokens.type(i);
+        if (type == TokenType::LS_PAREN) {
+            ++depth;
+        } else if (type == TokenType::RS_PAREN) {
+            depth -= depth > 0;
+        } else if (!depth && (type == TokenType::KW_LET || type == TokenType::KW_EXTERN ||
+                              (type == TokenType::KW_FN && !(i && tokens.type(i - 1) == TokenType::KW_EXTERN)))) {
+            // Items only start at declarations that open their line; one following the end of another stays with it.
+            const auto offset = text.rfind('\n', tokens[i].position.location - base) + 1;
+            if (declared && offset > offsets.back() && tokens[i - 1].position.location - base < offset) {
+                starts.push_back(i);
+                offsets.push_back(offset);
+            }
+            declared = true;
+        }
+    }
+    starts.push_back(last);
+    offsets.push_back(text.size());
+
+    parsed.resize(starts.size() - 1);
+    Parser parser;
+    for (std::size_t k = 0; k < parsed.size(); ++k) {
+        auto &item = parsed[k];
+        item.text = text.substr(offsets[k], offsets[k + 1] - offsets[k]);
+        item.lines = std::count(item.text.begin(), item.text.end(), '\n');
+        item.location = base + offsets[k];
+
+        TokenBuffer part;
+        part.append(tokens, starts[k], starts[k + 1]);
+        for (std::size_t i = starts[k]; i < starts[k + 1]; ++i) {
+            if (const auto symbol = get_symbol(tokens[i])) {
+                item.names.push_back(*symbol);
+            }
+        }
+        std::sort(item.names.begin(), item.names.end(), [](Symbol a, Symbol b) { return a.id < b.id; });
+        item.names.erase(std::unique(item.names.begin(), item.names.end()), item.names.end());
+
+        // The item ends right after its last token, which is where errors about a missing end point.
+        Position end = Position{ item.location };
+        if (starts[k + 1] > starts[k]) {
+            const auto last_token = tokens[starts[k + 1] - 1];
+            end = Position{ last_token.position.location + last_token.length };
+        }
+        part.push_back(make_token(TokenType::END_OF_FILE, end));
+
+        parser.attach_lexer(std::move(lexer), std::move(part));
+        try {
+            item.program = parser.parse_part();
+        } catch (const ParserException &e) {
+            item.syntax_error = Error{ e.position().value_or(end), e.description() };
+        }
+        lexer = parser.detach_lexer();
+    }
+    const std::shared_ptr<Arena> nodes = parser.take_nodes();
+    for (auto &item : parsed) {
+        item.nodes = nodes;
+    }
+    return parsed;
+}
+
+// The functions of the new items are checked, and so are those of every item mentioning a name declared differently
+// now. Everything is declared again when a global declaration or the sequence of function declarations changed, since
+// functions are numbered in declaration order.
+void Document::replace_items(std::size_t begin, std::size_t end, std::vector<Item> parsed)
+{
+    if (end - begin == 1 && parsed.size() == 1 && !parsed.front().program && items[begin].program) {
+        auto &item = parsed.front();
+        item.nodes = items[begin].nodes;
+        item.program = std::move(items[begin].program);
+        item.outdated = true;
+    }
+    // An emptied item between others would only be in the way of locate().
+    if (parsed.size() == 1 && parsed.front().text.empty() && end - begin < items.size()) {
+        parsed.clear();
+    }
+
+    std::vector<Signature> before;
+    std::vector<Signature> after;
+    bool globals = false;
+    for (std::size_t i = begin; i < end; ++i) {
+        collect_signatures(items[i], before);
+    }
+    for (const auto &item : parsed) {
+        collect_signatures(item, after);
+    }
+    for (const auto &signature : before) {
+        globals |= signature.second.front() != 'f';
+    }
+    for (const auto &signature : after) {
+        globals |= signature.second.front() != 'f';
+    }
+    const bool redeclare = globals || before != after;
+
+    std::sort(before.begin(), before.end());
+    std::sort(after.begin(), after.end());
+    std::vector<Signature> differing;
+    std::set_symmetric_difference(before.begin(), before.end(), after.begin(), after.end(),
+                                  std::back_inserter(differing));
+    std::vector<std::uint32_t> changed;
+    for (const auto &signature : differing) {
+        changed.push_back(signature.first);
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    std::size_t order = items[begin].first_function;
+    const std::size_t count = parsed.size();
+    items.erase(items.begin() + begin, items.begin() + end);
+    items.insert(items.begin() + begin, std::make_move_iterator(parsed.begin()), std::make_move_iterator(parsed.end()));
+
+    if (redeclare) {
+        declare_all();
+    } else {
+        for (std::size_t i = begin; i < begin + count; ++i) {
+            items[i].first_function = order;
+            order += items[i].program ? items[i].program->functions.size() : 0;
+        }
+    }
+    auto mentions_changed = [&changed](const Item &item) {
+        return std::any_of(item.names.begin(), item.names.end(), [&changed](Symbol name) {
+            return std::binary_search(changed.begin(), changed.end(), name.id);
+        });
+    };
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        if ((i >= begin && i < begin + count) || (!changed.empty() && mentions_changed(items[i]))) {
+            check(items[i]);
+        }
+    }
+}
+
+void Document::collect_signatures(const Item &item, std::vector<Signature> &signatures)
+{
+    if (!item.program) {
+        return;
+    }
+    for (const auto decl : item.program->externs) {
+        std::string types{ 'e', type_code(decl->return_type) };
+        for (const auto &param : decl->parameters) {
+            types += type_code(param.type);
+        }
+        signatures.emplace_back(decl->func_name.id, std::move(types));
+    }
+    for (const auto decl : item.program->global_vars) {
+        for (const auto &var : decl->var_decls) {
+            signatures.emplace_back(var.name.id, std::string{ 'v', type_code(var.type) });
+        }
+    }
+    for (const auto decl : item.program->functions) {
+        std::string types{ 'f', type_code(decl->return_type) };
+        for (const auto &param : decl->parameters) {
+            types += type_code(param.type);
+        }
+        signatures.emplace_back(decl->func_name.id, std::move(types));
+    }
+}
+
+// Checks the externs and global variables in the order analyse() does and declares every function in advance, so
+// that each can be checked on its own against those declared before it.
+void Document::declare_all()
+{
+    analyser.functions.clear();
+    analyser.declared_functions = 0;
+    analyser.scopes.clear();
+    analyser.enter();
+    for (auto &item : items) {
+        item.declaration_errors.clear();
+        if (item.program) {
+            for (const auto decl : item.program->externs) {
+                run_check(item, item.declaration_errors, [&] { analyser.dispatch(*decl); });
+            }
+        }
+    }
+    for (auto &item : items) {
+        if (item.program) {
+            for (const auto decl : item.program->global_vars) {
+                run_check(item, item.declaration_errors, [&] {
+                    analyser.dispatch(*decl);
+                    analyser.ignore_return(1);
+                });
+            }
+        }
+    }
+    for (auto &item : items) {
+        item.first_function = analyser.declared_functions;
+        if (item.program) {
+            for (const auto decl : item.program->functions) {
+                SemanticAnalyser::Function function;
+                function.return_type = decl->return_type;
+                for (const auto &param : decl->parameters) {
+                    function.parameters.emplace_back(param.name, param.type);
+                }
+                analyser.declare_function(decl->func_name, std::move(function));
+            }
+        }
+    }
+}
+
+void Document::check(Item &item)
+{
+    item.function_errors.clear();
+    if (!item.program || item.outdated) {
+        return;
+    }
+    auto order = item.first_function;
+    for (const auto decl : item.program->functions) {
+        analyser.declared_functions = order++;
+        run_check(item, item.function_errors, [&] { analyser.dispatch(*decl); });
+    }
+}
+
+template <typename Check> void Document::run_check(const Item &item, std::vector<Error> &errors, Check &&check)
+{
+    try {
+        check();
+    } catch (const SemanticException &e) {
+        recover();
+        if (!item.outdated) {
+            errors.push_back(Error{ e.position().value_or(Position{ item.location }), e.description() });
+        }
+    }
+}
+
+// Drops what a check that threw left on the analyser's stacks, keeping the global scope.
+void Document::recover()
+{
+    analyser.stack = {};
+    analyser.has_return = {};
+    analyser.calls.clear();
+    analyser.scopes.resize(1);
+}
+
+std::vector<Diagnostic> Document::diagnostics() const
+{
+    std::vector<Diagnostic> diagnostics;
+    std::size_t line = 0;
+    for (const auto &item : items) {
+        if (item.syntax_error) {
+            diagnostics.push_back(diagnostic(item, line, *item.syntax_error));
+        }
+        for (const auto &error : item.declaration_errors) {
+            diagnostics.push_back(diagnostic(item, line, error));
+        }
+        for (const auto &error : item.function_errors) {
+            diagnostics.push_back(diagnostic(item, line, error));
+        }
+        line += item.lines;
+    }
+    return diagnostics;
+}
+
+// The range covers the word the error points at, or a single character.
+Diagnostic Document::diagnostic(const Item &item, std::size_t line, const Error &error)
+{
+    const std::string_view text = item.text;
+    const std::size_t offset =
+        error.position.location > item.location ? std::min<std::size_t>(error.position.location - item.location,
+                                                                         text.size())
+                                                : 0;
+    std::size_t line_start = 0;
+    for (std::size_t i = 0; i < offset; ++i) {
+        if (text[i] == '\n') {
+            ++line;
+            line_start = i + 1;
+        }
+    }
+    auto end = offset;
+    while (end < text.size() && is_word_char(text[end])) {
+        ++end;
+    }
+    if (end == offset && end < text.size() && text[end] != '\n') {
+        end += utf8_offset(text.substr(end), 1);
+    }
+    const auto start_character = utf16_length(text.substr(line_start, offset - line_start));
+    const auto end_character = start_character + utf16_length(text.substr(offset, end - offset));
+    return Diagnostic{ TextPosition{ line, start_character }, TextPosition{ line, end_character }, error.message };
+}
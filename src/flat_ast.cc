@@ -0,0 +1,240 @@
+#include "flat_ast.hpp"
+#include "traversal.hpp"
+
+namespace {
+
+// Appends every node after its children; `last` is the index of the node visited most recently.
+class FlatBuilder : public Visitor, public StaticVisitor<FlatBuilder> {
+    template <typename Expressions> friend class ::ExpressionWalker;
+
+    FlatAst &ast;
+    NodeIndex last = no_node;
+    std::vector<NodeIndex> pending;
+    ExpressionWalker<TreeExpressions> walker;
+
+    NodeIndex add(const ASTNode *node)
+    {
+        if (!node) {
+            return no_node;
+        }
+        dispatch(*node);
+        return last;
+    }
+    template <typename Nodes> std::uint32_t add_list(const Nodes &nodes)
+    {
+        const std::size_t begin = pending.size();
+        for (const auto *node : nodes) {
+            pending.push_back(add(node));
+        }
+        return finish_list(begin);
+    }
+    std::uint32_t finish_list(std::size_t begin)
+    {
+        const auto list = ast.add_list(pending.data() + begin, pending.size() - begin);
+        pending.resize(begin);
+        return list;
+    }
+    std::uint32_t add_parameters(Span<FunctionDecl::Parameter> parameters, std::size_t begin)
+    {
+        for (const auto &param : parameters) {
+            pending.push_back(ast.add(NodeKind::Parameter, static_cast<std::uint8_t>(param.type), param.position(),
+                                      param.name.id, 0));
+        }
+        return finish_list(begin);
+    }
+    void yield(NodeKind kind, std::uint8_t op, const Position &position, std::uint32_t first, std::uint32_t second)
+    {
+        last = ast.add(kind, op, position, first, second);
+    }
+
+    // Expressions go through the walker; the rows of finished operands wait in `pending`, except for the last one,
+    // which is still in `last` when its parent is left.
+    void add_expression(const Expression &expr)
+    {
+        walker.walk(*this, TreeExpressions{}, &expr);
+    }
+    template <NodeKind kind> void enter_node(const TreeExpressions &, const Expression *)
+    {
+    }
+    template <NodeKind kind> void child_done(const TreeExpressions &, const Expression *, std::size_t index)
+    {
+        if (kind == NodeKind::FunctionCall || (kind != NodeKind::UnaryExpression && index == 0)) {
+            pending.push_back(last);
+        }
+    }
+    template <NodeKind kind> void leave_node(const TreeExpressions &expressions, const Expression *node)
+    {
+        const auto &position = node->position();
+        if constexpr (kind == NodeKind::UnaryExpression) {
+            yield(kind, static_cast<std::uint8_t>(expressions.unary_op(node)), position, last, 0);
+        } else if constexpr (kind == NodeKind::BinaryExpression || kind == NodeKind::IndexExpression) {
+            const auto lhs = pending.back();
+            pending.pop_back();
+            const std::uint8_t op =
+                kind == NodeKind::BinaryExpression ? static_cast<std::uint8_t>(expressions.binary_op(node)) : 0;
+            yield(kind, op, position, lhs, last);
+        } else if constexpr (kind == NodeKind::VariableRef) {
+            yield(kind, 0, position, expressions.name(node).id, 0);
+        } else if constexpr (kind == NodeKind::FunctionCall) {
+            const auto arguments = finish_list(pending.size() - expressions.child_count<kind>(node));
+            yield(kind, 0, position, expressions.name(node).id, arguments);
+        } else if constexpr (kind == NodeKind::IntConst) {
+            yield(kind, 0, position, static_cast<std::uint32_t>(expressions.value(node)), 0);
+        } else if constexpr (kind == NodeKind::StringConst) {
+            ast.strings.push_back(expressions.string(node));
+            yield(kind, 0, position, ast.strings.size() - 1, 0);
+        }
+    }
+
+public:
+    FlatBuilder(FlatAst &ast) : ast(ast)
+    {
+    }
+
+    void visit(const UnaryExpression &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const BinaryExpression &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const IndexExpression &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const VariableRef &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const FunctionCall &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const IntConst &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const StringConst &expr) override
+    {
+        add_expression(expr);
+    }
+    void visit(const Block &block) override
+    {
+        const auto statements = add_list(block.statements);
+        yield(NodeKind::Block, 0, Position{}, statements, 0);
+    }
+    void visit(const FunctionDecl &decl) override
+    {
+        const std::size_t begin = pending.size();
+        pending.push_back(add(decl.block));
+        const auto parts = add_parameters(decl.parameters, begin);
+        yield(NodeKind::FunctionDecl, static_cast<std::uint8_t>(decl.return_type), decl.position(), decl.func_name.id,
+              parts);
+    }
+    void visit(const ExternFunctionDecl &decl) override
+    {
+        const auto parameters = add_parameters(decl.parameters, pending.size());
+        yield(NodeKind::ExternFunctionDecl, static_cast<std::uint8_t>(decl.return_type), decl.position(),
+              decl.func_name.id, parameters);
+    }
+    void visit(const VariableDecl &decl) override
+    {
+        const std::size_t begin = pending.size();
+        for (const auto &var : decl.var_decls) {
+            const auto value = add(var.initial_value);
+            pending.push_back(
+                ast.add(NodeKind::Variable, static_cast<std::uint8_t>(var.type), var.position(), var.name.id, value));
+        }
+        yield(NodeKind::VariableDecl, 0, Position{}, finish_list(begin), 0);
+    }
+    void visit(const AssignmentStatement &stmt) override
+    {
+        const auto parts = add_list(stmt.parts);
+        yield(NodeKind::AssignmentStatement, 0, Position{}, parts, 0);
+    }
+    void visit(const ReturnStatement &stmt) override
+    {
+        const auto value = add(stmt.expr);
+        yield(NodeKind::ReturnStatement, 0, Position{}, value, 0);
+    }
+    void visit(const ExpressionStatement &stmt) override
+    {
+        const auto expr = add(stmt.expr);
+        yield(NodeKind::ExpressionStatement, 0, Position{}, expr, 0);
+    }
+    void visit(const IfStatement &stmt) override
+    {
+        const std::size_t begin = pending.size();
+        for (const auto &[condition, block] : stmt.blocks) {
+            pending.push_back(add(condition));
+            pending.push_back(add(block));
+        }
+        const auto blocks = finish_list(begin);
+        const auto else_statement = add(stmt.else_statement);
+        yield(NodeKind::IfStatement, 0, Position{}, blocks, else_statement);
+    }
+    void visit(const ForStatement &stmt) override
+    {
+        const std::size_t begin = pending.size();
+        pending.push_back(add(stmt.start));
+        pending.push_back(add(stmt.end));
+        pending.push_back(add(stmt.increase));
+        pending.push_back(add(stmt.block));
+        yield(NodeKind::ForStatement, 0, stmt.loop_variable_pos, stmt.loop_variable.id, finish_list(begin));
+    }
+    void visit(const WhileStatement &stmt) override
+    {
+        const auto condition = add(stmt.condition);
+        const auto block = add(stmt.block);
+        yield(NodeKind::WhileStatement, 0, Position{}, condition, block);
+    }
+    void visit(const Program &program) override
+    {
+        for (const auto *decl : program.externs) {
+            ast.externs.push_back(add(decl));
+        }
+        for (const auto *decl : program.global_vars) {
+            ast.global_vars.push_back(add(decl));
+        }
+        for (const auto *decl : program.functions) {
+            ast.functions.push_back(add(decl));
+        }
+    }
+};
+
+}
+
+NodeIndex FlatAst::add(NodeKind kind, std::uint8_t op, const Position &position, std::uint32_t first_value,
+                       std::uint32_t second_value)
+{
+    kinds.push_back(kind);
+    ops.push_back(op);
+    positions.push_back(position);
+    first.push_back(first_value);
+    second.push_back(second_value);
+    return kinds.size() - 1;
+}
+
+std::uint32_t FlatAst::add_list(const NodeIndex *items, std::size_t count)
+{
+    const std::uint32_t offset = lists.size();
+    lists.push_back(count);
+    lists.insert(lists.end(), items, items + count);
+    return offset;
+}
+
+std::size_t FlatAst::memory_usage() const noexcept
+{
+    return size() * (sizeof(NodeKind) + sizeof(std::uint8_t) + sizeof(Position) + 2 * sizeof(std::uint32_t)) +
+           lists.size() * sizeof(NodeIndex) + strings.size() * sizeof(std::string_view) +
+           (externs.size() + global_vars.size() + functions.size()) * sizeof(NodeIndex);
+}
+
+FlatAst flatten(const Program &program)
+{
+    FlatAst ast;
+    FlatBuilder builder{ ast };
+    builder.dispatch(program);
+    return ast;
+}
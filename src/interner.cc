@@ -0,0 +1,118 @@
+#include "interner.hpp"
+#include "utf8.hpp"
+
+#include <stdexcept>
+
+namespace {
+
+thread_local Interner *installed = nullptr;
+
+}
+
+Interner::Interner() : count(0), slots(1024, Slot{ 0, empty_slot })
+{
+    intern(""); // Symbol{} is the empty name
+    intern("int");
+    intern("string");
+    intern("main");
+}
+
+Interner &Interner::current()
+{
+    if (installed) {
+        return *installed;
+    }
+    thread_local Interner own;
+    return own;
+}
+
+Interner::Scope::Scope(Interner &interner) : previous(installed)
+{
+    installed = &interner;
+}
+
+Interner::Scope::~Scope()
+{
+    installed = previous;
+}
+
+std::string_view &Interner::entry(std::uint32_t id) const noexcept
+{
+    const std::uint32_t index = id + 1;
+    const int block = 31 - __builtin_clz(index);
+    return blocks[block][index - (std::uint32_t(1) << block)];
+}
+
+const Interner::Slot *Interner::find(std::string_view str, std::uint32_t hash) const
+{
+    const std::size_t mask = slots.size() - 1;
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot &slot = slots[i];
+        if (slot.id == empty_slot || (slot.hash == hash && entry(slot.id) == str)) {
+            return &slot;
+        }
+    }
+}
+
+void Interner::grow()
+{
+    std::vector<Slot> old(slots.size() * 2, Slot{ 0, empty_slot });
+    old.swap(slots);
+    const std::size_t mask = slots.size() - 1;
+    for (const Slot &slot : old) {
+        if (slot.id == empty_slot) {
+            continue;
+        }
+        std::size_t i = slot.hash & mask;
+        while (slots[i].id != empty_slot) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+}
+
+Symbol Interner::intern(std::string_view str)
+{
+    const auto hash = static_cast<std::uint32_t>(std::hash<std::string_view>{}(str));
+    const Slot *slot = find(str, hash);
+    if (slot->id != empty_slot) {
+        return Symbol{ slot->id };
+    }
+    const auto id = count.load(std::memory_order_relaxed);
+    if ((id + 1) * 2 > slots.size()) {
+        grow();
+        slot = find(str, hash);
+    }
+    const std::uint32_t index = id + 1;
+    const int block = 31 - __builtin_clz(index);
+    if (index == std::uint32_t(1) << block) {
+        blocks[block] = std::make_unique<std::string_view[]>(std::size_t(1) << block);
+    }
+    entry(id) = arena.store(str);
+    *const_cast<Slot *>(slot) = Slot{ hash, id };
+    count.store(id + 1, std::memory_order_release);
+    return Symbol{ id };
+}
+
+std::string_view Interner::name(Symbol symbol) const
+{
+    if (symbol.id >= count.load(std::memory_order_acquire)) {
+        throw std::out_of_range("Interner::name");
+    }
+    return entry(symbol.id);
+}
+
+std::size_t Interner::size() const noexcept
+{
+    return count.load(std::memory_order_acquire);
+}
+
+std::string_view Symbol::str() const
+{
+    return Interner::current().name(*this);
+}
+
+std::wostream &operator<<(std::wostream &os, const Symbol &symbol)
+{
+    return os << utf8_to_wstring(symbol.str());
+}
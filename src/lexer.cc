@@ -1,12 +1,348 @@
 #include "lexer.hpp"
 #include "common.hpp"
 #include "locale.hpp"
+#include "utf8.hpp"
 
 #include <locale>
 
-Lexer::Lexer(std::unique_ptr<Source> src) : locale(Locale::get().locale())
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+enum CharClass : std::uint8_t {
+    Tilde,
+    Bang,
+    Percent,
+    Caret,
+    Amp,
+    Pipe,
+    Star,
+    LParen,
+    RParen,
+    LBracket,
+    RBracket,
+    LBrace,
+    RBrace,
+    Less,
+    Greater,
+    Equal,
+    Plus,
+    Minus,
+    Colon,
+    Semicolon,
+    Comma,
+    Slash,
+    Dot,
+    Other,
+
+    Space,
+    Letter,
+    Digit,
+    Quote,
+    Hash,
+    NonAscii
+};
+
+constexpr std::size_t operator_class_count = Other + 1;
+
+constexpr std::array<CharClass, 256> make_char_classes()
+{
+    std::array<CharClass, 256> classes{};
+    for (std::size_t ch = 0; ch < classes.size(); ++ch) {
+        classes[ch] = ch < 0x80 ? Other : NonAscii;
+    }
+    for (char ch = 'a'; ch <= 'z'; ++ch) {
+        classes[ch] = Letter;
+        classes[ch - 'a' + 'A'] = Letter;
+    }
+    for (char ch = '0'; ch <= '9'; ++ch) {
+        classes[ch] = Digit;
+    }
+    for (char ch = '\t'; ch <= '\r'; ++ch) {
+        classes[ch] = Space;
+    }
+    classes[' '] = Space;
+    classes['_'] = Letter;
+    classes['"'] = Quote;
+    classes['#'] = Hash;
+
+    const char operators[] = "~!%^&|*()[]{}<>=+-:;,/.";
+    for (std::size_t i = 0; i + 1 < sizeof(operators); ++i) {
+        classes[static_cast<unsigned char>(operators[i])] = static_cast<CharClass>(i);
+    }
+    return classes;
+}
+
+constexpr std::array<CharClass, 256> char_classes = make_char_classes();
+
+inline CharClass char_class(char ch) noexcept
+{
+    return char_classes[static_cast<unsigned char>(ch)];
+}
+
+inline bool is_space(char ch) noexcept
+{
+    return char_class(ch) == Space;
+}
+
+inline bool is_digit(char ch) noexcept
+{
+    return char_class(ch) == Digit;
+}
+
+// Value of `ch` as a digit in any radix up to 36; 36 for characters that are not digits at all.
+inline std::uint32_t digit_value(char ch) noexcept
+{
+    if (is_digit(ch)) {
+        return ch - '0';
+    }
+    const char lower = ch | 0x20;
+    return lower >= 'a' && lower <= 'z' ? lower - 'a' + 10 : 36;
+}
+
+inline bool is_word(char ch) noexcept
+{
+    const auto cls = char_class(ch);
+    return cls == Letter || cls == Digit;
+}
+
+// Both scanners return the index of the first byte at or after `i` that ends the run; `size` if the run reaches the end
+// of the chunk. Non-ASCII whitespace is left to the locale aware slow path.
+std::size_t scan_spaces(const char *data, std::size_t i, std::size_t size) noexcept
+{
+#if defined(__AVX2__)
+    const __m256i space32 = _mm256_set1_epi8(' ');
+    const __m256i tab32 = _mm256_set1_epi8('\t');
+    const __m256i range32 = _mm256_set1_epi8('\r' - '\t');
+    for (; i + 32 <= size; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const __m256i control = _mm256_subs_epu8(_mm256_sub_epi8(block, tab32), range32);
+        const __m256i spaces = _mm256_or_si256(_mm256_cmpeq_epi8(block, space32),
+                                               _mm256_cmpeq_epi8(control, _mm256_setzero_si256()));
+        const auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(spaces));
+        if (mask != 0xFFFFFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i space16 = _mm_set1_epi8(' ');
+    const __m128i tab16 = _mm_set1_epi8('\t');
+    const __m128i range16 = _mm_set1_epi8('\r' - '\t');
+    for (; i + 16 <= size; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i control = _mm_subs_epu8(_mm_sub_epi8(block, tab16), range16);
+        const __m128i spaces =
+            _mm_or_si128(_mm_cmpeq_epi8(block, space16), _mm_cmpeq_epi8(control, _mm_setzero_si128()));
+        const auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(spaces));
+        if (mask != 0xFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+    while (i < size && is_space(data[i])) {
+        ++i;
+    }
+    return i;
+}
+
+std::size_t scan_to_newline(const char *data, std::size_t i, std::size_t size) noexcept
+{
+#if defined(__AVX2__)
+    const __m256i newline32 = _mm256_set1_epi8('\n');
+    for (; i + 32 <= size; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline32)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i newline16 = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline16)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    const void *newline = std::memchr(data + i, '\n', size - i);
+    return newline ? static_cast<const char *>(newline) - data : size;
+}
+
+enum OperatorState : std::uint8_t {
+    Start,
+    AfterBang,
+    AfterAmp,
+    AfterPipe,
+    AfterLess,
+    AfterGreater,
+    AfterEqual,
+    AfterMinus,
+    AfterDot,
+    Done
+};
+
+constexpr std::size_t operator_state_count = Done;
+
+struct Transition {
+    OperatorState next;
+    bool consume;
+    TokenType token;
+};
+
+typedef std::array<std::array<Transition, operator_class_count>, operator_state_count> TransitionTable;
+
+constexpr void emit_on(TransitionTable &table, OperatorState state, CharClass cls, TokenType token)
+{
+    table[state][cls] = Transition{ Done, true, token };
+}
+
+constexpr void move_on(TransitionTable &table, OperatorState state, CharClass cls, OperatorState next)
+{
+    table[state][cls] = Transition{ next, true, TokenType::INVALID };
+}
+
+constexpr void otherwise(TransitionTable &table, OperatorState state, TokenType token)
+{
+    for (auto &transition : table[state]) {
+        transition = Transition{ Done, false, token };
+    }
+}
+
+constexpr TransitionTable make_operator_transitions()
 {
-    change_source(std::move(src));
+    TransitionTable table{};
+    otherwise(table, Start, TokenType::INVALID);
+    emit_on(table, Start, Tilde, TokenType::BIT_NEG);
+    emit_on(table, Start, Percent, TokenType::MODULO);
+    emit_on(table, Start, Caret, TokenType::XOR);
+    emit_on(table, Start, Star, TokenType::STAR);
+    emit_on(table, Start, LParen, TokenType::L_PAREN);
+    emit_on(table, Start, RParen, TokenType::R_PAREN);
+    emit_on(table, Start, LBracket, TokenType::LI_PAREN);
+    emit_on(table, Start, RBracket, TokenType::RI_PAREN);
+    emit_on(table, Start, LBrace, TokenType::LS_PAREN);
+    emit_on(table, Start, RBrace, TokenType::RS_PAREN);
+    emit_on(table, Start, Plus, TokenType::PLUS);
+    emit_on(table, Start, Colon, TokenType::COLON);
+    emit_on(table, Start, Semicolon, TokenType::SEMICOLON);
+    emit_on(table, Start, Comma, TokenType::COMMA);
+    emit_on(table, Start, Slash, TokenType::DIVIDE);
+    move_on(table, Start, Bang, AfterBang);
+    move_on(table, Start, Amp, AfterAmp);
+    move_on(table, Start, Pipe, AfterPipe);
+    move_on(table, Start, Less, AfterLess);
+    move_on(table, Start, Greater, AfterGreater);
+    move_on(table, Start, Equal, AfterEqual);
+    move_on(table, Start, Minus, AfterMinus);
+    move_on(table, Start, Dot, AfterDot);
+
+    otherwise(table, AfterBang, TokenType::BOOLEAN_NEG);
+    emit_on(table, AfterBang, Equal, TokenType::NOT_EQUAL);
+    otherwise(table, AfterAmp, TokenType::AMPERSAND);
+    emit_on(table, AfterAmp, Amp, TokenType::BOOLEAN_AND);
+    otherwise(table, AfterPipe, TokenType::BIT_OR);
+    emit_on(table, AfterPipe, Pipe, TokenType::BOOLEAN_OR);
+    otherwise(table, AfterLess, TokenType::LESS);
+    emit_on(table, AfterLess, Less, TokenType::SHIFT_LEFT);
+    emit_on(table, AfterLess, Equal, TokenType::LESS_EQUAL);
+    otherwise(table, AfterGreater, TokenType::GREATER);
+    emit_on(table, AfterGreater, Greater, TokenType::SHIFT_RIGHT);
+    emit_on(table, AfterGreater, Equal, TokenType::GREATER_EQUAL);
+    otherwise(table, AfterEqual, TokenType::ASSIGN);
+    emit_on(table, AfterEqual, Equal, TokenType::EQUAL);
+    otherwise(table, AfterMinus, TokenType::MINUS);
+    emit_on(table, AfterMinus, Greater, TokenType::TYPE_DECL);
+    otherwise(table, AfterDot, TokenType::INVALID);
+    emit_on(table, AfterDot, Dot, TokenType::RANGE_SEP);
+    return table;
+}
+
+constexpr TransitionTable operator_transitions = make_operator_transitions();
+
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr Keyword keyword_list[] = { { "fn", TokenType::KW_FN },         { "for", TokenType::KW_FOR },
+                                     { "while", TokenType::KW_WHILE },   { "if", TokenType::KW_IF },
+                                     { "elif", TokenType::KW_ELIF },     { "else", TokenType::KW_ELSE },
+                                     { "return", TokenType::KW_RETURN }, { "let", TokenType::KW_LET },
+                                     { "in", TokenType::KW_IN },         { "extern", TokenType::KW_EXTERN } };
+
+constexpr std::size_t keyword_table_size = 32;
+constexpr std::size_t keyword_min_length = 2;
+constexpr std::size_t keyword_max_length = 6;
+
+constexpr std::size_t keyword_hash(std::string_view word) noexcept
+{
+    return (word.size() * 3 + static_cast<unsigned char>(word.front()) + static_cast<unsigned char>(word.back())) %
+           keyword_table_size;
+}
+
+constexpr bool keyword_hash_is_perfect()
+{
+    for (const auto &first : keyword_list) {
+        for (const auto &second : keyword_list) {
+            if (first.type != second.type && keyword_hash(first.text) == keyword_hash(second.text)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(keyword_hash_is_perfect(), "keyword_hash must map every keyword to a distinct slot");
+
+constexpr std::array<Keyword, keyword_table_size> make_keyword_table()
+{
+    std::array<Keyword, keyword_table_size> table{};
+    for (const auto &keyword : keyword_list) {
+        table[keyword_hash(keyword.text)] = keyword;
+    }
+    return table;
+}
+
+constexpr std::array<Keyword, keyword_table_size> keyword_table = make_keyword_table();
+
+inline TokenType keyword_type(std::string_view word) noexcept
+{
+    if (word.size() < keyword_min_length || word.size() > keyword_max_length) {
+        return TokenType::IDENTIFIER;
+    }
+    const Keyword &keyword = keyword_table[keyword_hash(word)];
+    return keyword.text == word ? keyword.type : TokenType::IDENTIFIER;
+}
+
+} // namespace
+
+Lexer::Lexer(std::unique_ptr<Source> src)
+    : sources(std::make_shared<SourceManager>()), buffer(0), source(nullptr), base(0), chunk_start(0), index(0),
+      locale(Locale::get().locale())
+{
+    if (src) {
+        change_source(std::move(src));
+    }
+}
+
+Lexer::Lexer(std::shared_ptr<SourceManager> sources, SourceManager::BufferId buffer)
+    : sources(std::move(sources)), buffer(0), source(nullptr), base(0), chunk_start(0), index(0),
+      locale(Locale::get().locale())
+{
+    change_source(buffer);
 }
 
 std::unique_ptr<Lexer> Lexer::from_source(std::unique_ptr<Source> source)
@@ -14,247 +350,457 @@ std::unique_ptr<Lexer> Lexer::from_source(std::unique_ptr<Source> source)
     return std::make_unique<Lexer>(std::move(source));
 }
 
+std::unique_ptr<Lexer> Lexer::from_source(std::shared_ptr<SourceManager> sources, SourceManager::BufferId buffer)
+{
+    return std::make_unique<Lexer>(std::move(sources), buffer);
+}
+
+const std::shared_ptr<SourceManager> &Lexer::source_manager() const noexcept
+{
+    return sources;
+}
+
 std::wstring Lexer::get_lines(std::size_t from, std::size_t to)
 {
     return source->get_lines(from, to);
 }
 
-Token Lexer::next()
+std::wstring Lexer::get_line(std::size_t line)
 {
-    if (!ch_opt) {
-        ch_opt = source->next();
+    return source->get_line(line);
+}
+
+wchar_t Lexer::current_char() const noexcept
+{
+    wchar_t ch;
+    utf8_decode(chunk.data() + index, chunk.data() + chunk.size(), ch);
+    return ch;
+}
+
+std::size_t Lexer::non_ascii_length(std::ctype_base::mask mask)
+{
+    const auto ch_opt = peek();
+    if (!ch_opt || static_cast<unsigned char>(*ch_opt) < 0x80) {
+        return 0;
+    }
+    wchar_t ch;
+    const std::size_t length = utf8_decode(chunk.data() + index, chunk.data() + chunk.size(), ch);
+    return std::use_facet<std::ctype<wchar_t> >(locale).is(mask, ch) ? length : 0;
+}
+
+bool Lexer::refill()
+{
+    if (!source) {
+        return false;
     }
+    chunk_start += chunk.size();
+    chunk = source->next_chunk();
+    index = 0;
+    if (static_cast<std::uint64_t>(base) + chunk_start + chunk.size() >= SourceManager::max_location) {
+        Source::report_error("Input exceeds the 4 GiB source location space");
+    }
+    return !chunk.empty();
+}
 
+void Lexer::skip_trivia()
+{
     while (skip_space() || skip_comment())
         ;
+}
+
+Token Lexer::next()
+{
+    skip_trivia();
 
-    position = source->get_position();
+    const auto ch_opt = peek();
+    position = Position{ base + static_cast<std::uint32_t>(offset()) };
 
     if (!ch_opt) {
-        return make_token(TokenType::END_OF_FILE, position);
+        return lexem(TokenType::END_OF_FILE);
     }
 
     const auto ch = *ch_opt;
 
-    if (std::isalpha(ch, locale) || ch == L'_') {
+    switch (char_class(ch)) {
+    case Letter:
         return keyword_or_identifier();
-    } else if (std::isdigit(ch, locale)) {
+    case Digit:
         return int_const();
-    } else if (ch == L'"') {
+    case Quote:
         return string_const();
-    } else if (operator_chars.find(ch) != operator_chars.end()) {
+    case NonAscii:
+        if (non_ascii_length(std::ctype_base::alpha)) {
+            return keyword_or_identifier();
+        }
+        break;
+    case Space:
+    case Hash:
+    case Other:
+        break;
+    default:
         return operator_lexem();
-    } else {
-        report_error(position, L"Unrecognised character", *ch_opt);
     }
+    report_error(position, L"Unrecognised character", current_char());
 }
 
-std::unique_ptr<Source> Lexer::change_source(std::unique_ptr<Source> src) noexcept
+TokenBuffer Lexer::tokenize_all()
 {
-    std::unique_ptr<Source> ret = std::move(source);
-    source = std::move(src);
-    return ret;
+    TokenBuffer tokens;
+    tokens.reserve(source->size_hint() / 3); // real code averages more than three bytes per token
+    Token token;
+    do {
+        token = next();
+        tokens.push_back(token);
+    } while (token.type != TokenType::END_OF_FILE);
+    return tokens;
+}
+
+Lexer::Lexer(std::string_view input, std::uint32_t base, std::size_t begin)
+    : buffer(0), source(nullptr), base(base), chunk(input), chunk_start(0), index(begin),
+      locale(Locale::get().locale())
+{
+}
+
+Lexer::Slice Lexer::lex_slice(std::size_t begin, std::size_t end) const
+{
+    Slice slice;
+    slice.tokens.reserve((end - begin) / 3);
+    slice.names = std::make_unique<Interner>();
+    Interner::Scope scope(*slice.names);
+    Lexer lexer{ chunk, base, begin };
+    for (;;) {
+        lexer.skip_trivia();
+        slice.stop = lexer.offset();
+        if (slice.stop >= end) {
+            return slice;
+        }
+        try {
+            slice.tokens.push_back(lexer.next());
+        } catch (...) {
+            slice.failed = true;
+            return slice;
+        }
+    }
+}
+
+TokenBuffer Lexer::tokenize_parallel(std::size_t threads)
+{
+    constexpr std::size_t min_slice_size = 1 << 20;
+
+    if (!peek() || !source->keeps_chunks() || chunk_start != 0 || chunk.size() != source->size_hint()) {
+        return tokenize_all();
+    }
+    threads = std::min(threads, (chunk.size() - index) / min_slice_size);
+    if (threads < 2) {
+        return tokenize_all();
+    }
+
+    // Slices start right after a newline, so only a multi-line string literal can make a speculative start wrong.
+    std::vector<std::size_t> bounds{ index };
+    for (std::size_t i = 1; i < threads; ++i) {
+        const auto target = index + (chunk.size() - index) * i / threads;
+        const auto newline = chunk.find('\n', std::max(target, bounds.back()));
+        if (newline == std::string_view::npos) {
+            break;
+        }
+        bounds.push_back(newline + 1);
+    }
+    bounds.push_back(chunk.size());
+
+    std::vector<Slice> slices(bounds.size() - 1);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < slices.size(); ++i) {
+        workers.emplace_back([this, &slices, &bounds, i]() { slices[i] = lex_slice(bounds[i], bounds[i + 1]); });
+    }
+
+    // The first slice starts in phase, so it is lexed straight into the result while the workers speculate.
+    TokenBuffer tokens;
+    tokens.reserve(source->size_hint() / 3);
+    try {
+        for (skip_trivia(); offset() < bounds[1]; skip_trivia()) {
+            tokens.push_back(next());
+        }
+    } catch (...) {
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        throw;
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    // Lexing is stateless between tokens, so once the serial position lands on a speculative token start the rest of
+    // that slice is exactly what the serial lexer would produce. Until then the serial lexer fills the gap.
+    for (std::size_t i = 1; i < slices.size(); ++i) {
+        const auto &slice = slices[i];
+        std::size_t next_token = 0;
+        for (;;) {
+            skip_trivia();
+            const auto start = offset();
+            if (start >= bounds[i + 1]) {
+                break;
+            }
+            while (next_token < slice.tokens.size() && slice.tokens[next_token].position.location - base < start) {
+                ++next_token;
+            }
+            if (next_token < slice.tokens.size() && slice.tokens[next_token].position.location - base == start) {
+                const auto first = tokens.size();
+                tokens.append(slice.tokens, next_token);
+                next_token = slice.tokens.size();
+                std::vector<std::uint32_t> symbols(slice.names->size(), UINT32_MAX);
+                for (auto j = first; j < tokens.size(); ++j) {
+                    const Token token = tokens[j];
+                    if (token.type == TokenType::IDENTIFIER) {
+                        auto &symbol = symbols[token.payload];
+                        if (symbol == UINT32_MAX) {
+                            symbol = intern(slice.names->name(Symbol{ token.payload })).id;
+                        }
+                        tokens.set_payload(j, symbol);
+                    } else if (token.type == TokenType::STRINGCONST) {
+                        const auto literal = chunk.substr(token.position.location - base + 1, token.length - 2);
+                        tokens.set_payload(j, add_literal(literal, false));
+                    }
+                }
+                index = slice.stop;
+                if (!slice.failed) {
+                    break;
+                }
+            }
+            tokens.push_back(next());
+        }
+    }
+    tokens.push_back(next());
+    return tokens;
+}
+
+SourceManager::BufferId Lexer::change_source(std::unique_ptr<Source> src, std::string name)
+{
+    const auto id = sources->add(std::move(src), std::move(name));
+    change_source(id);
+    return id;
+}
+
+void Lexer::change_source(SourceManager::BufferId id)
+{
+    buffer = id;
+    source = &sources->source(id);
+    base = sources->base(id);
+    chunk = {};
+    chunk_start = 0;
+    index = 0;
 }
 
 Token Lexer::keyword_or_identifier()
 {
-    std::wstring str;
-    wchar_t ch = *ch_opt;
+    const char *begin = chunk.data() + index;
+    const char *end = chunk.data() + chunk.size();
+    const char *it = begin;
+    while (it != end && is_word(*it)) {
+        ++it;
+    }
+    if (it != end && char_class(*it) != NonAscii) {
+        const std::string_view word(begin, it - begin);
+        index = it - chunk.data();
+        const TokenType type = keyword_type(word);
+        if (type != TokenType::IDENTIFIER) {
+            return lexem(type);
+        }
+        return lexem(TokenType::IDENTIFIER, intern(word).id);
+    }
 
-    while (std::isalpha(ch, locale) || std::isdigit(ch, locale) || ch == L'_') {
-        str += ch;
-        ch_opt = source->next();
-        if (!ch_opt) {
+    std::string str;
+    for (;;) {
+        collect_while(str, is_word);
+        const std::size_t length = non_ascii_length(std::ctype_base::alnum);
+        if (!length) {
             break;
         }
-        ch = *ch_opt;
+        str.append(chunk.data() + index, length);
+        index += length;
     }
 
-    if (keywords.find(str) != keywords.end()) {
-        return make_token(keywords.at(str), position);
-    } else {
-        return make_token(TokenType::IDENTIFIER, position, str);
+    const TokenType type = keyword_type(str);
+    if (type != TokenType::IDENTIFIER) {
+        return lexem(type);
     }
+    return lexem(TokenType::IDENTIFIER, intern(str).id);
 }
 
 Token Lexer::operator_lexem()
 {
-    wchar_t ch = *ch_opt;
-    ch_opt = source->next();
-    switch (ch) {
-    case L'~':
-        return make_token(TokenType::BIT_NEG, position);
-    case L'!':
-        return choose_operator_on(L'=', TokenType::NOT_EQUAL, TokenType::BOOLEAN_NEG);
-    case L'%':
-        return make_token(TokenType::MODULO, position);
-    case L'^':
-        return make_token(TokenType::XOR, position);
-    case L'&':
-        return choose_operator_on(L'&', TokenType::BOOLEAN_AND, TokenType::AMPERSAND);
-    case L'|':
-        return choose_operator_on(L'|', TokenType::BOOLEAN_OR, TokenType::BIT_OR);
-    case L'*':
-        return make_token(TokenType::STAR, position);
-    case L'(':
-        return make_token(TokenType::L_PAREN, position);
-    case L')':
-        return make_token(TokenType::R_PAREN, position);
-    case L'[':
-        return make_token(TokenType::LI_PAREN, position);
-    case L']':
-        return make_token(TokenType::RI_PAREN, position);
-    case L'{':
-        return make_token(TokenType::LS_PAREN, position);
-    case L'}':
-        return make_token(TokenType::RS_PAREN, position);
-    case L'<':
-        return choose_operator_on(L'<', TokenType::SHIFT_LEFT, L'=', TokenType::LESS_EQUAL, TokenType::LESS);
-    case L'>':
-        return choose_operator_on(L'>', TokenType::SHIFT_RIGHT, L'=', TokenType::GREATER_EQUAL, TokenType::GREATER);
-    case L'=':
-        return choose_operator_on(L'=', TokenType::EQUAL, TokenType::ASSIGN);
-    case L'+':
-        return make_token(TokenType::PLUS, position);
-    case L'-':
-        return choose_operator_on(L'>', TokenType::TYPE_DECL, TokenType::MINUS);
-    case L':':
-        return make_token(TokenType::COLON, position);
-    case L';':
-        return make_token(TokenType::SEMICOLON, position);
-    case L',':
-        return make_token(TokenType::COMMA, position);
-    case L'/':
-        return make_token(TokenType::DIVIDE, position);
-    }
-    if (ch == L'.' && ch_opt && *ch_opt == L'.') {
-        ch_opt = source->next();
-        return make_token(TokenType::RANGE_SEP, position);
-    }
-    report_error(position, L"Error operator undefined", *ch_opt);
-}
-
-Token Lexer::choose_operator_on(TokenType on_mismatch)
-{
-    return make_token(on_mismatch, position);
+    const char first = *peek();
+    OperatorState state = Start;
+    for (;;) {
+        const auto ch_opt = peek();
+        const auto cls = ch_opt && char_class(*ch_opt) < operator_class_count ? char_class(*ch_opt) : Other;
+        const Transition &transition = operator_transitions[state][cls];
+        if (transition.consume) {
+            advance();
+        }
+        if (transition.next == Done) {
+            if (transition.token == TokenType::INVALID) {
+                report_error(position, L"Error operator undefined", first);
+            }
+            return lexem(transition.token);
+        }
+        state = transition.next;
+    }
 }
 
 bool Lexer::skip_space()
 {
-    if (!std::isspace(*ch_opt, locale)) {
+    const auto ch_opt = peek();
+    std::size_t length = 0;
+    if (!ch_opt || !(is_space(*ch_opt) || (length = non_ascii_length(std::ctype_base::space)))) {
         return false;
     }
-    while (ch_opt && std::isspace(*ch_opt, locale)) {
-        ch_opt = source->next();
-    }
+    do {
+        index += length;
+        skip_run(scan_spaces);
+    } while ((length = non_ascii_length(std::ctype_base::space)));
     return true;
 }
 
 bool Lexer::skip_comment()
 {
-    if (*ch_opt != L'#') {
+    const auto ch_opt = peek();
+    if (!ch_opt || *ch_opt != '#') {
         return false;
     }
-    while (ch_opt && *ch_opt != L'\n') {
-        ch_opt = source->next();
-    }
+    skip_run(scan_to_newline);
     return true;
 }
 
 Token Lexer::int_const()
 {
-    std::wstring str;
-    wchar_t ch = *ch_opt;
+    // Decimal literals have to fit in an int; hex and binary ones are bit patterns and may use all 32 bits.
+    std::uint32_t radix = 10;
+    std::uint64_t limit = std::numeric_limits<int>::max();
+    std::size_t digits = 0;
+    if (*peek() == '0') {
+        advance();
+        ++digits;
+        const auto prefix = peek();
+        if (prefix && ((*prefix | 0x20) == 'x' || (*prefix | 0x20) == 'b')) {
+            advance();
+            digits = 0;
+            radix = (*prefix | 0x20) == 'x' ? 16 : 2;
+            limit = std::numeric_limits<std::uint32_t>::max();
+        }
+    }
 
-    while (std::isdigit(ch, locale)) {
-        str += ch;
-        ch_opt = source->next();
-        if (!ch_opt) {
+    // A `_` has to stand between two digits; any other one ends the literal, which is then reported.
+    std::uint64_t value = 0;
+    bool separator = false;
+    bool overflow = false;
+    for (auto ch_opt = peek(); ch_opt; ch_opt = peek()) {
+        if (*ch_opt == '_' && digits && !separator) {
+            separator = true;
+        } else if (const auto digit = digit_value(*ch_opt); digit < radix) {
+            value = value * radix + digit;
+            overflow |= value > limit;
+            value = std::min(value, limit);
+            separator = false;
+            ++digits;
+        } else {
             break;
         }
-        ch = *ch_opt;
+        advance();
     }
 
-    try {
-        return make_token(TokenType::INTCONST, position, std::stoi(str));
-    } catch (const std::invalid_argument &) {
-        report_error(position, L"Cannot convert this literal to int", str);
-    } catch (const std::out_of_range &) {
-        report_error(position, L"Number is to big to be albe to fit in an int", str);
+    if (!digits || separator) {
+        report_error(position, L"Cannot convert this literal to int", lexem_text());
     }
+    if (overflow) {
+        report_error(position, L"Number is to big to be albe to fit in an int", lexem_text());
+    }
+    return lexem(TokenType::INTCONST, static_cast<std::uint32_t>(value));
 }
 
 Token Lexer::string_const()
 {
-    std::wstring str;
-    wchar_t ch;
-    bool escaped = false;
-
-    ch_opt = source->next();
-    while (ch_opt) {
-        ch = *ch_opt;
-
-        if (escaped) {
-            escaped = false;
-            str += escape_char(ch);
-        } else {
-            if (ch == L'"') {
-                ch_opt = source->next();
-                return make_token(TokenType::STRINGCONST, position, str);
-            } else if (ch == L'\\') {
-                escaped = true;
-            } else {
-                str += ch;
+    advance();
+    const char *begin = chunk.data() + index;
+    const char *end = chunk.data() + chunk.size();
+    for (const char *it = begin; it != end; ++it) {
+        if (*it == '\\') {
+            if (++it == end) {
+                break;
             }
+        } else if (*it == '"') {
+            index = it + 1 - chunk.data();
+            const std::string_view raw(begin, it - begin);
+            return lexem(TokenType::STRINGCONST, add_literal(raw, !source || !source->keeps_chunks()));
         }
-        ch_opt = source->next();
     }
-    report_error(position, L"Error reached end of file while collecting string", str);
+
+    std::string raw;
+    collect_while(raw, [](char ch) { return ch != '"' && ch != '\\'; });
+    for (auto ch_opt = peek(); ch_opt; ch_opt = peek()) {
+        advance();
+        if (*ch_opt == '"') {
+            return lexem(TokenType::STRINGCONST, add_literal(raw, true));
+        }
+        const auto escaped = peek();
+        if (!escaped) {
+            break;
+        }
+        advance();
+        raw += '\\';
+        raw += *escaped;
+        collect_while(raw, [](char ch) { return ch != '"' && ch != '\\'; });
+    }
+    report_error(position, L"Error reached end of file while collecting string", unescape(raw));
 }
 
-wchar_t Lexer::escape_char(wchar_t ch)
+std::string Lexer::source_between(const Position &start, const Position &end)
 {
-    switch (ch) {
-    case 'n':
-        return '\n';
-    case 'r':
-        return '\r';
-    case 'a':
-        return '\a';
-    case 'b':
-        return '\b';
-    case 't':
-        return '\t';
+    return sources->input_between(start, end);
+}
 
-    default:
-        return ch;
+void Lexer::retain_from(const Position &position) noexcept
+{
+    if (source) {
+        source->retain_from(position.location > base ? position.location - base : 0);
     }
 }
 
-std::wstring Lexer::source_between(const Position &start, const Position &end)
+void Lexer::wait_for_input(bool waiting) noexcept
 {
-    return source->input_between(start, end);
+    if (source) {
+        source->wait_for_input(waiting);
+    }
 }
 
-void Lexer::report_error(const Position &error_position, const std::wstring &error_msg, wchar_t bad_char)
+std::string Lexer::lexem_text()
 {
-    throw LexerException{ concat(L"Error line ", std::to_wstring(error_position.line_number), L" in `\033[31;1;4m",
-                                 bad_char, L"\033[0m`\n", error_msg) };
+    return sources ? source_between(position, Position{ base + static_cast<std::uint32_t>(offset()) }) : "";
 }
 
-void Lexer::report_error(const Position &error_position, const std::wstring &error_msg, const std::wstring &bad_lexem)
+std::uint32_t Lexer::add_literal(std::string_view raw, bool copy)
 {
-    throw LexerException{ concat(L"Error line ", std::to_wstring(error_position.line_number), L" in `\033[31;1;4m",
-                                 bad_lexem, L"\033[0m`\n", error_msg) };
+    return sources ? sources->add_literal(raw, copy) : 0;
 }
 
-const std::unordered_map<std::wstring, TokenType> Lexer::keywords = {
-    { L"fn", TokenType::KW_FN },         { L"for", TokenType::KW_FOR },   { L"while", TokenType::KW_WHILE },
-    { L"if", TokenType::KW_IF },         { L"elif", TokenType::KW_ELIF }, { L"else", TokenType::KW_ELSE },
-    { L"return", TokenType::KW_RETURN }, { L"let", TokenType::KW_LET },   { L"in", TokenType::KW_IN },
-    { L"extern", TokenType::KW_EXTERN }
-};
+void Lexer::report_error(const Position &error_position, const std::wstring &error_msg, wchar_t bad_char)
+{
+    if (!sources) {
+        throw LexerException{ error_msg, error_msg, error_position };
+    }
+    const auto line = sources->decode(error_position).line_number;
+    throw LexerException{ concat(L"Error line ", std::to_wstring(line), L" in `\033[31;1;4m", bad_char, L"\033[0m`\n",
+                                 error_msg),
+                          concat(error_msg, L" `", bad_char, L"`"), error_position };
+}
 
-const std::unordered_set<wchar_t> Lexer::operator_chars = { L'~', L'!', L'%', L'^', L'&', L'*', L'(', L')',
-                                                            L'[', L']', L'{', L'}', L'<', L'>', L'=', L'+',
-                                                            L'-', L'/', L':', L';', L',', L'|', L'.' };
+void Lexer::report_error(const Position &error_position, const std::wstring &error_msg, const std::string &bad_lexem)
+{
+    if (!sources) {
+        throw LexerException{ error_msg, error_msg, error_position };
+    }
+    const auto line = sources->decode(error_position).line_number;
+    throw LexerException{ concat(L"Error line ", std::to_wstring(line), L" in `\033[31;1;4m", bad_lexem, L"\033[0m`\n",
+                                 error_msg),
+                          concat(error_msg, L" `", bad_lexem, L"`"), error_position };
+}
@@ -4,7 +4,9 @@
 #include "parser.hpp"
 #include "print.hpp"
 #include "semantic.hpp"
+#include "server.hpp"
 #include "source.hpp"
+#include "source_manager.hpp"
 
 #include <boost/exception/all.hpp>
 #include <iostream>
@@ -18,20 +20,37 @@ int main(int argc, char *argv[])
             options.help();
             return 0;
         }
+        if (options.runLanguageServer()) {
+            LanguageServer server{ std::cin, std::cout };
+            return server.run();
+        }
 
-        std::unique_ptr<Source> source;
+        auto sources = std::make_shared<SourceManager>();
+        SourceManager::BufferId buffer;
         if (options.getInputFile()) {
-            source = Source::from_file(*options.getInputFile());
+            buffer = sources->add(Source::from_file(*options.getInputFile(), options.getStreamWindow()),
+                                  *options.getInputFile());
         } else {
-            source = Source::from_stdin();
+            buffer = sources->add(Source::from_stdin(options.getStreamWindow()));
         }
 
-        auto lexer = Lexer::from_source(std::move(source));
+        auto lexer = Lexer::from_source(sources, buffer);
         Parser parser;
-        parser.attach_lexer(std::move(lexer));
-        auto program = parser.parse();
-        source = parser.detach_lexer()->change_source();
-        analyse(program, std::move(source));
+        if (options.getMaxDepth()) {
+            parser.set_depth_limit(*options.getMaxDepth());
+        }
+        std::unique_ptr<Program> program;
+        // A bounded window only bounds memory if tokens are consumed as they are read, so it implies pipelining.
+        if (options.runPipelined() || options.getStreamWindow()) {
+            IncrementalAnalyser analyser{ sources };
+            parser.attach_lexer(std::move(lexer), true);
+            program = parser.parse(analyser);
+            analyser.finish(program);
+        } else {
+            parser.attach_lexer(std::move(lexer));
+            program = parser.parse();
+            analyse(program, sources);
+        }
         auto compiled = compile(program);
 
         if (options.getOutputFile()) {
@@ -1,72 +1,439 @@
 #include "parser.hpp"
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <thread>
 
-std::unique_ptr<Lexer> Parser::attach_lexer(std::unique_ptr<Lexer> lex) noexcept
+namespace {
+
+// Binding strength of the binary operators; every other token has None. No binary operator is at UnaryLogical, the
+// lowest level whose operands may start with `!`.
+namespace Precedence {
+enum : int { None, Conditional, UnaryLogical, Comparison, Bitwise, Additive, Multiplicative };
+}
+
+struct BinaryOperatorEntry {
+    int precedence = Precedence::None;
+    BinaryOperator op = BinaryOperator::Plus;
+};
+
+// Operator tokens are numbered from PLUS up to RI_PAREN, so the table covers just that range.
+constexpr std::size_t first_operator = static_cast<std::size_t>(TokenType::PLUS);
+constexpr std::size_t operator_count = static_cast<std::size_t>(TokenType::RI_PAREN) - first_operator + 1;
+
+constexpr std::array<BinaryOperatorEntry, operator_count> make_binary_operators()
+{
+    std::array<BinaryOperatorEntry, operator_count> table{};
+    auto set = [&table](TokenType type, int precedence, BinaryOperator op) {
+        table[static_cast<std::size_t>(type) - first_operator] = BinaryOperatorEntry{ precedence, op };
+    };
+    set(TokenType::BOOLEAN_AND, Precedence::Conditional, BinaryOperator::BooleanAnd);
+    set(TokenType::BOOLEAN_OR, Precedence::Conditional, BinaryOperator::BooleanOr);
+
+    set(TokenType::LESS, Precedence::Comparison, BinaryOperator::Less);
+    set(TokenType::GREATER, Precedence::Comparison, BinaryOperator::Greater);
+    set(TokenType::LESS_EQUAL, Precedence::Comparison, BinaryOperator::LessEqual);
+    set(TokenType::GREATER_EQUAL, Precedence::Comparison, BinaryOperator::GreaterEqual);
+    set(TokenType::EQUAL, Precedence::Comparison, BinaryOperator::Equal);
+    set(TokenType::NOT_EQUAL, Precedence::Comparison, BinaryOperator::NotEqual);
+
+    set(TokenType::AMPERSAND, Precedence::Bitwise, BinaryOperator::And);
+    set(TokenType::BIT_OR, Precedence::Bitwise, BinaryOperator::Or);
+    set(TokenType::XOR, Precedence::Bitwise, BinaryOperator::Xor);
+    set(TokenType::SHIFT_LEFT, Precedence::Bitwise, BinaryOperator::ShiftLeft);
+    set(TokenType::SHIFT_RIGHT, Precedence::Bitwise, BinaryOperator::ShiftRight);
+
+    set(TokenType::PLUS, Precedence::Additive, BinaryOperator::Plus);
+    set(TokenType::MINUS, Precedence::Additive, BinaryOperator::Minus);
+
+    set(TokenType::STAR, Precedence::Multiplicative, BinaryOperator::Multiply);
+    set(TokenType::DIVIDE, Precedence::Multiplicative, BinaryOperator::Divide);
+    set(TokenType::MODULO, Precedence::Multiplicative, BinaryOperator::Modulo);
+    return table;
+}
+
+constexpr auto binary_operators = make_binary_operators();
+
+BinaryOperatorEntry binary_operator(TokenType type) noexcept
 {
+    const std::size_t index = static_cast<std::size_t>(type) - first_operator;
+    return index < operator_count ? binary_operators[index] : BinaryOperatorEntry{};
+}
+
+}
+
+Parser::~Parser()
+{
+    stop_lexing();
+}
+
+std::unique_ptr<Lexer> Parser::attach_lexer(std::unique_ptr<Lexer> lex, bool pipelined)
+{
+    stop_lexing();
     auto tmp = std::move(lexer);
     lexer = std::move(lex);
-    advance();
+    sources = lexer->source_manager();
+    tokens = {};
+    cursor = 0;
+    if (pipelined) {
+        constexpr std::size_t queue_capacity = 64;
+        batches = std::make_unique<SpscQueue<TokenBatch> >(queue_capacity);
+        lexer->retain_from(Position{ 0 });
+        stop_producer = false;
+        producer = std::thread(&Parser::produce_tokens, this, std::ref(*lexer), std::ref(Interner::current()));
+        receive_tokens();
+    } else {
+        tokens = lexer->tokenize_parallel(std::thread::hardware_concurrency());
+    }
+    token = tokens[cursor];
+    return tmp;
+}
+
+std::unique_ptr<Lexer> Parser::attach_lexer(std::unique_ptr<Lexer> lex, TokenBuffer recorded)
+{
+    stop_lexing();
+    auto tmp = std::move(lexer);
+    lexer = std::move(lex);
+    sources = lexer->source_manager();
+    tokens = std::move(recorded);
+    cursor = 0;
+    token = tokens[cursor];
     return tmp;
 }
 
 std::unique_ptr<Lexer> Parser::detach_lexer() noexcept
 {
+    stop_lexing();
     return std::move(lexer);
 }
 
-void Parser::advance() noexcept
+void Parser::set_depth_limit(std::size_t limit) noexcept
+{
+    depth_limit = limit;
+}
+
+Parser::NestingGuard::NestingGuard(Parser &parser, const Position &position) : parser(parser)
+{
+    if (++parser.depth > parser.depth_limit) {
+        --parser.depth;
+        parser.report_nested_too_deeply(position);
+    }
+}
+
+void Parser::produce_tokens(Lexer &lex, Interner &names)
+{
+    constexpr std::size_t batch_size = 4096;
+    Interner::Scope scope(names);
+    for (;;) {
+        TokenBatch batch;
+        batch.tokens.reserve(batch_size);
+        try {
+            while (batch.tokens.size() < batch_size && !batch.last) {
+                const Token next = lex.next();
+                batch.tokens.push_back(next);
+                batch.last = is_eof(next);
+            }
+        } catch (...) {
+            if (batch.tokens.size()) {
+                batches->push(std::move(batch));
+            }
+            TokenBatch failure;
+            failure.error = std::current_exception();
+            failure.last = true;
+            batches->push(std::move(failure));
+            return;
+        }
+        batch.last = batch.last || stop_producer.load(std::memory_order_relaxed);
+        const bool last = batch.last;
+        batches->push(std::move(batch));
+        if (last) {
+            return;
+        }
+    }
+}
+
+void Parser::receive_tokens()
+{
+    // The lexer holds back while the stream window is full of text still retained here; once every token is used up,
+    // it has to read on regardless.
+    const bool starved = batches->empty();
+    if (starved) {
+        lexer->wait_for_input(true);
+    }
+    TokenBatch batch = batches->pop();
+    if (starved) {
+        lexer->wait_for_input(false);
+    }
+    if (batch.last) {
+        producer.join();
+        batches.reset();
+    }
+    if (batch.error) {
+        std::rethrow_exception(batch.error);
+    }
+    // Only the unread tail is kept, so a pipelined parse holds a bounded window of tokens.
+    TokenBuffer window;
+    window.reserve(tokens.size() - cursor + batch.tokens.size());
+    window.append(tokens, cursor);
+    window.append(batch.tokens, 0);
+    tokens = std::move(window);
+    cursor = 0;
+}
+
+// The lexer thread extends the source's line table while it reads, so it has to finish before diagnostics decode
+// positions.
+void Parser::stop_lexing() noexcept
 {
-    token = lexer->next();
+    if (!producer.joinable()) {
+        return;
+    }
+    stop_producer = true;
+    lexer->wait_for_input(true);
+    while (!batches->pop().last) {
+    }
+    producer.join();
+    lexer->wait_for_input(false);
+    batches.reset();
+}
+
+void Parser::advance()
+{
+    if (cursor + 1 >= tokens.size() && batches) {
+        receive_tokens();
+    }
+    if (cursor + 1 < stream->size()) {
+        ++cursor;
+    }
+    token = (*stream)[cursor];
+}
+
+Token Parser::peek(std::size_t distance)
+{
+    while (cursor + distance >= tokens.size() && batches) {
+        receive_tokens();
+    }
+    return (*stream)[std::min(cursor + distance, stream->size() - 1)];
+}
+
+std::unique_ptr<Program> Parser::parse(std::size_t threads)
+{
+    return parse_Program(threads);
 }
 
-std::unique_ptr<Program> Parser::parse()
+std::unique_ptr<Program> Parser::parse(DeclarationSink &declarations)
 {
-    return parse_Program();
+    sink = &declarations;
+    auto program = parse_Program(1);
+    sink = nullptr;
+    return program;
 }
 
-BuiltinType Parser::get_builtin_type(const std::wstring &wstr) const
+BuiltinType Parser::get_builtin_type(Symbol name)
 {
-    if (wstr == L"int") {
+    if (name == int_symbol) {
         return BuiltinType::Int;
-    } else if (wstr == L"string") {
+    } else if (name == string_symbol) {
         return BuiltinType::String;
     } else {
         report_invalid_type();
     }
 }
 
-std::unique_ptr<Program> Parser::parse_Program()
+std::unique_ptr<Program> Parser::parse_Program(std::size_t threads)
 {
-    std::list<std::unique_ptr<VariableDecl> > global_vars;
-    std::list<std::unique_ptr<FunctionDecl> > functions;
-    std::list<std::unique_ptr<ExternFunctionDecl> > externs;
-
-    auto function = parse_FunctionDecl();
-    auto variable = parse_VariableDecl();
-    auto extern_func = parse_ExternFunctionDecl();
+    Declarations declarations;
 
-    while (function || variable || extern_func) {
-        if (function) {
-            functions.push_back(std::move(function));
+    try {
+        if (!sink && !batches) {
+            parse_concurrently(declarations, threads);
         }
-        if (variable) {
-            global_vars.push_back(std::move(variable));
+        while (parse_Declaration(declarations)) {
         }
-        if (extern_func) {
-            externs.push_back(std::move(extern_func));
+
+        expect(L"Expected function `fn` declaration or variable `let` definition token", TokenType::END_OF_FILE);
+    } catch (...) {
+        if (sink) {
+            sink->cancel();
         }
-        function = parse_FunctionDecl();
-        variable = parse_VariableDecl();
-        extern_func = parse_ExternFunctionDecl();
+        nodes = std::make_unique<Arena>();
+        throw;
     }
 
+    auto program = make_program(declarations);
+    program->nodes = take_nodes();
+    return program;
+}
+
+std::unique_ptr<Program> Parser::parse_part()
+{
+    Declarations declarations;
+    operands.clear();
+    operators.clear();
+    while (parse_Declaration(declarations)) {
+    }
     expect(L"Expected function `fn` declaration or variable `let` definition token", TokenType::END_OF_FILE);
+    return make_program(declarations);
+}
+
+std::unique_ptr<Arena> Parser::take_nodes() noexcept
+{
+    auto taken = std::move(nodes);
+    nodes = std::make_unique<Arena>();
+    return taken;
+}
+
+// The program does not own the arena holding its nodes yet.
+std::unique_ptr<Program> Parser::make_program(const Declarations &declarations)
+{
+    auto globals_span = nodes->copy(declarations.global_vars);
+    auto functions_span = nodes->copy(declarations.functions);
+    auto externs_span = nodes->copy(declarations.externs);
+    return std::make_unique<Program>(nullptr, globals_span, functions_span, externs_span);
+}
 
-    return make<Program>(std::move(global_vars), std::move(functions), std::move(externs));
+bool Parser::parse_Declaration(Declarations &declarations)
+{
+    // Errors point into the declaration being parsed, so a lexer reading ahead has to keep its text.
+    if (batches) {
+        lexer->retain_from(token.position);
+    }
+    if (auto function = parse_FunctionDecl()) {
+        declarations.functions.push_back(function);
+        if (sink) {
+            sink->declare(*function);
+        }
+    } else if (auto variable = parse_VariableDecl()) {
+        declarations.global_vars.push_back(variable);
+        if (sink) {
+            sink->declare(*variable);
+        }
+    } else if (auto extern_func = parse_ExternFunctionDecl()) {
+        declarations.externs.push_back(extern_func);
+        if (sink) {
+            sink->declare(*extern_func);
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Parser::Declarations::append(Declarations &other)
+{
+    for (auto *decl : other.global_vars) {
+        global_vars.push_back(decl);
+    }
+    for (auto *decl : other.functions) {
+        functions.push_back(decl);
+    }
+    for (auto *decl : other.externs) {
+        externs.push_back(decl);
+    }
 }
 
-std::unique_ptr<ExternFunctionDecl> Parser::parse_ExternFunctionDecl()
+// Worker threads parse the slices after the first one while this parser takes the first. A slice is only kept if the
+// declarations before it ended exactly where it starts and it parsed cleanly up to where the next one starts; from the
+// first slice that did not, the rest is parsed serially, so the program and any error are those of a serial parse.
+void Parser::parse_concurrently(Declarations &declarations, std::size_t threads)
+{
+    constexpr std::size_t min_slice_tokens = 1 << 16;
+
+    threads = std::min(threads, (tokens.size() - cursor) / min_slice_tokens);
+    if (threads < 2) {
+        return;
+    }
+    const auto bounds = split_declarations(threads);
+    if (bounds.size() < 3) {
+        return;
+    }
+
+    struct Slice {
+        Parser parser;
+        Declarations declarations;
+        bool complete = false;
+    };
+    std::vector<Slice> slices(bounds.size() - 1);
+    std::vector<std::thread> workers;
+    auto &names = Interner::current();
+    for (std::size_t i = 1; i < slices.size(); ++i) {
+        workers.emplace_back([this, &slices, &bounds, &names, i]() {
+            Interner::Scope scope(names);
+            auto &slice = slices[i];
+            slice.complete = slice.parser.parse_slice(*this, bounds[i], bounds[i + 1], slice.declarations);
+        });
+    }
+
+    try {
+        while (cursor < bounds[1] && parse_Declaration(declarations)) {
+        }
+    } catch (...) {
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        throw;
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (std::size_t i = 1; i < slices.size() && cursor == bounds[i] && slices[i].complete; ++i) {
+        declarations.append(slices[i].declarations);
+        nodes->adopt(*slices[i].parser.nodes);
+        cursor = bounds[i + 1];
+        token = tokens[cursor];
+    }
+}
+
+// Runs on a worker thread. Errors are dropped here; the serial parse reaches them again and reports them.
+bool Parser::parse_slice(const Parser &parent, std::size_t begin, std::size_t end, Declarations &declarations) noexcept
+{
+    sources = parent.sources;
+    stream = parent.stream;
+    depth_limit = parent.depth_limit;
+    cursor = begin;
+    token = (*stream)[cursor];
+    try {
+        while (cursor < end && parse_Declaration(declarations)) {
+        }
+    } catch (...) {
+        return false;
+    }
+    return cursor == end;
+}
+
+// Returns the cursor, the indices of `parts - 1` tokens starting top-level declarations at roughly even intervals and
+// the index of END_OF_FILE. Declarations are told apart by the keywords that begin them outside of any braces; string
+// literals and comments are already folded into single tokens, so braces inside them are not counted.
+std::vector<std::size_t> Parser::split_declarations(std::size_t parts) const
+{
+    const std::size_t last = tokens.size() - 1;
+    std::vector<std::size_t> bounds{ cursor };
+    std::size_t depth = 0;
+    for (std::size_t i = cursor; i < last && bounds.size() < parts; ++i) {
+        switch (tokens.type(i)) {
+        case TokenType::LS_PAREN:
+            ++depth;
+            break;
+        case TokenType::RS_PAREN:
+            depth -= depth > 0;
+            break;
+        case TokenType::KW_FN:
+        case TokenType::KW_LET:
+        case TokenType::KW_EXTERN:
+            if (!depth && i >= cursor + (last - cursor) * bounds.size() / parts) {
+                bounds.push_back(i);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    bounds.push_back(last);
+    return bounds;
+}
+
+ExternFunctionDecl *Parser::parse_ExternFunctionDecl()
 {
     if (!is_one_of(token, TokenType::KW_EXTERN)) {
         return nullptr;
@@ -76,7 +443,7 @@ std::unique_ptr<ExternFunctionDecl> Parser::parse_ExternFunctionDecl()
 
     eat(L"Expected `fn` keyword", TokenType::KW_FN);
     expect(L"Expected function name", TokenType::IDENTIFIER);
-    std::wstring name = *get_string(token);
+    Symbol name = *get_symbol(token);
     advance();
 
     eat(L"Expected openning paren `(`", TokenType::L_PAREN);
@@ -87,10 +454,10 @@ std::unique_ptr<ExternFunctionDecl> Parser::parse_ExternFunctionDecl()
     auto type = parse_Type();
     eat(L"Expected `;` after extern function declaration", TokenType::SEMICOLON);
 
-    return make<ExternFunctionDecl>(position, std::move(name), type, std::move(parameters));
+    return make<ExternFunctionDecl>(position, name, type, parameters);
 }
 
-std::unique_ptr<FunctionDecl> Parser::parse_FunctionDecl()
+FunctionDecl *Parser::parse_FunctionDecl()
 {
     if (!is_one_of(token, TokenType::KW_FN)) {
         return nullptr;
@@ -99,7 +466,7 @@ std::unique_ptr<FunctionDecl> Parser::parse_FunctionDecl()
     advance();
 
     expect(L"Expected function name", TokenType::IDENTIFIER);
-    std::wstring name = *get_string(token);
+    Symbol name = *get_symbol(token);
     advance();
 
     eat(L"Expected openning paren `(`", TokenType::L_PAREN);
@@ -110,17 +477,17 @@ std::unique_ptr<FunctionDecl> Parser::parse_FunctionDecl()
     auto type = parse_Type();
     auto block = parse_Block();
 
-    return make<FunctionDecl>(position, std::move(name), type, std::move(parameters), std::move(block));
+    return make<FunctionDecl>(position, name, type, parameters, block);
 }
 
-std::unique_ptr<VariableDecl> Parser::parse_VariableDecl()
+VariableDecl *Parser::parse_VariableDecl()
 {
     if (!is_one_of(token, TokenType::KW_LET)) {
         return nullptr;
     }
     advance();
 
-    VariableDecl::VarDeclList list;
+    SmallVector<VariableDecl::SingleVarDecl> list;
 
     list.push_back(parse_SingleVarDecl());
 
@@ -136,7 +503,7 @@ std::unique_ptr<VariableDecl> Parser::parse_VariableDecl()
     for (auto &i : list) {
         i.type = type;
     }
-    return make<VariableDecl>(std::move(list));
+    return make<VariableDecl>(nodes->copy(list));
 }
 
 VariableDecl::SingleVarDecl Parser::parse_SingleVarDecl()
@@ -144,7 +511,7 @@ VariableDecl::SingleVarDecl Parser::parse_SingleVarDecl()
     VariableDecl::SingleVarDecl var;
 
     expect(L"Expected variable name", TokenType::IDENTIFIER);
-    var.name = *get_string(token);
+    var.name = *get_symbol(token);
     var.pos = token.position;
     advance();
 
@@ -154,7 +521,7 @@ VariableDecl::SingleVarDecl Parser::parse_SingleVarDecl()
         if (!value) {
             report_expected_expression();
         }
-        var.initial_value = std::move(value);
+        var.initial_value = value;
     }
 
     return var;
@@ -163,16 +530,16 @@ VariableDecl::SingleVarDecl Parser::parse_SingleVarDecl()
 BuiltinType Parser::parse_Type()
 {
     expect(L"Expected type name", TokenType::IDENTIFIER);
-    std::wstring name = *get_string(token);
+    const Symbol name = *get_symbol(token);
 
-    if (name == L"int") {
+    if (name == int_symbol) {
         advance();
         if (is_one_of(token, TokenType::STAR)) {
             advance();
             return BuiltinType::IntPointer;
         }
         return BuiltinType::Int;
-    } else if (name == L"string") {
+    } else if (name == string_symbol) {
         advance();
         return BuiltinType::String;
     } else {
@@ -180,26 +547,26 @@ BuiltinType Parser::parse_Type()
     }
 }
 
-std::list<FunctionDecl::Parameter> Parser::parse_ParameterList()
+Span<FunctionDecl::Parameter> Parser::parse_ParameterList()
 {
-    std::list<FunctionDecl::Parameter> list;
+    SmallVector<FunctionDecl::Parameter> list;
     auto param = parse_SingleParameter();
     if (!param) {
         return {};
     } else {
-        list.push_back(std::move(*param));
+        list.push_back(*param);
     }
 
     while (is_one_of(token, TokenType::COMMA)) {
         advance();
         param = parse_SingleParameter();
         if (param) {
-            list.push_back(std::move(*param));
+            list.push_back(*param);
         } else {
             report_expected_parameter();
         }
     }
-    return list;
+    return nodes->copy(list);
 }
 
 std::optional<FunctionDecl::Parameter> Parser::parse_SingleParameter()
@@ -207,162 +574,143 @@ std::optional<FunctionDecl::Parameter> Parser::parse_SingleParameter()
     if (!is_one_of(token, TokenType::IDENTIFIER)) {
         return {};
     }
-    std::wstring name = *get_string(token);
+    Symbol name = *get_symbol(token);
     const Position pos = token.position;
     advance();
     eat(L"Expected type declaration token `:`", TokenType::COLON);
     auto type = parse_Type();
-    return FunctionDecl::Parameter{ std::move(name), type, pos };
+    return FunctionDecl::Parameter{ name, type, pos };
 }
 
-std::unique_ptr<Block> Parser::parse_Block()
+Block *Parser::parse_Block()
 {
+    NestingGuard nesting{ *this, token.position };
     eat(L"Expected `{` paren", TokenType::LS_PAREN);
-    std::list<std::unique_ptr<Statement> > list;
+    SmallVector<Statement *> list;
     auto statement = parse_Statement();
     while (statement) {
-        list.push_back(std::move(statement));
+        list.push_back(statement);
         statement = parse_Statement();
     }
     eat(L"Expected `}` paren", TokenType::RS_PAREN);
-    return make<Block>(std::move(std::move(list)));
+    return make<Block>(nodes->copy(list));
 }
 
-std::unique_ptr<Expression> Parser::parse_ConditionalExpression()
+Expression *Parser::parse_ConditionalExpression()
 {
-    auto node = parse_UnaryLogicalExpr();
-    if (!node) {
-        return nullptr;
-    }
-    while (is_boolean_binary_op(token)) {
-        auto op = BinOp_from_token(token);
-        auto position = token.position;
-        advance();
-        auto rhs = parse_UnaryLogicalExpr();
-        if (!rhs) {
-            return nullptr;
-        }
-        node = make<BinaryExpression>(position, op, std::move(node), std::move(rhs));
-    }
-    return node;
+    return parse_BinaryExpression(Precedence::Conditional);
 }
 
-std::unique_ptr<Expression> Parser::parse_UnaryLogicalExpr()
+Expression *Parser::parse_ArithmeticalExpr()
 {
-    if (is_one_of(token, TokenType::BOOLEAN_NEG)) {
-        auto position = token.position;
-        advance();
-        auto lhs = parse_LogicalExpr();
-        if (!lhs) {
-            return nullptr;
-        }
-        return make<UnaryExpression>(position, UnaryOperator::BooleanNeg, std::move(lhs));
-    } else {
-        return parse_LogicalExpr();
-    }
+    return parse_BinaryExpression(Precedence::Bitwise);
 }
 
-std::unique_ptr<Expression> Parser::parse_LogicalExpr()
+// Precedence climbing over the explicit stacks `operands` and `operators`, so that neither long operator chains nor
+// deeply nested parentheses and prefix operators recurse. Open parentheses still count as nesting against the depth
+// limit, operators do not. Operands of a binary operator take only stronger operators, which keeps every level left
+// associative. `!` negates a whole comparison and may only start an operand of `&&` and `||`. Indices bind tighter
+// than prefix operators.
+Expression *Parser::parse_BinaryExpression(int min_precedence)
 {
-    auto node = parse_ArithmeticalExpr();
-    if (!node) {
-        return nullptr;
-    }
-    while (is_compare_op(token)) {
-        auto op = BinOp_from_token(token);
-        auto position = token.position;
-        advance();
-        auto rhs = parse_ArithmeticalExpr();
-        if (!rhs) {
-            return nullptr;
+    const auto operand_base = operands.size();
+    const auto operator_base = operators.size();
+    // The parentheses opened here and not closed yet, released from `depth` however the expression ends.
+    struct OpenParens {
+        std::size_t &depth;
+        std::size_t count = 0;
+        ~OpenParens()
+        {
+            depth -= count;
         }
-        node = make<BinaryExpression>(position, op, std::move(node), std::move(rhs));
-    }
-    return node;
-}
-
-std::unique_ptr<Expression> Parser::parse_ArithmeticalExpr()
-{
-    auto node = parse_AdditiveExpr();
-    if (!node) {
-        return nullptr;
-    }
-    while (is_bitwise_op(token)) {
-        auto op = BinOp_from_token(token);
-        auto position = token.position;
-        advance();
-        auto rhs = parse_AdditiveExpr();
-        if (!rhs) {
-            return nullptr;
+    } open_parens{ depth };
+    auto weakest_allowed = [&] {
+        if (operators.size() == operator_base) {
+            return min_precedence;
         }
-        node = make<BinaryExpression>(position, op, std::move(node), std::move(rhs));
-    }
-    return node;
-}
-
-std::unique_ptr<Expression> Parser::parse_AdditiveExpr()
-{
-    auto node = parse_MultiplicativeExpr();
-    if (!node) {
-        return nullptr;
-    }
-    while (is_additive_op(token)) {
-        auto op = BinOp_from_token(token);
-        auto position = token.position;
-        advance();
-        auto rhs = parse_MultiplicativeExpr();
-        if (!rhs) {
-            return nullptr;
+        const auto &pending = operators.back();
+        return pending.kind == PendingOperator::Binary ? pending.precedence + 1 : pending.precedence;
+    };
+
+    for (;;) {
+        if (weakest_allowed() <= Precedence::UnaryLogical && is_one_of(token, TokenType::BOOLEAN_NEG)) {
+            operators.push_back({ PendingOperator::Negation, Precedence::Comparison, {}, UnaryOperator::BooleanNeg,
+                                  token.position });
+            advance();
+        }
+        while (is_unary_op(token)) {
+            operators.push_back({ PendingOperator::Prefix, Precedence::None, {}, UnOp_from_token(token), token.position });
+            advance();
+        }
+        if (is_one_of(token, TokenType::L_PAREN)) {
+            if (depth + 1 > depth_limit) {
+                report_nested_too_deeply(token.position);
+            }
+            ++depth;
+            ++open_parens.count;
+            operators.push_back({ PendingOperator::Paren, Precedence::Conditional, {}, {}, token.position });
+            advance();
+            continue;
         }
-        node = make<BinaryExpression>(position, op, std::move(node), std::move(rhs));
-    }
-    return node;
-}
 
-std::unique_ptr<Expression> Parser::parse_MultiplicativeExpr()
-{
-    auto node = parse_UnaryExpression();
-    if (!node) {
-        return nullptr;
-    }
-    while (is_multiplicative_op(token)) {
-        auto op = BinOp_from_token(token);
-        auto position = token.position;
-        advance();
-        auto rhs = parse_UnaryExpression();
-        if (!rhs) {
+        Expression *lhs = parse_Factor();
+        if (!lhs) {
+            // Every open paren still has to be closed, as if the expression inside it had ended here.
+            for (auto it = operators.end(); it != operators.begin() + operator_base;) {
+                if ((--it)->kind == PendingOperator::Paren) {
+                    eat(L"Expected closing paren `)` at the end of expression", TokenType::R_PAREN);
+                }
+            }
+            operands.resize(operand_base);
+            operators.resize(operator_base);
             return nullptr;
         }
-        node = make<BinaryExpression>(position, op, std::move(node), std::move(rhs));
-    }
-    return node;
-}
 
-std::unique_ptr<Expression> Parser::parse_UnaryExpression()
-{
-    std::stack<std::pair<UnaryOperator, Position> > operators;
-    while (is_unary_op(token)) {
-        operators.push(std::make_pair(UnOp_from_token(token), token.position));
-        advance();
-    }
-    auto lhs = parse_Factor();
-    auto index_position = token.position;
-    auto index = parse_IndexExpression();
-    if (index) {
-        lhs = make<IndexExpression>(index_position, std::move(lhs), std::move(index));
-    }
-    if (!lhs) {
-        return nullptr;
-    }
-    while (!operators.empty()) {
-        auto [op, position] = operators.top();
-        operators.pop();
-        lhs = make<UnaryExpression>(position, op, std::move(lhs));
+        // `lhs` is complete up to the operators still pending; apply those that bind tighter than the next token.
+        for (;;) {
+            auto index_position = token.position;
+            auto index = parse_IndexExpression();
+            if (index) {
+                lhs = make<IndexExpression>(index_position, lhs, index);
+            }
+            while (operators.size() > operator_base && operators.back().kind == PendingOperator::Prefix) {
+                lhs = make<UnaryExpression>(operators.back().position, operators.back().unary_op, lhs);
+                operators.pop_back();
+            }
+
+            const auto entry = binary_operator(token.type);
+            while (operators.size() > operator_base) {
+                const auto &pending = operators.back();
+                if (pending.kind == PendingOperator::Binary && pending.precedence >= entry.precedence) {
+                    lhs = make<BinaryExpression>(pending.position, pending.binary_op, operands.back(), lhs);
+                    operands.pop_back();
+                } else if (pending.kind == PendingOperator::Negation && entry.precedence < Precedence::Comparison) {
+                    lhs = make<UnaryExpression>(pending.position, UnaryOperator::BooleanNeg, lhs);
+                } else {
+                    break;
+                }
+                operators.pop_back();
+            }
+
+            if (entry.precedence != Precedence::None && entry.precedence >= weakest_allowed()) {
+                operands.push_back(lhs);
+                operators.push_back({ PendingOperator::Binary, entry.precedence, entry.op, {}, token.position });
+                advance();
+                break;
+            }
+            if (operators.size() == operator_base) {
+                return lhs;
+            }
+            // Only an open paren is left pending; the nested expression ends here and becomes an operand itself.
+            eat(L"Expected closing paren `)` at the end of expression", TokenType::R_PAREN);
+            operators.pop_back();
+            --depth;
+            --open_parens.count;
+        }
     }
-    return lhs;
 }
 
-std::unique_ptr<Expression> Parser::parse_Factor()
+Expression *Parser::parse_Factor()
 {
     auto int_const = parse_IntConst();
     if (int_const) {
@@ -374,20 +722,10 @@ std::unique_ptr<Expression> Parser::parse_Factor()
         return string_const;
     }
 
-    auto expr = parse_FuncCallOrVariableRef();
-    if (expr) {
-        return expr;
-    }
-
-    auto nested = parse_NestedExpression();
-    if (nested) {
-        return nested;
-    }
-
-    return nullptr;
+    return parse_FuncCallOrVariableRef();
 }
 
-std::unique_ptr<IntConst> Parser::parse_IntConst()
+IntConst *Parser::parse_IntConst()
 {
     if (is_one_of(token, TokenType::INTCONST)) {
         auto value = *get_int(token);
@@ -399,10 +737,10 @@ std::unique_ptr<IntConst> Parser::parse_IntConst()
     }
 }
 
-std::unique_ptr<StringConst> Parser::parse_StringConst()
+StringConst *Parser::parse_StringConst()
 {
     if (is_one_of(token, TokenType::STRINGCONST)) {
-        auto value = *get_string(token);
+        auto value = sources->literal(token);
         auto position = token.position;
         advance();
         return make<StringConst>(position, value);
@@ -411,74 +749,65 @@ std::unique_ptr<StringConst> Parser::parse_StringConst()
     }
 }
 
-std::unique_ptr<Expression> Parser::parse_FuncCallOrVariableRef()
+Expression *Parser::parse_FuncCallOrVariableRef()
 {
     if (!is_one_of(token, TokenType::IDENTIFIER)) {
         return nullptr;
     }
-    std::wstring name = *get_string(token);
+    Symbol name = *get_symbol(token);
     auto position = token.position;
     advance();
     auto func_call = parse_FunctionCall(position, name);
     if (func_call) {
         return func_call;
     } else {
-        return make<VariableRef>(position, std::move(name));
+        return make<VariableRef>(position, name);
     }
 }
 
-std::unique_ptr<Expression> Parser::parse_NestedExpression()
-{
-    if (!is_one_of(token, TokenType::L_PAREN)) {
-        return nullptr;
-    }
-    advance();
-    auto expr = parse_ConditionalExpression();
-    eat(L"Expected closing paren `)` at the end of expression", TokenType::R_PAREN);
-    return expr;
-}
-
-std::unique_ptr<FunctionCall> Parser::parse_FunctionCall(const Position &position, std::wstring name)
+FunctionCall *Parser::parse_FunctionCall(const Position &position, Symbol name)
 {
     if (!is_one_of(token, TokenType::L_PAREN)) {
         return nullptr;
     }
+    NestingGuard nesting{ *this, token.position };
     advance();
     auto arguments = parse_CallArgumentList();
     eat(L"Expected closing paren `)` at the end of argument list", TokenType::R_PAREN);
-    return make<FunctionCall>(position, std::move(name), std::move(arguments));
+    return make<FunctionCall>(position, name, arguments);
 }
 
-std::list<std::unique_ptr<Expression> > Parser::parse_CallArgumentList()
+Span<Expression *> Parser::parse_CallArgumentList()
 {
-    std::list<std::unique_ptr<Expression> > list;
+    SmallVector<Expression *> list;
     auto node = parse_ArithmeticalExpr();
     if (node) {
-        list.push_back(std::move(node));
+        list.push_back(node);
         while (is_one_of(token, TokenType::COMMA)) {
             advance();
             node = parse_ArithmeticalExpr();
             if (!node) {
                 report_expected_expression();
             }
-            list.push_back(std::move(node));
+            list.push_back(node);
         }
     }
-    return list;
+    return nodes->copy(list);
 }
 
-std::unique_ptr<Expression> Parser::parse_IndexExpression()
+Expression *Parser::parse_IndexExpression()
 {
     if (!is_one_of(token, TokenType::LI_PAREN)) {
         return nullptr;
     }
+    NestingGuard nesting{ *this, token.position };
     advance();
     auto index = parse_ArithmeticalExpr();
     eat(L"Expected closing `]` paren to end indexing", TokenType::RI_PAREN);
     return index;
 }
 
-std::unique_ptr<Statement> Parser::parse_Statement()
+Statement *Parser::parse_Statement()
 {
     auto for_stmt = parse_ForStatement();
     if (for_stmt) {
@@ -513,14 +842,14 @@ std::unique_ptr<Statement> Parser::parse_Statement()
     return nullptr;
 }
 
-std::unique_ptr<IfStatement> Parser::parse_IfStatement()
+IfStatement *Parser::parse_IfStatement()
 {
     if (!is_one_of(token, TokenType::KW_IF)) {
         return nullptr;
     }
     advance();
 
-    std::list<std::pair<std::unique_ptr<Expression>, std::unique_ptr<Block> > > blocks;
+    SmallVector<IfStatement::ConditionalBlock> blocks;
     blocks.push_back(parse_ConditionalBlock());
 
     while (is_one_of(token, TokenType::KW_ELIF)) {
@@ -528,44 +857,41 @@ std::unique_ptr<IfStatement> Parser::parse_IfStatement()
         blocks.push_back(parse_ConditionalBlock());
     }
 
-    std::optional<std::unique_ptr<Block> > else_statement;
+    Block *else_statement = nullptr;
     if (is_one_of(token, TokenType::KW_ELSE)) {
         advance();
-        auto block = parse_Block();
-        else_statement = std::move(block);
+        else_statement = parse_Block();
     }
-    return make<IfStatement>(std::move(blocks), std::move(else_statement));
+    return make<IfStatement>(nodes->copy(blocks), else_statement);
 }
 
-std::pair<std::unique_ptr<Expression>, std::unique_ptr<Block> > Parser::parse_ConditionalBlock()
+IfStatement::ConditionalBlock Parser::parse_ConditionalBlock()
 {
     auto condition = parse_ConditionalExpression();
     if (!condition) {
         report_expected_expression();
     }
     auto block = parse_Block();
-    return std::make_pair(std::move(condition), std::move(block));
+    return std::make_pair(condition, block);
 }
 
-std::unique_ptr<ForStatement> Parser::parse_ForStatement()
+ForStatement *Parser::parse_ForStatement()
 {
     if (!is_one_of(token, TokenType::KW_FOR)) {
         return nullptr;
     }
     advance();
     expect(L"Expected loop's variable name", TokenType::IDENTIFIER);
-    std::wstring name = *get_string(token);
+    Symbol name = *get_symbol(token);
     const auto pos = token.position;
     advance();
     eat(L"Expected `in` keyword", TokenType::KW_IN);
     auto [start, end, increase] = parse_Range();
     auto block = parse_Block();
-    return make<ForStatement>(std::move(name), pos, std::move(start), std::move(end), std::move(increase),
-                              std::move(block));
+    return make<ForStatement>(name, pos, start, end, increase, block);
 }
 
-std::tuple<std::unique_ptr<Expression>, std::unique_ptr<Expression>, std::optional<std::unique_ptr<Expression> > >
-Parser::parse_Range()
+std::tuple<Expression *, Expression *, Expression *> Parser::parse_Range()
 {
     auto start = parse_ArithmeticalExpr();
     if (!start) {
@@ -576,40 +902,42 @@ Parser::parse_Range()
     if (!end) {
         report_expected_expression();
     }
-    std::optional<std::unique_ptr<Expression> > increase;
+    Expression *increase = nullptr;
     if (is_one_of(token, TokenType::RANGE_SEP)) {
         advance();
-        auto inc = parse_ArithmeticalExpr();
-        if (!inc) {
+        increase = parse_ArithmeticalExpr();
+        if (!increase) {
             report_expected_expression();
         }
-        increase = std::move(inc);
     }
-    return std::make_tuple(std::move(start), std::move(end), std::move(increase));
+    return std::make_tuple(start, end, increase);
 }
 
-std::unique_ptr<WhileStatement> Parser::parse_WhileStatement()
+WhileStatement *Parser::parse_WhileStatement()
 {
     if (!is_one_of(token, TokenType::KW_WHILE)) {
         return nullptr;
     }
     advance();
     auto [expr, block] = parse_ConditionalBlock();
-    return make<WhileStatement>(std::move(expr), std::move(block));
+    return make<WhileStatement>(expr, block);
 }
 
-std::unique_ptr<ReturnStatement> Parser::parse_ReturnSatetemnt()
+ReturnStatement *Parser::parse_ReturnSatetemnt()
 {
     if (!is_one_of(token, TokenType::KW_RETURN)) {
         return nullptr;
     }
     advance();
     auto expr = parse_ArithmeticalExpr();
+    if (!expr) {
+        report_expected_expression();
+    }
     eat(L"Expected semicolon `;` et the end of return statement", TokenType::SEMICOLON);
-    return make<ReturnStatement>(std::move(expr));
+    return make<ReturnStatement>(expr);
 }
 
-std::unique_ptr<Statement> Parser::parse_AssignStatement()
+Statement *Parser::parse_AssignStatement()
 {
     auto expr = parse_ConditionalExpression();
     if (!expr) {
@@ -617,52 +945,63 @@ std::unique_ptr<Statement> Parser::parse_AssignStatement()
     }
     if (is_one_of(token, TokenType::SEMICOLON)) {
         advance();
-        return make<ExpressionStatement>(std::move(expr));
+        return make<ExpressionStatement>(expr);
     }
-    std::list<std::unique_ptr<Expression> > parts;
-    parts.push_back(std::move(expr));
+    SmallVector<Expression *> parts;
+    parts.push_back(expr);
     while (is_one_of(token, TokenType::ASSIGN)) {
         advance();
         expr = parse_ConditionalExpression();
         if (!expr) {
             report_expected_expression();
         }
-        parts.push_back(std::move(expr));
+        parts.push_back(expr);
     }
     eat(L"Expected semicolon `;` at the end of assignment expression", TokenType::SEMICOLON);
-    return make<AssignmentStatement>(std::move(parts));
+    return make<AssignmentStatement>(nodes->copy(parts));
+}
+
+std::wstring Parser::snippet(const Position &position)
+{
+    // Workers of parse_concurrently() have no lexer and drop their errors, so they do not decode positions either.
+    if (!lexer) {
+        return {};
+    }
+    stop_lexing();
+    return sources->snippet(position);
 }
 
 void Parser::report_unexpected_token(const std::wstring &msg)
 {
     const auto position = token.position;
-    throw ParserException{ concat(position_in_file(position), L"\n In \n",
-                                  lexer->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                  error_marker(position), L"\n", L"\nError unexpected token\n", msg,
-                                  L"\n Got `\033[31;1;4m", repr(token.type), L"\033[0m`\n") };
+    throw ParserException{ concat(snippet(position), L"\n", L"\nError unexpected token\n",
+                                  msg, L"\n Got `\033[31;1;4m", repr(token.type), L"\033[0m`\n"),
+                           concat(msg, L", got `", repr(token.type), L"`"), position };
 }
 
 void Parser::report_expected_expression()
 {
     const auto position = token.position;
-    throw ParserException{ concat(position_in_file(position), L"\n In \n",
-                                  lexer->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                  error_marker(position), L"\n", L"\nExpected expression but got ", repr(token.type)) };
+    const auto error = concat(L"Expected expression but got ", repr(token.type));
+    throw ParserException{ concat(snippet(position), L"\n", L"\n", error), error, position };
 }
 
-void Parser::report_invalid_type() const
+void Parser::report_invalid_type()
 {
     const auto position = token.position;
-    throw ParserException{ concat(
-        position_in_file(position), L"\n In \n", lexer->get_lines(position.line_number, position.line_number + 1),
-        L"\n", error_marker(position), L"\n", L"Invalid type you can only use int, int* or string\n") };
+    const std::wstring error = L"Invalid type you can only use int, int* or string";
+    throw ParserException{ concat(snippet(position), L"\n", error, L"\n"), error, position };
 }
 
 void Parser::report_expected_parameter()
 {
     const auto position = token.position;
-    throw ParserException{ concat(position_in_file(position), L"\n In \n",
-                                  lexer->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                  error_marker(position), L"\n",
-                                  L"Expected parameter declaration starting with name but got", repr(token.type)) };
+    const auto error = concat(L"Expected parameter declaration starting with name but got", repr(token.type));
+    throw ParserException{ concat(snippet(position), L"\n", error), error, position };
+}
+
+void Parser::report_nested_too_deeply(const Position &position)
+{
+    const auto error = concat(L"Program is nested too deeply, the limit is ", std::to_wstring(depth_limit), L" levels");
+    throw ParserException{ concat(snippet(position), L"\n", error), error, position };
 }
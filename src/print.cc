@@ -8,7 +8,7 @@ PrintVisitor::PrintVisitor(std::size_t ident) : ident(ident), str(L"")
 void PrintVisitor::visit(const UnaryExpression &target)
 {
     PrintVisitor visitor{ ident + 1 };
-    target.rhs->accept(visitor);
+    visitor.dispatch(*target.rhs);
     str = concat(make_identation(ident), repr(target.op), L" : {\n", visitor.result(), L"\n", make_identation(ident),
                  L"}");
 }
@@ -16,8 +16,8 @@ void PrintVisitor::visit(const UnaryExpression &target)
 void PrintVisitor::visit(const BinaryExpression &target)
 {
     PrintVisitor lhs{ ident + 1 }, rhs{ ident + 1 };
-    target.rhs->accept(rhs);
-    target.lhs->accept(lhs);
+    rhs.dispatch(*target.rhs);
+    lhs.dispatch(*target.lhs);
     str = concat(make_identation(ident), repr(target.op), L" : {\n", lhs.result(), L"\n", rhs.result(), L"\n",
                  make_identation(ident), L"}");
 }
@@ -26,8 +26,8 @@ void PrintVisitor::visit(const IndexExpression &target)
 {
     PrintVisitor ptr{ ident + 1 };
     PrintVisitor index{ ident + 1 };
-    target.ptr->accept(ptr);
-    target.index->accept(index);
+    ptr.dispatch(*target.ptr);
+    index.dispatch(*target.index);
     str = concat(make_identation(ident), L"Index : {\n", ptr.result(), L"\n", index.result(), L"\n",
                  make_identation(ident), L"}");
 }
@@ -42,7 +42,7 @@ void PrintVisitor::visit(const FunctionCall &target)
     str = concat(make_identation(ident), L"FunctionCall name = `", target.func_name, L"`; args = {\n");
     for (const auto &i : target.arguments) {
         PrintVisitor visitor{ ident + 1 };
-        i->accept(visitor);
+        visitor.dispatch(*i);
         str += visitor.result() + L"\n";
     }
     str += make_identation(ident) + L"}";
@@ -62,7 +62,7 @@ void PrintVisitor::visit(const Block &target)
 {
     for (const auto &i : target.statements) {
         PrintVisitor visitor{ ident + 1 };
-        i->accept(visitor);
+        visitor.dispatch(*i);
         str += concat(visitor.result(), L",\n");
     }
 }
@@ -77,7 +77,7 @@ void PrintVisitor::visit(const FunctionDecl &target)
     str += make_identation(ident + 1) + L"}\n";
     str += make_identation(ident + 1) + L"with body = {\n";
     PrintVisitor visitor{ ident + 2 };
-    target.block->accept(visitor);
+    visitor.dispatch(*target.block);
     str += visitor.result();
     str += concat(make_identation(ident + 1), L"}\n", make_identation(ident), L"]");
 }
@@ -88,7 +88,7 @@ void PrintVisitor::visit(const VariableDecl &target)
         str += concat(make_identation(ident), L"[ make var `", i.name, L"` of type `", repr(i.type), L"`");
         if (i.initial_value) {
             PrintVisitor visitor{ ident + 1 };
-            (*i.initial_value)->accept(visitor);
+            visitor.dispatch(*i.initial_value);
             str += concat(L" = \n", visitor.result());
         }
         str += L"\n" + make_identation(ident) + L"]";
@@ -100,7 +100,7 @@ void PrintVisitor::visit(const AssignmentStatement &target)
     str = concat(make_identation(ident), L"[ Assign parts = {\n");
     for (const auto &i : target.parts) {
         PrintVisitor part{ ident + 2 };
-        i->accept(part);
+        part.dispatch(*i);
         str += concat(part.result(), L"\n");
         str += concat(make_identation(ident + 1), L"}, next = {\n");
     }
@@ -110,14 +110,14 @@ void PrintVisitor::visit(const AssignmentStatement &target)
 void PrintVisitor::visit(const ReturnStatement &target)
 {
     PrintVisitor visitor{ ident + 1 };
-    target.expr->accept(visitor);
+    visitor.dispatch(*target.expr);
     str = concat(make_identation(ident), L"Return : {\n", visitor.result(), L"\n", make_identation(ident), L"}");
 }
 
 void PrintVisitor::visit(const ExpressionStatement &target)
 {
     PrintVisitor visitor{ ident + 1 };
-    target.expr->accept(visitor);
+    visitor.dispatch(*target.expr);
     str = concat(visitor.result());
 }
 
@@ -127,8 +127,8 @@ void PrintVisitor::visit(const IfStatement &target)
     for (const auto &i : target.blocks) {
         PrintVisitor cond{ ident + 2 };
         PrintVisitor block{ ident + 2 };
-        i.first->accept(cond);
-        i.second->accept(block);
+        cond.dispatch(*i.first);
+        block.dispatch(*i.second);
         str += concat(make_identation(ident + 1), L"[ condition = {\n", cond.result(), L"\n",
                       make_identation(ident + 1), L"}\n");
         str += concat(make_identation(ident + 1), L"  block = {\n", block.result(), L"\n", make_identation(ident + 1),
@@ -137,7 +137,7 @@ void PrintVisitor::visit(const IfStatement &target)
 
     if (target.else_statement) {
         PrintVisitor else_stmt{ ident + 2 };
-        (*target.else_statement)->accept(else_stmt);
+        else_stmt.dispatch(*target.else_statement);
         str += concat(make_identation(ident + 1), L"[ else block = {\n", else_stmt.result(), L"\n",
                       make_identation(ident + 1), L"],\n");
     }
@@ -150,21 +150,21 @@ void PrintVisitor::visit(const ForStatement &target)
     str = concat(make_identation(ident), L"[ for loop variable name = `", target.loop_variable, L"`\n");
     PrintVisitor start{ ident + 2 };
     PrintVisitor end{ ident + 2 };
-    target.start->accept(start);
-    target.end->accept(end);
+    start.dispatch(*target.start);
+    end.dispatch(*target.end);
     str +=
         concat(make_identation(ident + 1), L"start = {\n", start.result(), L"\n", make_identation(ident + 1), L"},\n");
     str += concat(make_identation(ident + 1), L"end = {\n", end.result(), L"\n", make_identation(ident + 1), L"},\n");
     if (target.increase) {
         PrintVisitor inc{ ident + 2 };
-        (*target.increase)->accept(inc);
+        inc.dispatch(*target.increase);
         str += concat(make_identation(ident + 1), L"increase = {\n", inc.result(), L"\n", make_identation(ident + 1),
                       L"},\n");
     } else {
         str += concat(make_identation(ident + 1), L"increase = default;\n");
     }
     PrintVisitor block{ ident + 2 };
-    target.block->accept(block);
+    block.dispatch(*target.block);
     str += concat(make_identation(ident + 1), L"with body = {\n", block.result(), L"\n", make_identation(ident + 1),
                   L"},\n");
     str += concat(make_identation(ident), L" end for ]");
@@ -174,8 +174,8 @@ void PrintVisitor::visit(const WhileStatement &target)
 {
     PrintVisitor condition{ ident + 2 };
     PrintVisitor block{ ident + 2 };
-    target.condition->accept(condition);
-    target.block->accept(block);
+    condition.dispatch(*target.condition);
+    block.dispatch(*target.block);
     str = concat(make_identation(ident), L"[ while loop condition = {\n");
     str += concat(condition.result(), L"\n", make_identation(ident + 1), L"},\n");
     str += concat(make_identation(ident + 1), L"with body = {\n");
@@ -198,17 +198,17 @@ void PrintVisitor::visit(const Program &target)
 {
     for (const auto &i : target.externs) {
         PrintVisitor visitor{ ident + 1 };
-        i->accept(visitor);
+        visitor.dispatch(*i);
         str += visitor.result() + L"\n";
     }
     for (const auto &i : target.global_vars) {
         PrintVisitor visitor{ ident + 1 };
-        i->accept(visitor);
+        visitor.dispatch(*i);
         str += visitor.result() + L"\n";
     }
     for (const auto &i : target.functions) {
         PrintVisitor visitor{ ident + 1 };
-        i->accept(visitor);
+        visitor.dispatch(*i);
         str += visitor.result() + L"\n";
     }
 }
@@ -6,10 +6,107 @@
 #define ASSERT_EMPTY_SCOPE assert(scopes.empty())
 #define ASSERT_EMPTY_RET_STACK assert(has_return.empty())
 
-void analyse(const std::unique_ptr<Program> &program, std::unique_ptr<Source> source)
+void analyse(const std::unique_ptr<Program> &program, std::shared_ptr<SourceManager> sources)
 {
-    SemanticAnalyser analyser{ std::move(source) };
-    program->accept(analyser);
+    SemanticAnalyser analyser{ std::move(sources) };
+    analyser.dispatch(*program);
+}
+
+void analyse(const FlatAst &ast, std::shared_ptr<SourceManager> sources)
+{
+    SemanticAnalyser analyser{ std::move(sources) };
+    analyser.analyse(ast);
+}
+
+IncrementalAnalyser::IncrementalAnalyser(std::shared_ptr<SourceManager> sources)
+    : sources(std::move(sources)), names(Interner::current()), analyser(nullptr), declarations(1024),
+      seen_function(false), valid(true)
+{
+    worker = std::thread(&IncrementalAnalyser::run, this);
+}
+
+IncrementalAnalyser::~IncrementalAnalyser()
+{
+    stop();
+}
+
+void IncrementalAnalyser::declare(const ExternFunctionDecl &decl)
+{
+    declarations.push(&decl);
+}
+
+void IncrementalAnalyser::declare(const VariableDecl &decl)
+{
+    declarations.push(&decl);
+}
+
+void IncrementalAnalyser::declare(const FunctionDecl &decl)
+{
+    declarations.push(&decl);
+}
+
+void IncrementalAnalyser::cancel() noexcept
+{
+    stop();
+}
+
+void IncrementalAnalyser::finish(const std::unique_ptr<Program> &program)
+{
+    stop();
+    if (!valid) {
+        analyse(program, sources);
+    }
+}
+
+void IncrementalAnalyser::stop() noexcept
+{
+    if (worker.joinable()) {
+        declarations.push(std::monostate{});
+        worker.join();
+    }
+}
+
+void IncrementalAnalyser::run()
+{
+    Interner::Scope scope(names);
+    analyser.enter();
+    for (auto declaration = declarations.pop(); declaration.index(); declaration = declarations.pop()) {
+        if (!valid) {
+            continue;
+        }
+        try {
+            std::visit([this](auto decl) { check(decl); }, declaration);
+        } catch (...) {
+            valid = false;
+        }
+    }
+}
+
+void IncrementalAnalyser::check(std::monostate)
+{
+}
+
+void IncrementalAnalyser::check(const ExternFunctionDecl *decl)
+{
+    valid = !seen_function;
+    if (valid) {
+        analyser.dispatch(*decl);
+    }
+}
+
+void IncrementalAnalyser::check(const VariableDecl *decl)
+{
+    valid = !seen_function;
+    if (valid) {
+        analyser.dispatch(*decl);
+        analyser.ignore_return(1);
+    }
+}
+
+void IncrementalAnalyser::check(const FunctionDecl *decl)
+{
+    seen_function = true;
+    analyser.dispatch(*decl);
 }
 
 void SemanticAnalyser::yield(SemanticAnalyser::ExprType type, const Position &pos)
@@ -43,51 +140,101 @@ bool SemanticAnalyser::is_one_of(ExprType allowed)
     return stack.top().first == allowed;
 }
 
-BuiltinType SemanticAnalyser::get_var(const VariableRef &var) const
+BuiltinType SemanticAnalyser::get_var(Symbol name, const Position &position) const
 {
-    check_id(var.var_name, var.position());
+    check_id(name, position);
     for (auto it = scopes.crbegin(); it != scopes.crend(); ++it) {
-        if (is_in_scope(var.var_name, *it)) {
-            return var_from_scope(var.var_name, *it);
+        if (is_in_scope(name, *it)) {
+            return var_from_scope(name, *it);
         }
     }
-    report_undefined_variable(var.var_name, var.position());
+    report_undefined_variable(name, position);
 }
 
-BuiltinType SemanticAnalyser::var_from_scope(const std::wstring &name,
-                                             const std::unordered_map<std::wstring, BuiltinType> &scope) const
+BuiltinType SemanticAnalyser::var_from_scope(Symbol name, const std::unordered_map<Symbol, BuiltinType> &scope) const
 {
     return scope.at(name);
 }
 
-void SemanticAnalyser::declare_var(const VariableDecl::SingleVarDecl &var)
+void SemanticAnalyser::declare_var(Symbol name, BuiltinType type, const Position &position)
 {
-    check_id(var.name, var.position());
-    if (is_in_scope(var.name, scopes.back())) {
-        report_variable_redeclaration(var.name, var.position());
+    check_id(name, position);
+    if (is_in_scope(name, scopes.back())) {
+        report_variable_redeclaration(name, position);
     }
-    scopes.back().insert(std::make_pair(var.name, var.type));
+    scopes.back().insert(std::make_pair(name, type));
 }
 
-void SemanticAnalyser::check_id(const std::wstring &name, const Position &position) const
+void SemanticAnalyser::check_id(Symbol name, const Position &position) const
 {
     if (reserved_words.find(name) != reserved_words.end()) {
         report_reserved_word(name, position);
     }
 }
 
-bool SemanticAnalyser::is_in_scope(const std::wstring &name,
-                                   const std::unordered_map<std::wstring, BuiltinType> &variables) const
+bool SemanticAnalyser::is_in_scope(Symbol name, const std::unordered_map<Symbol, BuiltinType> &variables) const
 {
     return variables.find(name) != variables.end();
 }
 
 void SemanticAnalyser::visit(const UnaryExpression &expr)
 {
-    analyse(expr.rhs);
-    auto pos = expr.position();
+    analyse_expression(expr);
+}
+
+void SemanticAnalyser::analyse_expression(const Expression &expr)
+{
+    tree_walker.walk(*this, TreeExpressions{}, &expr);
+}
+
+template <NodeKind kind, typename Expressions>
+void SemanticAnalyser::enter_node(const Expressions &expressions, typename Expressions::Node node)
+{
+    if constexpr (kind == NodeKind::FunctionCall) {
+        const auto &func = callee(expressions.name(node), expressions.template child_count<kind>(node),
+                                  expressions.position(node));
+        calls.push_back(Call{ &func, func.parameters.cbegin() });
+    }
+}
+
+template <NodeKind kind, typename Expressions>
+void SemanticAnalyser::child_done(const Expressions &, typename Expressions::Node, std::size_t index)
+{
+    if constexpr (kind == NodeKind::IndexExpression) {
+        if (index == 0) {
+            require_pointer();
+        }
+    } else if constexpr (kind == NodeKind::FunctionCall) {
+        require_assignable_to(calls.back().parameter->second);
+        ++calls.back().parameter;
+    }
+}
+
+template <NodeKind kind, typename Expressions>
+void SemanticAnalyser::leave_node(const Expressions &expressions, typename Expressions::Node node)
+{
+    const auto &position = expressions.position(node);
+    if constexpr (kind == NodeKind::IntConst) {
+        yield(SemanticAnalyser::ExprType::Int, position);
+    } else if constexpr (kind == NodeKind::StringConst) {
+        yield(SemanticAnalyser::ExprType::String, position);
+    } else if constexpr (kind == NodeKind::VariableRef) {
+        yield(from_builtin_type(get_var(expressions.name(node), position)), position);
+    } else if constexpr (kind == NodeKind::FunctionCall) {
+        yield(from_builtin_type_value(calls.back().function->return_type), position);
+        calls.pop_back();
+    } else if constexpr (kind == NodeKind::UnaryExpression) {
+        check_unary(expressions.unary_op(node), position);
+    } else if constexpr (kind == NodeKind::BinaryExpression) {
+        check_binary(expressions.binary_op(node), position);
+    } else if constexpr (kind == NodeKind::IndexExpression) {
+        require_index(position);
+    }
+}
 
-    switch (expr.op) {
+void SemanticAnalyser::check_unary(UnaryOperator op, const Position &pos)
+{
+    switch (op) {
     case UnaryOperator::Minus:
     case UnaryOperator::Neg:
         require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
@@ -111,11 +258,12 @@ void SemanticAnalyser::visit(const UnaryExpression &expr)
 
 void SemanticAnalyser::visit(const BinaryExpression &expr)
 {
-    analyse(expr.lhs);
-    analyse(expr.rhs);
+    analyse_expression(expr);
+}
 
-    const auto &pos = expr.position();
-    switch (expr.op) {
+void SemanticAnalyser::check_binary(BinaryOperator op, const Position &pos)
+{
+    switch (op) {
     case BinaryOperator::Plus:
     case BinaryOperator::Minus:
     case BinaryOperator::Multiply:
@@ -151,28 +299,30 @@ void SemanticAnalyser::visit(const BinaryExpression &expr)
 
 void SemanticAnalyser::visit(const IndexExpression &expr)
 {
-    analyse(expr.ptr);
+    analyse_expression(expr);
+}
+
+void SemanticAnalyser::require_pointer()
+{
     require(SemanticAnalyser::ExprType::IntPointer, SemanticAnalyser::ExprType::IntPointerReference,
             SemanticAnalyser::ExprType::StringReference);
+}
 
-    analyse(expr.index);
+void SemanticAnalyser::require_index(const Position &pos)
+{
     require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
-
-    yield(SemanticAnalyser::ExprType::IntReference, expr.position());
+    yield(SemanticAnalyser::ExprType::IntReference, pos);
 }
 
 void SemanticAnalyser::visit(const VariableRef &var)
 {
-    const auto type = get_var(var);
-    const auto &pos = var.position();
-
-    yield(from_builtin_type(type), pos);
+    analyse_expression(var);
 }
 
-const SemanticAnalyser::Function &SemanticAnalyser::function_from_name(const std::wstring &name, const Position &pos)
+const SemanticAnalyser::Function &SemanticAnalyser::function_from_name(Symbol name, const Position &pos)
 {
     auto it = functions.find(name);
-    if (it != functions.end()) {
+    if (it != functions.end() && it->second.order < declared_functions) {
         return it->second;
     } else {
         report_undefined_function(name, pos);
@@ -181,23 +331,18 @@ const SemanticAnalyser::Function &SemanticAnalyser::function_from_name(const std
 
 void SemanticAnalyser::visit(const FunctionCall &expr)
 {
-    const auto &position = expr.position();
-    check_id(expr.func_name, position);
-    const auto &func = function_from_name(expr.func_name, position);
-
-    std::size_t expected = func.parameters.size();
-    std::size_t got = expr.arguments.size();
-    if (expected != got) {
-        report_argument_number_mismatch(expected, got, expr.position());
-    }
+    analyse_expression(expr);
+}
 
-    auto param_it = func.parameters.cbegin();
-    for (const auto &arg : expr.arguments) {
-        check_assignable_by(param_it->second, arg);
-        std::advance(param_it, 1);
+const SemanticAnalyser::Function &SemanticAnalyser::callee(Symbol name, std::size_t arguments,
+                                                           const Position &position)
+{
+    check_id(name, position);
+    const auto &func = function_from_name(name, position);
+    if (func.parameters.size() != arguments) {
+        report_argument_number_mismatch(func.parameters.size(), arguments, position);
     }
-
-    yield(from_builtin_type_value(func.return_type), expr.position());
+    return func;
 }
 
 SemanticAnalyser::ExprType SemanticAnalyser::from_builtin_type_value(BuiltinType type)
@@ -228,12 +373,12 @@ SemanticAnalyser::ExprType SemanticAnalyser::from_builtin_type(BuiltinType type)
 
 void SemanticAnalyser::visit(const IntConst &expr)
 {
-    yield(SemanticAnalyser::ExprType::Int, expr.position());
+    analyse_expression(expr);
 }
 
 void SemanticAnalyser::visit(const StringConst &expr)
 {
-    yield(SemanticAnalyser::ExprType::String, expr.position());
+    analyse_expression(expr);
 }
 
 void SemanticAnalyser::visit(const Block &block)
@@ -248,37 +393,54 @@ void SemanticAnalyser::visit(const Block &block)
 
 void SemanticAnalyser::visit(const ExternFunctionDecl &func)
 {
-    check_id(func.func_name, func.position());
-    if (functions.find(func.func_name) != functions.end()) {
-        report_function_redeclaration(func.func_name, func.position());
-    }
+    check_function_name(func.func_name, func.position());
 
     enter();
-    for (const auto &param : func.parameters) {
-        if (is_in_scope(param.name, scopes.back())) {
-            report_parameter_redeclaration(param.name, param.position());
-        }
-        scopes.back().insert(std::make_pair(param.name, param.type));
-    }
     Function declaration;
     declaration.return_type = func.return_type;
     for (const auto &param : func.parameters) {
-        declaration.parameters.push_back(std::make_pair(param.name, param.type));
+        declare_parameter(declaration, param.name, param.type, param.position());
     }
-    functions.insert(std::make_pair(func.func_name, declaration)); // To enable recursion
+    declare_function(func.func_name, std::move(declaration)); // To enable recursion
     leave();
 
     ASSERT_EMPTY_RET_STACK;
 }
 
-void SemanticAnalyser::check_main_function(const FunctionDecl &decl)
+void SemanticAnalyser::check_function_name(Symbol name, const Position &position)
+{
+    check_id(name, position);
+    const auto it = functions.find(name);
+    if (it != functions.end() && it->second.order < declared_functions) {
+        report_function_redeclaration(name, position);
+    }
+}
+
+void SemanticAnalyser::declare_function(Symbol name, Function declaration)
 {
-    if (decl.func_name == L"main") {
-        if (decl.parameters.size() != 0) {
-            report_main_bad_params(decl.parameters.front().position());
+    declaration.order = declared_functions++;
+    functions.insert(std::make_pair(name, std::move(declaration)));
+}
+
+void SemanticAnalyser::declare_parameter(Function &function, Symbol name, BuiltinType type, const Position &position)
+{
+    if (is_in_scope(name, scopes.back())) {
+        report_parameter_redeclaration(name, position);
+    }
+    scopes.back().insert(std::make_pair(name, type));
+    function.parameters.push_back(std::make_pair(name, type));
+}
+
+// `first_parameter` is null when the function takes none.
+void SemanticAnalyser::check_main_function(Symbol name, BuiltinType return_type, const Position &position,
+                                           const Position *first_parameter)
+{
+    if (name == main_symbol) {
+        if (first_parameter) {
+            report_main_bad_params(*first_parameter);
         }
-        if (decl.return_type != BuiltinType::Int) {
-            report_main_bad_return_type(decl.position());
+        if (return_type != BuiltinType::Int) {
+            report_main_bad_return_type(position);
         }
     }
 }
@@ -286,24 +448,17 @@ void SemanticAnalyser::check_main_function(const FunctionDecl &decl)
 void SemanticAnalyser::visit(const FunctionDecl &func)
 {
     check_id(func.func_name, func.position());
-    check_main_function(func);
-    if (functions.find(func.func_name) != functions.end()) {
-        report_function_redeclaration(func.func_name, func.position());
-    }
+    check_main_function(func.func_name, func.return_type, func.position(),
+                        func.parameters.empty() ? nullptr : &func.parameters.front().pos);
+    check_function_name(func.func_name, func.position());
 
     enter();
-    for (const auto &param : func.parameters) {
-        if (is_in_scope(param.name, scopes.back())) {
-            report_parameter_redeclaration(param.name, param.position());
-        }
-        scopes.back().insert(std::make_pair(param.name, param.type));
-    }
     Function declaration;
     declaration.return_type = func.return_type;
     for (const auto &param : func.parameters) {
-        declaration.parameters.push_back(std::make_pair(param.name, param.type));
+        declare_parameter(declaration, param.name, param.type, param.position());
     }
-    functions.insert(std::make_pair(func.func_name, declaration)); // To enable recursion
+    declare_function(func.func_name, std::move(declaration)); // To enable recursion
     current_func_ret_type = func.return_type;
     analyse(func.block);
     assert_returns(func.position());
@@ -315,18 +470,16 @@ void SemanticAnalyser::visit(const FunctionDecl &func)
 void SemanticAnalyser::visit(const VariableDecl &stmt)
 {
     for (const auto &var : stmt.var_decls) {
-        declare_var(var);
+        declare_var(var.name, var.type, var.position());
         if (var.initial_value) {
-            check_assignable_by(var.type, *var.initial_value);
+            check_assignable_by(var.type, var.initial_value);
         }
     }
     yield_no_return();
 }
 
-void SemanticAnalyser::check_assignable_by(BuiltinType type, const std::unique_ptr<Expression> &expr)
+void SemanticAnalyser::require_assignable_to(BuiltinType type)
 {
-    analyse(expr);
-
     switch (type) {
     case BuiltinType::Int:
         require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
@@ -340,9 +493,8 @@ void SemanticAnalyser::check_assignable_by(BuiltinType type, const std::unique_p
     }
 }
 
-void SemanticAnalyser::check_assignable_by(const std::unique_ptr<Expression> &expr, SemanticAnalyser::ExprType rhs)
+void SemanticAnalyser::require_assignable_from(SemanticAnalyser::ExprType rhs)
 {
-    analyse(expr);
     switch (rhs) {
     case SemanticAnalyser::ExprType::Int:
     case SemanticAnalyser::ExprType::IntReference:
@@ -402,7 +554,7 @@ void SemanticAnalyser::visit(const IfStatement &stmt)
         analyse(conditional_block.second);
     }
     if (stmt.else_statement) {
-        analyse(*stmt.else_statement);
+        analyse(stmt.else_statement);
         yield_return_all(stmt.blocks.size() + 1);
     } else {
         ignore_return(stmt.blocks.size());
@@ -421,7 +573,7 @@ void SemanticAnalyser::visit(const ForStatement &stmt)
     analyse(stmt.end);
     require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
     if (stmt.increase) {
-        analyse(*stmt.increase);
+        analyse(stmt.increase);
         require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
     }
     check_id(stmt.loop_variable, stmt.loop_variable_pos);
@@ -462,6 +614,179 @@ void SemanticAnalyser::visit(const Program &program)
     ASSERT_EMPTY_SCOPE;
 }
 
+void SemanticAnalyser::analyse(const FlatAst &program)
+{
+    ast = &program;
+    enter();
+    for (const auto decl : program.externs) {
+        analyse(decl);
+    }
+    for (const auto decl : program.global_vars) {
+        analyse(decl);
+    }
+    ignore_return(program.global_vars.size());
+    for (const auto decl : program.functions) {
+        analyse(decl);
+    }
+    leave();
+    ast = nullptr;
+
+    ASSERT_EMPTY_STACK;
+    ASSERT_EMPTY_SCOPE;
+}
+
+void SemanticAnalyser::analyse(NodeIndex node)
+{
+    const auto &position = ast->positions[node];
+    const auto first = ast->first[node];
+    const auto second = ast->second[node];
+
+    switch (ast->kinds[node]) {
+    case NodeKind::IntConst:
+    case NodeKind::StringConst:
+    case NodeKind::VariableRef:
+    case NodeKind::FunctionCall:
+    case NodeKind::UnaryExpression:
+    case NodeKind::BinaryExpression:
+    case NodeKind::IndexExpression:
+        flat_walker.walk(*this, FlatExpressions{ *ast }, node);
+        break;
+    case NodeKind::Block: {
+        const auto statements = ast->list(first);
+        enter();
+        for (const auto stmt : statements) {
+            analyse(stmt);
+        }
+        leave();
+        yield_return_one(statements.size());
+        break;
+    }
+    case NodeKind::VariableDecl:
+        for (const auto var : ast->list(first)) {
+            const auto type = ast->op<BuiltinType>(var);
+            declare_var(ast->symbol(var), type, ast->positions[var]);
+            if (ast->second[var] != no_node) {
+                check_assignable_by(type, ast->second[var]);
+            }
+        }
+        yield_no_return();
+        break;
+    case NodeKind::AssignmentStatement: {
+        const auto parts = ast->list(first);
+        analyse(parts.back());
+        const auto value_type = pop();
+        for (std::size_t i = 0; i < parts.size() - 1; ++i) {
+            check_assignable_by(parts[i], value_type);
+        }
+        yield_no_return();
+        break;
+    }
+    case NodeKind::ReturnStatement:
+        check_assignable_by(current_func_ret_type, first);
+        yield_return();
+        break;
+    case NodeKind::ExpressionStatement:
+        analyse(first);
+        ignore();
+        yield_no_return();
+        break;
+    case NodeKind::IfStatement: {
+        const auto blocks = ast->list(first);
+        for (std::size_t i = 0; i < blocks.size(); i += 2) {
+            analyse(blocks[i]);
+            require(SemanticAnalyser::ExprType::Bool, SemanticAnalyser::ExprType::Int,
+                    SemanticAnalyser::ExprType::IntReference);
+            analyse(blocks[i + 1]);
+        }
+        if (second != no_node) {
+            analyse(second);
+            yield_return_all(blocks.size() / 2 + 1);
+        } else {
+            ignore_return(blocks.size() / 2);
+            yield_no_return();
+        }
+        break;
+    }
+    case NodeKind::ForStatement: {
+        const auto parts = ast->list(second);
+        enter();
+        analyse(parts[0]);
+        require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
+        analyse(parts[1]);
+        require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
+        if (parts[2] != no_node) {
+            analyse(parts[2]);
+            require(SemanticAnalyser::ExprType::Int, SemanticAnalyser::ExprType::IntReference);
+        }
+        check_id(ast->symbol(node), position);
+        scopes.back().insert(std::make_pair(ast->symbol(node), BuiltinType::Int));
+        analyse(parts[3]);
+        leave();
+        break;
+    }
+    case NodeKind::WhileStatement:
+        analyse(first);
+        require(SemanticAnalyser::ExprType::Bool, SemanticAnalyser::ExprType::Int,
+                SemanticAnalyser::ExprType::IntReference);
+        analyse(second);
+        break;
+    case NodeKind::FunctionDecl:
+        analyse_function(node);
+        break;
+    case NodeKind::ExternFunctionDecl: {
+        check_function_name(ast->symbol(node), position);
+        enter();
+        Function declaration;
+        declaration.return_type = ast->op<BuiltinType>(node);
+        for (const auto param : ast->list(second)) {
+            declare_parameter(declaration, ast->symbol(param), ast->op<BuiltinType>(param), ast->positions[param]);
+        }
+        declare_function(ast->symbol(node), std::move(declaration));
+        leave();
+        break;
+    }
+    case NodeKind::Variable:
+    case NodeKind::Parameter:
+        // Checked by the declaration they belong to.
+        break;
+    case NodeKind::Program:
+        // Never flattened: its declarations are the roots of the FlatAst.
+        break;
+    }
+}
+
+void SemanticAnalyser::analyse_function(NodeIndex node)
+{
+    const auto name = ast->symbol(node);
+    const auto return_type = ast->op<BuiltinType>(node);
+    const auto &position = ast->positions[node];
+    const auto parts = ast->list(ast->second[node]);
+
+    check_id(name, position);
+    check_main_function(name, return_type, position, parts.size() > 1 ? &ast->positions[parts[1]] : nullptr);
+    check_function_name(name, position);
+
+    enter();
+    Function declaration;
+    declaration.return_type = return_type;
+    for (std::size_t i = 1; i < parts.size(); ++i) {
+        declare_parameter(declaration, ast->symbol(parts[i]), ast->op<BuiltinType>(parts[i]), ast->positions[parts[i]]);
+    }
+    declare_function(name, std::move(declaration)); // To enable recursion
+    current_func_ret_type = return_type;
+    analyse(parts[0]);
+    assert_returns(position);
+    leave();
+
+    ASSERT_EMPTY_RET_STACK;
+}
+
+// Speculative analysis runs without sources, its errors are never shown.
+std::wstring SemanticAnalyser::snippet(const Position &position) const
+{
+    return sources ? sources->snippet(position) : L"";
+}
+
 std::wstring SemanticAnalyser::repr(SemanticAnalyser::ExprType type)
 {
     switch (type) {
@@ -532,78 +857,61 @@ void SemanticAnalyser::assert_returns(const Position &pos)
     has_return.pop();
 }
 
-void SemanticAnalyser::report_reserved_word(const std::wstring &word, const Position &position) const
+void SemanticAnalyser::report_reserved_word(Symbol word, const Position &position) const
 {
-    throw SemanticException{ concat(position_in_file(position), L"\n In \n",
-                                    source->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                    error_marker(position), L"\n\n", L"Error word `", word,
-                                    L"` is reserved and cannot by used as identifier.") };
+    report_error(position, concat(L"Error word `", word, L"` is reserved and cannot by used as identifier."));
 }
 
-void SemanticAnalyser::report_undefined_variable(const std::wstring &name, const Position &position) const
+void SemanticAnalyser::report_undefined_variable(Symbol name, const Position &position) const
 {
-    throw SemanticException{ concat(
-        position_in_file(position), L"\n In \n", source->get_lines(position.line_number, position.line_number + 1),
-        L"\n", error_marker(position), L"\n\n", L"Error cannot find variable named `", name, L"` in scope.") };
+    report_error(position, concat(L"Error cannot find variable named `", name, L"` in scope."));
 }
 
-void SemanticAnalyser::report_variable_redeclaration(const std::wstring &name, const Position &position) const
+void SemanticAnalyser::report_variable_redeclaration(Symbol name, const Position &position) const
 {
-    throw SemanticException{ concat(
-        position_in_file(position), L"\n In \n", source->get_lines(position.line_number, position.line_number + 1),
-        L"\n", error_marker(position), L"\n\n", L"Error redclaration of variable `", name, L"`.") };
+    report_error(position, concat(L"Error redclaration of variable `", name, L"`."));
 }
 
-void SemanticAnalyser::report_function_redeclaration(const std::wstring &name, const Position &position) const
+void SemanticAnalyser::report_function_redeclaration(Symbol name, const Position &position) const
 {
-    throw SemanticException{ concat(
-        position_in_file(position), L"\n In \n", source->get_lines(position.line_number, position.line_number + 1),
-        L"\n", error_marker(position), L"\n\n", L"Error redclaration of function `", name, L"`.") };
+    report_error(position, concat(L"Error redclaration of function `", name, L"`."));
 }
 
-void SemanticAnalyser::report_parameter_redeclaration(const std::wstring &name, const Position &position) const
+void SemanticAnalyser::report_parameter_redeclaration(Symbol name, const Position &position) const
 {
-    throw SemanticException{ concat(
-        position_in_file(position), L"\n In \n", source->get_lines(position.line_number, position.line_number + 1),
-        L"\n", error_marker(position), L"\n\n", L"Error redclaration of parameter `", name, L"`.") };
+    report_error(position, concat(L"Error redclaration of parameter `", name, L"`."));
 }
 
-void SemanticAnalyser::report_undefined_function(const std::wstring &name, const Position &position) const
+void SemanticAnalyser::report_undefined_function(Symbol name, const Position &position) const
 {
-    throw SemanticException{ concat(
-        position_in_file(position), L"\n In \n", source->get_lines(position.line_number, position.line_number + 1),
-        L"\n", error_marker(position), L"\n\n", L"Error undefiend funtion with name = `", name, L"`.") };
+    report_error(position, concat(L"Error undefiend funtion with name = `", name, L"`."));
 }
 
 void SemanticAnalyser::report_no_return(const Position &position) const
 {
-    throw SemanticException{ concat(position_in_file(position), L"\n In \n",
-                                    source->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                    error_marker(position), L"\n\n", L"Not all paths end with return statement.") };
+    report_error(position, L"Not all paths end with return statement.");
 }
 
 void SemanticAnalyser::report_argument_number_mismatch(std::size_t expected, std::size_t got,
                                                        const Position &position) const
 {
-    throw SemanticException{ concat(position_in_file(position), L"\n In \n",
-                                    source->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                    error_marker(position), L"\n\n", L"Wrong number of arguments, expected `",
-                                    std::to_wstring(expected), L"` but got`", std::to_wstring(got), L"`.") };
+    report_error(position, concat(L"Wrong number of arguments, expected `", std::to_wstring(expected), L"` but got`",
+                                  std::to_wstring(got), L"`."));
 }
 
 void SemanticAnalyser::report_main_bad_params(const Position &position) const
 {
-    throw SemanticException{ concat(position_in_file(position), L"\n In \n",
-                                    source->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                    error_marker(position), L"\n\n",
-                                    L"Main function should take no parameters (for now...) due to author laziness") };
+    report_error(position, L"Main function should take no parameters (for now...) due to author laziness");
 }
 
 void SemanticAnalyser::report_main_bad_return_type(const Position &position) const
 {
-    throw SemanticException{ concat(position_in_file(position), L"\n In \n",
-                                    source->get_lines(position.line_number, position.line_number + 1), L"\n",
-                                    error_marker(position), L"\n\n", L"Main function should return Int") };
+    report_error(position, L"Main function should return Int");
+}
+
+void SemanticAnalyser::report_error(const Position &position, const std::wstring &error) const
+{
+    throw SemanticException{ concat(snippet(position), L"\n\n", error), error, position };
 }
 
-const std::unordered_set<std::wstring> SemanticAnalyser::reserved_words = { L"int", L"string" };
+const std::unordered_set<Symbol> SemanticAnalyser::reserved_words = { int_symbol, string_symbol };
@@ -0,0 +1,245 @@
+#include "server.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <sstream>
+
+namespace pt = boost::property_tree;
+
+namespace {
+
+// JSON-RPC error codes.
+constexpr int parse_error = -32700;
+constexpr int method_not_found = -32601;
+constexpr int invalid_params = -32602;
+constexpr int internal_error = -32603;
+
+std::string quote(std::string_view text)
+{
+    std::string quoted = "\"";
+    for (const char ch : text) {
+        switch (ch) {
+        case '"':
+            quoted += "\\\"";
+            break;
+        case '\\':
+            quoted += "\\\\";
+            break;
+        case '\n':
+            quoted += "\\n";
+            break;
+        case '\t':
+            quoted += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<int>(ch));
+                quoted += escaped;
+            } else {
+                quoted += ch;
+            }
+        }
+    }
+    return quoted + "\"";
+}
+
+// Property trees keep every value as text, so a request id made of digits is taken to have been a number. Requests
+// whose id could not be read are answered with a null one.
+std::string id_json(const std::optional<std::string> &id)
+{
+    if (!id) {
+        return "null";
+    }
+    const bool number = !id->empty() && id->find_first_not_of("0123456789") == std::string::npos;
+    return number ? *id : quote(*id);
+}
+
+// Notifications have none.
+std::optional<std::string> request_id(const pt::ptree &message)
+{
+    if (const auto id = message.get_optional<std::string>("id")) {
+        return *id;
+    }
+    return {};
+}
+
+std::string position_json(const TextPosition &position)
+{
+    return "{\"line\":" + std::to_string(position.line) + ",\"character\":" + std::to_string(position.character) + "}";
+}
+
+const pt::ptree none;
+
+TextPosition text_position(const pt::ptree &position)
+{
+    return TextPosition{ position.get<std::size_t>("line"), position.get<std::size_t>("character") };
+}
+
+}
+
+LanguageServer::LanguageServer(std::istream &in, std::ostream &out) : in(in), out(out)
+{
+}
+
+int LanguageServer::run()
+{
+    while (!exit_code) {
+        const auto content = read_message();
+        if (!content) {
+            return 1;
+        }
+        pt::ptree message;
+        try {
+            std::istringstream stream(*content);
+            pt::read_json(stream, message);
+        } catch (const pt::json_parser_error &e) {
+            respond_error({}, parse_error, e.message());
+            continue;
+        }
+        // A message that fails is answered and the next one is served as usual. Notifications get the answer too,
+        // with a null id, as nothing else would show that they failed.
+        try {
+            handle(message);
+        } catch (const pt::ptree_error &e) {
+            if (const auto id = request_id(message)) {
+                respond_error(id, invalid_params, e.what());
+            }
+        } catch (const std::exception &e) {
+            respond_error(request_id(message), internal_error, e.what());
+        }
+    }
+    return *exit_code;
+}
+
+// Returns the content of the next message, or nothing at the end of the input. A header without a valid
+// Content-Length is answered with a parse error; what follows it is skipped up to the next Content-Length header.
+std::optional<std::string> LanguageServer::read_message()
+{
+    static const std::string content_length = "Content-Length:";
+    std::optional<std::size_t> length;
+    std::string header;
+    while (std::getline(in, header)) {
+        if (!header.empty() && header.back() == '\r') {
+            header.pop_back();
+        }
+        if (header.empty()) {
+            if (!length) {
+                respond_error({}, parse_error, "Expected a Content-Length header with the length of the message");
+                continue;
+            }
+            // Read in chunks, so that a length the input does not have allocates no more than it does.
+            constexpr std::size_t chunk = 64 << 10;
+            std::string content;
+            while (content.size() < *length) {
+                const auto read = content.size();
+                content.resize(read + std::min(chunk, *length - read));
+                if (!in.read(content.data() + read, content.size() - read)) {
+                    return {};
+                }
+            }
+            return content;
+        }
+        // The content of a skipped message may run into the header of the next one.
+        const auto found = header.find(content_length);
+        if (found == std::string::npos) {
+            continue;
+        }
+        const auto value = header.find_first_not_of(' ', found + content_length.size());
+        const auto end = header.data() + header.find_last_not_of(' ') + 1;
+        std::size_t parsed = 0;
+        const auto [last, error] = std::from_chars(header.data() + std::min(value, header.size()), end, parsed);
+        if (error == std::errc{} && last == end) {
+            length = parsed;
+        } else {
+            length.reset();
+        }
+    }
+    return {};
+}
+
+void LanguageServer::write_message(const std::string &content)
+{
+    out << "Content-Length: " << content.size() << "\r\n\r\n" << content;
+    out.flush();
+}
+
+void LanguageServer::respond(const std::optional<std::string> &id, const std::string &result)
+{
+    write_message("{\"jsonrpc\":\"2.0\",\"id\":" + id_json(id) + ",\"result\":" + result + "}");
+}
+
+void LanguageServer::respond_error(const std::optional<std::string> &id, int code, const std::string &message)
+{
+    write_message("{\"jsonrpc\":\"2.0\",\"id\":" + id_json(id) + ",\"error\":{\"code\":" + std::to_string(code) +
+                  ",\"message\":" + quote(message) + "}}");
+}
+
+// Requests carry an id and are answered; notifications are not. Unknown notifications are ignored.
+void LanguageServer::handle(const pt::ptree &message)
+{
+    const auto method = message.get<std::string>("method", "");
+    const auto id = request_id(message);
+    const auto &params = message.get_child("params", none);
+
+    if (method == "initialize") {
+        respond(id, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2}},"
+                     "\"serverInfo\":{\"name\":\"rc\"}}");
+    } else if (method == "shutdown") {
+        shut_down = true;
+        respond(id, "null");
+    } else if (method == "exit") {
+        exit_code = shut_down ? 0 : 1;
+    } else if (method == "textDocument/didOpen") {
+        const auto uri = params.get<std::string>("textDocument.uri");
+        auto &document = documents[uri];
+        document = std::make_unique<Document>(params.get<std::string>("textDocument.text"));
+        publish(uri, document.get());
+    } else if (method == "textDocument/didChange") {
+        change(params);
+    } else if (method == "textDocument/didClose") {
+        const auto uri = params.get<std::string>("textDocument.uri");
+        documents.erase(uri);
+        publish(uri, nullptr);
+    } else if (id) {
+        respond_error(id, method_not_found, "Unsupported method " + method);
+    }
+}
+
+// Changes come in order; those without a range replace the whole text.
+void LanguageServer::change(const pt::ptree &params)
+{
+    const auto uri = params.get<std::string>("textDocument.uri");
+    const auto found = documents.find(uri);
+    if (found == documents.end()) {
+        return;
+    }
+    auto &document = *found->second;
+    for (const auto &change : params.get_child("contentChanges", none)) {
+        const auto &text = change.second.get<std::string>("text");
+        if (const auto range = change.second.get_child_optional("range")) {
+            document.edit(text_position(range->get_child("start")), text_position(range->get_child("end")), text);
+        } else {
+            document.reset(text);
+        }
+    }
+    publish(uri, &document);
+}
+
+// A closed document is published with no diagnostics, which clears them in the client.
+void LanguageServer::publish(const std::string &uri, const Document *document)
+{
+    std::string diagnostics;
+    if (document) {
+        for (const auto &diagnostic : document->diagnostics()) {
+            diagnostics += diagnostics.empty() ? "" : ",";
+            diagnostics += "{\"range\":{\"start\":" + position_json(diagnostic.start) +
+                           ",\"end\":" + position_json(diagnostic.end) + "},\"severity\":1,\"source\":\"rc\"," +
+                           "\"message\":" + quote(wstring_to_utf8(diagnostic.message)) + "}";
+        }
+    }
+    write_message("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":" +
+                  quote(uri) + ",\"diagnostics\":[" + diagnostics + "]}}");
+}
@@ -1,15 +1,23 @@
 #include "common.hpp"
-#include "locale.hpp"
 #include "source.hpp"
+#include "utf8.hpp"
 
-#include <codecvt>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 
-Source::Source()
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+Source::Source() : forgotten_lines(0), forgotten_bytes(0), retained(SIZE_MAX), consumer_waiting(false), line_hint(0),
+      consumed(0)
 {
-    current_position.stream_position = 0;
-    current_position.line_number = 1;
-    current_position.column_number = 0;
-    line_position[1] = current_position;
+    line_starts.push_back(0);
 }
 
 Source::~Source()
@@ -17,43 +25,198 @@ Source::~Source()
 }
 
 std::wstring to_wstring(const Position &position)
+{
+    return concat(L"location: ", std::to_wstring(position.location), L"; ");
+}
+
+std::wstring to_wstring(const SourcePosition &position)
 {
     return concat(L"line: ", std::to_wstring(position.line_number), L"; stream: ",
                   std::to_wstring(position.stream_position), L"; column: ", std::to_wstring(position.column_number),
                   L"; ");
 }
 
-const Position &Source::get_position() const noexcept
+std::string_view Source::next_chunk()
+{
+    auto chunk = read_chunk();
+    index_lines(chunk);
+    consumed.store(consumed.load(std::memory_order_relaxed) + chunk.size(), std::memory_order_relaxed);
+    return chunk;
+}
+
+std::size_t Source::consumed_size() const noexcept
+{
+    return consumed.load(std::memory_order_relaxed);
+}
+
+void Source::retain_from(std::size_t offset) noexcept
+{
+    retained.store(offset, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(retention);
+    released.notify_one();
+}
+
+void Source::wait_for_input(bool waiting) noexcept
+{
+    consumer_waiting.store(waiting);
+    std::lock_guard<std::mutex> lock(retention);
+    released.notify_one();
+}
+
+bool Source::keeps_chunks() const noexcept
+{
+    return false;
+}
+
+std::size_t Source::size_hint() const noexcept
 {
-    return current_position;
+    return 0;
 }
 
-void Source::update_position(wchar_t ch)
+void Source::index_lines(std::string_view chunk)
 {
-    if (ch == L'\n') {
-        current_position.line_number++;
-        current_position.column_number = 0;
-        line_position[current_position.line_number] = current_position;
+    const char *begin = chunk.data();
+    const char *end = begin + chunk.size();
+    const std::size_t offset = consumed.load(std::memory_order_relaxed);
+    for (const char *it = begin; (it = static_cast<const char *>(std::memchr(it, '\n', end - it))) != nullptr;) {
+        ++it;
+        line_starts.push_back(offset + (it - begin));
     }
-    current_position.column_number++;
-    current_position.stream_position++;
+}
+
+void Source::validate(std::string_view chunk) const
+{
+    const std::size_t valid = utf8_validate(chunk.data(), chunk.size());
+    if (valid != chunk.size()) {
+        Source::report_error("Invalid UTF-8 sequence at byte " + std::to_string(consumed_size() + valid));
+    }
+}
+
+void Source::forget_lines_before(std::size_t offset)
+{
+    auto it = std::upper_bound(line_starts.cbegin(), line_starts.cend(), offset);
+    const std::size_t count = std::distance(line_starts.cbegin(), it) - 1;
+    if (count > 0) {
+        line_starts.erase(line_starts.cbegin(), line_starts.cbegin() + count);
+        forgotten_lines += count;
+        line_hint = 0;
+    }
+    forgotten_bytes = offset;
+}
+
+std::size_t Source::retained_line_start() const
+{
+    const auto offset = retained.load(std::memory_order_acquire);
+    if (offset == SIZE_MAX) {
+        return offset;
+    }
+    const auto it = std::upper_bound(line_starts.cbegin(), line_starts.cend(), offset);
+    return it == line_starts.cbegin() ? offset : *std::prev(it);
+}
+
+std::size_t Source::wait_for_release(std::size_t offset)
+{
+    if (retained_line_start() < offset) {
+        std::unique_lock<std::mutex> lock(retention);
+        released.wait(lock, [&] { return consumer_waiting.load() || retained_line_start() >= offset; });
+    }
+    return std::min(offset, retained_line_start());
+}
+
+std::size_t Source::line_count() const noexcept
+{
+    return forgotten_lines + line_starts.size();
+}
+
+std::size_t Source::line_offset(std::size_t line) const
+{
+    return line_starts.at(line - forgotten_lines - 1);
+}
+
+SourcePosition Source::position_of(std::size_t offset) const
+{
+    if (offset < line_starts.front()) {
+        return SourcePosition{ "", offset, 0, 0 };
+    }
+    std::size_t line = line_hint;
+    if (line_starts[line] > offset) {
+        line = 0;
+    }
+    for (int steps = 0; line + 1 < line_starts.size() && line_starts[line + 1] <= offset; ++line, ++steps) {
+        if (steps == 8) {
+            auto it = std::upper_bound(line_starts.cbegin() + line, line_starts.cend(), offset);
+            line = std::distance(line_starts.cbegin(), it) - 1;
+            break;
+        }
+    }
+    line_hint = line;
+    if (line_starts[line] < forgotten_bytes) {
+        return SourcePosition{ "", offset, 0, 0 };
+    }
+    // Columns count characters, as the decoded line the error marker is drawn under does.
+    const auto column = utf8_length(input_between(line_starts[line], offset)) + 1;
+    return SourcePosition{ "", offset, forgotten_lines + line + 1, column };
 }
 
 std::wstring Source::get_lines(std::size_t from, std::size_t to)
 {
-    Position start = line_position.at(from);
-    Position end;
-    if (line_position.find(to) != line_position.end()) {
-        end = line_position.at(to);
-    } else {
-        end = current_position;
+    if (from <= forgotten_lines || line_offset(from) < forgotten_bytes) {
+        return L"";
     }
-    return input_between(start, end);
+    const std::size_t start = line_offset(from);
+    const std::size_t end = to <= line_count() ? line_offset(to) - 1 : consumed_size();
+    return utf8_to_wstring(input_between(start, end));
 }
 
-FileSource::FileSource(const std::string &path) : file(path, std::ios::in)
+std::wstring Source::get_line(std::size_t line)
+{
+    return get_lines(line, line + 1);
+}
+
+StreamSource::StreamSource(std::size_t window_size)
+    : window_start(0), window_size(window_size ? std::max(window_size, 2 * chunk_size) : 0), tail(0)
+{
+}
+
+std::string_view StreamSource::read_chunk()
+{
+    // Retained lines stay; the window only outgrows its size when the consumer is waiting for text past them.
+    if (window_size && window.size() + chunk_size > window_size) {
+        const std::size_t keep = wait_for_release(window_start + window.size() + chunk_size - window_size);
+        if (keep > window_start) {
+            window.erase(0, keep - window_start);
+            window_start = keep;
+            forget_lines_before(window_start);
+        }
+    }
+    const std::size_t start = window.size() - tail;
+    const std::size_t read_at = window.size();
+    window.resize(read_at + chunk_size);
+    stream().read(window.data() + read_at, chunk_size);
+    window.resize(read_at + stream().gcount());
+
+    auto chunk = std::string_view(window).substr(start);
+    tail = stream().eof() ? 0 : utf8_incomplete_tail(chunk.data(), chunk.size());
+    chunk.remove_suffix(tail);
+    validate(chunk);
+    return chunk;
+}
+
+std::string StreamSource::input_between(std::size_t start, std::size_t end) const
+{
+    const auto st = std::max(start, window_start);
+    const auto en = std::min(end, window_start + window.size() - tail);
+
+    if (st >= en) {
+        return "";
+    }
+
+    return window.substr(st - window_start, en - st);
+}
+
+FileSource::FileSource(const std::string &path, std::size_t window_size)
+    : StreamSource(window_size), file(path, std::ios::in | std::ios::binary)
 {
-    file.imbue(std::locale(Locale::get().locale(), new std::codecvt_utf8<wchar_t>{}));
     if (!file.good()) {
         Source::report_error("IO error when trying to access file");
     }
@@ -69,121 +232,273 @@ void Source::report_error(const std::string &msg)
     throw SourceException{ msg };
 }
 
-std::optional<wchar_t> FileSource::next() noexcept
+std::istream &FileSource::stream() noexcept
 {
-    wchar_t ch;
-    if (file.get(ch)) {
-        Source::update_position(ch);
-        return ch;
-    } else {
+    return file;
+}
+
+MappedFileSource::MappedFileSource(const std::string &path)
+    : data(nullptr), size(0), done(false)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Source::report_error("IO error when trying to access file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        Source::report_error("IO error when trying to access file");
+    }
+    size = st.st_size;
+    if (size > 0) {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            Source::report_error("Cannot map file into memory");
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(mapping);
+    }
+    close(fd);
+}
+
+MappedFileSource::~MappedFileSource()
+{
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+}
+
+std::string_view MappedFileSource::read_chunk()
+{
+    if (done || size == 0) {
         return {};
     }
+    done = true;
+    const std::string_view chunk(data, size);
+    validate(chunk);
+    return chunk;
 }
 
-std::wstring FileSource::input_between(const Position &start, const Position &end)
+std::string MappedFileSource::input_between(std::size_t start, std::size_t end) const
 {
-    const auto st = start.stream_position;
-    const auto en = end.stream_position;
+    const auto st = start;
+    const auto en = std::min(end, size);
 
     if (st >= en) {
-        return L"";
+        return "";
     }
 
-    file.clear();
-    auto position_backup = file.tellg();
-    file.seekg(st);
-    std::wstring source(en - st, L'\x00');
-    file.read(source.data(), en - st);
-    file.seekg(position_backup);
-    return source;
+    return std::string(data + st, en - st);
 }
 
-StdInSource::StdInSource() : source_stream(std::wcin.rdbuf())
+bool MappedFileSource::keeps_chunks() const noexcept
 {
-    std::wcin.rdbuf(nullptr);
-    source_stream.imbue(std::locale(Locale::get().locale(), new std::codecvt_utf8<wchar_t>{}));
+    return true;
 }
 
-StdInSource::~StdInSource()
+std::size_t MappedFileSource::size_hint() const noexcept
 {
-    std::wcin.rdbuf(source_stream.rdbuf());
-    source_stream.rdbuf(nullptr);
+    return size;
 }
 
-std::optional<wchar_t> StdInSource::next() noexcept
+GzipBuffer::GzipBuffer(const std::string &path, std::size_t buffer_size)
+    : file(gzopen(path.c_str(), "rb")), buffer(buffer_size)
 {
-    wchar_t ch;
-    if (source_stream.get(ch) && std::char_traits<wchar_t>::not_eof(ch)) {
-        Source::update_position(ch);
-        source_code.push_back(ch);
-        return ch;
-    } else {
-        return {};
+    if (!file) {
+        Source::report_error("IO error when trying to access file");
     }
+    gzbuffer(file, buffer_size);
 }
 
-std::wstring StdInSource::input_between(const Position &start, const Position &end)
+GzipBuffer::~GzipBuffer()
 {
-    const auto st = start.stream_position;
-    const auto en = end.stream_position;
+    gzclose(file);
+}
 
-    if (st >= en) {
-        return L"";
+GzipBuffer::int_type GzipBuffer::underflow()
+{
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    const int count = gzread(file, buffer.data(), buffer.size());
+    int error;
+    const char *message = gzerror(file, &error);
+    if (count < 0 || (error != Z_OK && error != Z_STREAM_END)) {
+        Source::report_error(std::string("Corrupted gzip stream: ") + message);
     }
+    if (count == 0) {
+        return traits_type::eof();
+    }
+    setg(buffer.data(), buffer.data(), buffer.data() + count);
+    return traits_type::to_int_type(*gptr());
+}
 
-    return source_code.substr(st, en - st);
+GzipSource::GzipSource(const std::string &path, std::size_t window_size)
+    : StreamSource(window_size), buffer(path, chunk_size), source_stream(&buffer)
+{
+    source_stream.exceptions(std::ios::badbit);
+}
+
+std::istream &GzipSource::stream() noexcept
+{
+    return source_stream;
+}
+
+#ifdef HAVE_ZSTD
+ZstdBuffer::ZstdBuffer(const std::string &path, std::size_t buffer_size)
+    : file(path, std::ios::in | std::ios::binary), context(ZSTD_createDStream()), input(ZSTD_DStreamInSize()),
+      input_pos(0), input_size(0), buffer(buffer_size), frame_done(false), output_full(false)
+{
+    if (!file.good()) {
+        ZSTD_freeDStream(context);
+        Source::report_error("IO error when trying to access file");
+    }
+    ZSTD_initDStream(context);
+}
+
+ZstdBuffer::~ZstdBuffer()
+{
+    ZSTD_freeDStream(context);
+}
+
+ZstdBuffer::int_type ZstdBuffer::underflow()
+{
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    for (;;) {
+        if (input_pos == input_size && !output_full) {
+            file.read(input.data(), input.size());
+            input_size = file.gcount();
+            input_pos = 0;
+            if (input_size == 0) {
+                if (!frame_done) {
+                    Source::report_error("Corrupted zstd stream: unexpected end of file");
+                }
+                return traits_type::eof();
+            }
+        }
+        ZSTD_inBuffer in{ input.data(), input_size, input_pos };
+        ZSTD_outBuffer out{ buffer.data(), buffer.size(), 0 };
+        const std::size_t ret = ZSTD_decompressStream(context, &out, &in);
+        if (ZSTD_isError(ret)) {
+            Source::report_error(std::string("Corrupted zstd stream: ") + ZSTD_getErrorName(ret));
+        }
+        input_pos = in.pos;
+        frame_done = ret == 0;
+        output_full = out.pos == out.size;
+        if (out.pos > 0) {
+            setg(buffer.data(), buffer.data(), buffer.data() + out.pos);
+            return traits_type::to_int_type(*gptr());
+        }
+    }
+}
+
+ZstdSource::ZstdSource(const std::string &path, std::size_t window_size)
+    : StreamSource(window_size), buffer(path, chunk_size), source_stream(&buffer)
+{
+    source_stream.exceptions(std::ios::badbit);
+}
+
+std::istream &ZstdSource::stream() noexcept
+{
+    return source_stream;
 }
+#endif
 
-StringSource::StringSource(const std::wstring &source)
+StdInSource::StdInSource(std::size_t window_size) : StreamSource(window_size), source_stream(std::cin.rdbuf())
+{
+    std::cin.rdbuf(nullptr);
+}
+
+StdInSource::~StdInSource()
+{
+    std::cin.rdbuf(source_stream.rdbuf());
+    source_stream.rdbuf(nullptr);
+}
+
+std::istream &StdInSource::stream() noexcept
+{
+    return source_stream;
+}
+
+StringSource::StringSource(const std::string &source) : source_code(source), done(false)
 {
-    source_stream.imbue(std::locale(Locale::get().locale(), new std::codecvt_utf8<wchar_t>{}));
-    source_stream << source;
 }
 
 StringSource::~StringSource()
 {
 }
 
-std::optional<wchar_t> StringSource::next() noexcept
+std::string_view StringSource::read_chunk()
 {
-    wchar_t ch;
-    if (source_stream.get(ch) && std::char_traits<wchar_t>::not_eof(ch)) {
-        Source::update_position(ch);
-        return ch;
-    } else {
+    if (done) {
         return {};
     }
+    done = true;
+    validate(source_code);
+    return source_code;
 }
 
-std::wstring StringSource::input_between(const Position &start, const Position &end)
+std::string StringSource::input_between(std::size_t start, std::size_t end) const
 {
-    const auto st = start.stream_position;
-    const auto en = end.stream_position;
+    const auto st = start;
+    const auto en = std::min(end, source_code.size());
 
     if (st >= en) {
-        return L"";
+        return "";
     }
 
-    source_stream.clear();
-    auto position_backup = source_stream.tellg();
-    source_stream.seekg(st);
-    std::wstring source(en - st, L'\x00');
-    source_stream.read(source.data(), en - st);
-    source_stream.seekg(position_backup);
-    return source;
+    return source_code.substr(st, en - st);
 }
 
-std::unique_ptr<Source> Source::from_file(const std::string &path)
+bool StringSource::keeps_chunks() const noexcept
 {
-    return std::make_unique<FileSource>(path);
+    return true;
 }
 
-std::unique_ptr<Source> Source::from_stdin()
+std::size_t StringSource::size_hint() const noexcept
 {
-    return std::make_unique<StdInSource>();
+    return source_code.size();
 }
 
-std::unique_ptr<Source> Source::from_wstring(const std::wstring &str)
+static bool ends_with(const std::string &str, std::string_view suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::unique_ptr<Source> Source::from_file(const std::string &path, std::size_t window_size)
+{
+    if (ends_with(path, ".gz")) {
+        return std::make_unique<GzipSource>(path, window_size);
+    }
+    if (ends_with(path, ".zst")) {
+#ifdef HAVE_ZSTD
+        return std::make_unique<ZstdSource>(path, window_size);
+#else
+        Source::report_error("This build does not support zstd compressed input");
+#endif
+    }
+    // A mapped file stays resident as a whole, so a window asks for the file to be streamed instead.
+    struct stat st;
+    if (!window_size && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        return std::make_unique<MappedFileSource>(path);
+    }
+    return std::make_unique<FileSource>(path, window_size);
+}
+
+std::unique_ptr<Source> Source::from_stdin(std::size_t window_size)
+{
+    return std::make_unique<StdInSource>(window_size);
+}
+
+std::unique_ptr<Source> Source::from_string(const std::string &str)
 {
     return std::make_unique<StringSource>(str);
 }
+
+std::unique_ptr<Source> Source::from_wstring(const std::wstring &str)
+{
+    return std::make_unique<StringSource>(wstring_to_utf8(str));
+}
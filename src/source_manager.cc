@@ -0,0 +1,92 @@
+#include "source_manager.hpp"
+#include "common.hpp"
+#include "token.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+SourceManager::BufferId SourceManager::add(std::unique_ptr<Source> source, std::string name)
+{
+    std::uint64_t base = 0;
+    if (!buffers.empty()) {
+        const auto &last = buffers.back();
+        base = static_cast<std::uint64_t>(last.base) + last.source->consumed_size() + 1;
+    }
+    if (base >= max_location) {
+        Source::report_error("Input exceeds the 4 GiB source location space");
+    }
+    buffers.push_back(Buffer{ std::move(name), std::move(source), static_cast<std::uint32_t>(base) });
+    return buffers.size() - 1;
+}
+
+std::size_t SourceManager::buffer_count() const noexcept
+{
+    return buffers.size();
+}
+
+Source &SourceManager::source(BufferId id) const
+{
+    return *buffers.at(id).source;
+}
+
+const std::string &SourceManager::name(BufferId id) const
+{
+    return buffers.at(id).name;
+}
+
+std::uint32_t SourceManager::base(BufferId id) const
+{
+    return buffers.at(id).base;
+}
+
+const SourceManager::Buffer &SourceManager::buffer_of(const Position &position) const
+{
+    auto it = std::upper_bound(buffers.cbegin(), buffers.cend(), position.location,
+                               [](std::uint32_t location, const Buffer &buffer) { return location < buffer.base; });
+    if (it == buffers.cbegin()) {
+        Source::report_error("Source location does not belong to any buffer");
+    }
+    return *std::prev(it);
+}
+
+SourcePosition SourceManager::decode(const Position &position) const
+{
+    const auto &buffer = buffer_of(position);
+    auto decoded = buffer.source->position_of(position.location - buffer.base);
+    decoded.file = buffer.name;
+    return decoded;
+}
+
+std::string SourceManager::input_between(const Position &start, const Position &end) const
+{
+    const auto &buffer = buffer_of(start);
+    return buffer.source->input_between(start.location - buffer.base, end.location - buffer.base);
+}
+
+std::wstring SourceManager::get_line(const Position &position) const
+{
+    const auto &buffer = buffer_of(position);
+    return buffer.source->get_line(buffer.source->position_of(position.location - buffer.base).line_number);
+}
+
+std::wstring SourceManager::snippet(const Position &position) const
+{
+    const auto decoded = decode(position);
+    if (!decoded.line_number) {
+        return position_in_file(decoded);
+    }
+    return concat(position_in_file(decoded), L"\n In \n", get_line(position), L"\n", error_marker(decoded));
+}
+
+std::uint32_t SourceManager::add_literal(std::string_view raw, bool copy)
+{
+    std::unique_lock<std::shared_mutex> lock(literal_mutex);
+    literals.push_back(copy ? literal_copies.store(raw) : raw);
+    return literals.size() - 1;
+}
+
+std::string_view SourceManager::literal(const Token &token) const
+{
+    std::shared_lock<std::shared_mutex> lock(literal_mutex);
+    return literals.at(token.payload);
+}
@@ -65,48 +65,79 @@ bool is_unary_op(const Token &token)
 
 std::optional<int> get_int(const Token &token)
 {
-    try {
-        return std::get<int>(token.value);
-    } catch (const std::bad_variant_access &) {
+    if (token.type != TokenType::INTCONST) {
         return {};
     }
+    return static_cast<int>(token.payload);
 }
 
-std::optional<std::wstring> get_string(const Token &token)
+std::optional<Symbol> get_symbol(const Token &token)
 {
-    try {
-        return std::get<std::wstring>(token.value);
-    } catch (const std::bad_variant_access &) {
+    if (token.type != TokenType::IDENTIFIER) {
         return {};
     }
+    return Symbol{ token.payload };
 }
 
 Token make_token(TokenType type, const Position &position)
 {
-    return Token{ type, position, std::variant<int, std::wstring>() };
+    return Token{ type, position, 0, 0 };
 }
 
 Token make_token(TokenType type, const Position &position, int value)
 {
-    return Token{ type, position, value };
+    return Token{ type, position, 0, static_cast<std::uint32_t>(value) };
 }
 
-Token make_token(TokenType type, const Position &position, std::wstring value)
+Token make_token(TokenType type, const Position &position, Symbol value)
 {
-    return Token{ type, position, value };
+    return Token{ type, position, 0, value.id };
+}
+
+std::string unescape(std::string_view literal)
+{
+    std::string str;
+    str.reserve(literal.size());
+    for (std::size_t i = 0; i < literal.size(); ++i) {
+        if (literal[i] != '\\' || i + 1 == literal.size()) {
+            str += literal[i];
+            continue;
+        }
+        switch (literal[++i]) {
+        case 'n':
+            str += '\n';
+            break;
+        case 'r':
+            str += '\r';
+            break;
+        case 'a':
+            str += '\a';
+            break;
+        case 'b':
+            str += '\b';
+            break;
+        case 't':
+            str += '\t';
+            break;
+
+        default:
+            str += literal[i];
+        }
+    }
+    return str;
 }
 
 std::wstring repr(const Token &token)
 {
     switch (token.type) {
     case TokenType::IDENTIFIER:
-        return concat(to_wstring(token.position), L"TOKEN(IDENTIFIER, ", *get_string(token), L")");
+        return concat(to_wstring(token.position), L"TOKEN(IDENTIFIER, ", *get_symbol(token), L")");
         break;
     case TokenType::INTCONST:
         return concat(to_wstring(token.position), L"TOKEN(INTCONST, ", std::to_wstring(*get_int(token)), L")");
         break;
     case TokenType::STRINGCONST:
-        return concat(to_wstring(token.position), L"TOKEN(STRINGCONST, ", *get_string(token), L")");
+        return concat(to_wstring(token.position), L"TOKEN(STRINGCONST, literal ", token.payload, L")");
         break;
     case TokenType::PLUS:
         return concat(to_wstring(token.position), L"TOKEN(PLUS)");
@@ -379,13 +410,18 @@ std::wstring repr(TokenType type)
     }
 }
 
-std::wstring position_in_file(const Token &token)
-{
-    return position_in_file(token.position);
-}
-
-std::wstring position_in_file(const Position &position)
+std::wstring position_in_file(const SourcePosition &position)
 {
+    if (!position.line_number) {
+        if (!position.file.empty()) {
+            return concat(position.file, L": location unavailable\n");
+        }
+        return L"Location unavailable\n";
+    }
+    if (!position.file.empty()) {
+        return concat(position.file, L": Line ", std::to_wstring(position.line_number), L" column ",
+                      std::to_wstring(position.column_number), L" :\n");
+    }
     return concat(L"Line ", std::to_wstring(position.line_number), L" column ", std::to_wstring(position.column_number),
                   L" :\n");
 }
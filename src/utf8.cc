@@ -0,0 +1,80 @@
+#include "utf8.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static std::size_t skip_ascii(const char *data, std::size_t i, std::size_t size) noexcept
+{
+#if defined(__AVX2__)
+    for (; i + 32 <= size; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        if (_mm256_movemask_epi8(block) != 0) {
+            break;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        if (_mm_movemask_epi8(block) != 0) {
+            break;
+        }
+    }
+#endif
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+    return i;
+}
+
+std::size_t utf8_validate(const char *data, std::size_t size) noexcept
+{
+    std::size_t i = 0;
+    while (i < size) {
+        i = skip_ascii(data, i, size);
+        const std::size_t block_end = std::min(size, i + 32);
+        while (i < block_end) {
+            if (static_cast<unsigned char>(data[i]) < 0x80) {
+                ++i;
+                continue;
+            }
+            wchar_t ch;
+            const std::size_t length = utf8_decode(data + i, data + size, ch);
+            if (length == 1) {
+                return i;
+            }
+            i += length;
+        }
+    }
+    return size;
+}
+
+std::size_t utf8_incomplete_tail(const char *data, std::size_t size) noexcept
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+    for (std::size_t back = 1; back <= std::min<std::size_t>(size, 4); ++back) {
+        const unsigned char byte = bytes[size - back];
+        if ((byte & 0xC0) == 0x80) {
+            continue;
+        }
+        std::size_t length = 1;
+        if ((byte & 0xE0) == 0xC0) {
+            length = 2;
+        } else if ((byte & 0xF0) == 0xE0) {
+            length = 3;
+        } else if ((byte & 0xF8) == 0xF0) {
+            length = 4;
+        }
+        return length > back ? back : 0;
+    }
+    return 0;
+}
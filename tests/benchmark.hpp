@@ -0,0 +1,152 @@
+#ifndef __BENCHMARK_HPP__
+#define __BENCHMARK_HPP__
+
+#include "source.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Every benchmark is a single translation unit, so the replacement allocation functions live in this header.
+static std::size_t allocation_count = 0;
+
+void *operator new(std::size_t size)
+{
+    ++allocation_count;
+    if (void *memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+struct BenchmarkInput {
+    std::string name;
+    std::string text;
+};
+
+static std::string generate_program(std::size_t size)
+{
+    std::string text;
+    for (int i = 0; text.size() < size; ++i) {
+        const auto n = std::to_string(i);
+        text += "fn function_" + n + "(ptr : int*, size : int) -> int {\n";
+        text += "    let sum = 0, i = " + n + " : int; # running total\n";
+        text += "    for j in 0..size..2 {\n";
+        text += "        if ptr[j] >= 10 && ptr[j] != -1 || !(j << 2 == 8) {\n";
+        text += "            sum = sum + ptr[j] * 3 % 7;\n";
+        text += "        } elif j <= i {\n";
+        text += "            putstr(\"value\\n\");\n";
+        text += "        }\n";
+        text += "    }\n";
+        text += "    return sum;\n";
+        text += "}\n\n";
+    }
+    return text;
+}
+
+static std::string read_file(const std::string &path)
+{
+    auto source = Source::from_file(path);
+    std::string text;
+    for (auto chunk = source->next_chunk(); !chunk.empty(); chunk = source->next_chunk()) {
+        text.append(chunk);
+    }
+    return text;
+}
+
+// Code blocks of the README that define `main` are the sample programs.
+static std::vector<BenchmarkInput> readme_samples(const std::string &path)
+{
+    std::vector<BenchmarkInput> samples;
+    std::ifstream readme(path);
+    std::string line, block;
+    bool inside = false;
+    while (std::getline(readme, line)) {
+        if (line.compare(0, 3, "```") == 0) {
+            if (inside && block.find("fn main") != std::string::npos) {
+                samples.push_back({ "readme_" + std::to_string(samples.size() + 1), block });
+            }
+            inside = !inside;
+            block.clear();
+        } else if (inside) {
+            block += line + "\n";
+        }
+    }
+    return samples;
+}
+
+// Files named on the command line, otherwise the README samples and generated programs of growing size.
+static std::vector<BenchmarkInput> benchmark_inputs(int argc, char *argv[])
+{
+    std::vector<BenchmarkInput> inputs;
+    for (int i = 1; i < argc; ++i) {
+        inputs.push_back({ argv[i], read_file(argv[i]) });
+    }
+    if (!inputs.empty()) {
+        return inputs;
+    }
+    inputs = readme_samples(README_PATH);
+    for (const std::size_t size : { 64u << 10, 1u << 20, 16u << 20 }) {
+        inputs.push_back({ "generated_" + std::to_string(size >> 10) + "k", generate_program(size) });
+    }
+    return inputs;
+}
+
+// Seconds taken by `work`; the allocations it made are stored in `allocations`.
+template <typename Work> double timed(Work work, std::size_t &allocations)
+{
+    const auto allocated = allocation_count;
+    const auto start = std::chrono::steady_clock::now();
+    work();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    allocations = allocation_count - allocated;
+    return elapsed.count();
+}
+
+// Best time per iteration over several rounds, each repeating `iteration` for at least 50 ms so that small inputs are
+// measurable. `iteration` returns the seconds it wants counted, which leaves its own setup out.
+template <typename Iteration> double best_time(Iteration iteration)
+{
+    constexpr int rounds = 5;
+    constexpr double min_round = 0.05;
+    double best = 1e9;
+    for (int round = 0; round < rounds; ++round) {
+        double total = 0;
+        std::size_t count = 0;
+        do {
+            total += iteration();
+            ++count;
+        } while (total < min_round);
+        best = std::min(best, total / count);
+    }
+    return best;
+}
+
+// One JSON object per line.
+static void report(const char *benchmark, const BenchmarkInput &input, std::size_t tokens, double seconds,
+                   std::size_t allocations)
+{
+    std::printf("{\"benchmark\": \"%s\", \"input\": \"%s\", \"bytes\": %zu, \"tokens\": %zu, \"seconds\": %.6f, "
+                "\"tokens_per_second\": %.0f, \"allocations\": %zu, \"allocations_per_token\": %.4f}\n",
+                benchmark, input.name.c_str(), input.text.size(), tokens, seconds, tokens / seconds, allocations,
+                static_cast<double>(allocations) / tokens);
+    std::fflush(stdout);
+}
+
+#endif
@@ -1,32 +1,64 @@
 #include <gtest/gtest.h>
 
 #include "lexer.hpp"
+#include <codecvt>
+#include <cstdio>
+#include <fstream>
 #include <initializer_list>
+#include <thread>
+#include <variant>
+#include <zlib.h>
 
-#define T(type) make_token(TokenType::type, Position{})
-#define V(type, value) make_token(TokenType::type, Position{}, value)
-#define CAT(A, B)   A##B
-#define W(A)  CAT(L, #A)
+struct Lexem {
+    TokenType type;
+    std::variant<int, std::string> value;
+};
 
-bool operator!=(const Token& a, const Token& b) {
+#define T(type) (Lexem{ TokenType::type, 0 })
+#define V(type, value) (Lexem{ TokenType::type, value })
+#define W(A)  #A
+
+bool operator!=(const Lexem& a, const Lexem& b) {
     return a.type != b.type || a.value != b.value;
 }
 
-bool operator==(const Token& a, const Token& b) {
+bool operator==(const Lexem& a, const Lexem& b) {
     return a.type == b.type && a.value == b.value;
 }
 
+bool operator==(const Token& a, const Token& b) {
+    return a.type == b.type && a.length == b.length && a.payload == b.payload;
+}
+
+Lexem lexem(const Lexer& lexer, const Token& token) {
+    switch (token.type) {
+    case TokenType::IDENTIFIER:
+        return Lexem{ token.type, std::string(get_symbol(token)->str()) };
+    case TokenType::INTCONST:
+        return Lexem{ token.type, *get_int(token) };
+    case TokenType::STRINGCONST:
+        return Lexem{ token.type, unescape(lexer.source_manager()->literal(token)) };
+    default:
+        return Lexem{ token.type, 0 };
+    }
+}
+
+Lexem next(Lexer& lexer) {
+    return lexem(lexer, lexer.next());
+}
 
-bool check_tokens(const std::wstring& test, std::initializer_list<Token> tokens) {
-    Lexer lexer{ Source::from_wstring(test) };
+bool check_tokens(const std::string& test, std::initializer_list<Lexem> tokens) {
+    Lexer lexer{ Source::from_string(test) };
     for (const auto &i : tokens) {
-        const Token result = lexer.next();
-        if (result != i) {
+        if (next(lexer) != i) {
             return false;
         }
     }
-    Token last = lexer.next();
-    return last == T(END_OF_FILE);
+    return next(lexer) == T(END_OF_FILE);
+}
+
+SourcePosition where(const Lexer& lexer, const Token& token) {
+    return lexer.source_manager()->decode(token.position);
 }
 
 #define CASE(str, tokens) EXPECT_TRUE(check_tokens(str, tokens))
@@ -46,6 +78,42 @@ TEST(Expression, Operators) {
     CASE(W(a<=b>=c),    LIST( V(IDENTIFIER, W(a)), T(LESS_EQUAL), V(IDENTIFIER, W(b)), T(GREATER_EQUAL), V(IDENTIFIER, W(c)) ));
 }
 
+TEST(Expression, OperatorPrefixes) {
+    CASE(W(!a<-b),      LIST( T(BOOLEAN_NEG), V(IDENTIFIER, W(a)), T(LESS), T(MINUS), V(IDENTIFIER, W(b)) ));
+    CASE(W(a=~b->c),    LIST( V(IDENTIFIER, W(a)), T(ASSIGN), T(BIT_NEG), V(IDENTIFIER, W(b)), T(TYPE_DECL), V(IDENTIFIER, W(c)) ));
+    CASE(W(&&&|||>>>),  LIST( T(BOOLEAN_AND), T(AMPERSAND), T(BOOLEAN_OR), T(BIT_OR), T(SHIFT_RIGHT), T(GREATER) ));
+    CASE(W(1..a),       LIST( V(INTCONST, 1), T(RANGE_SEP), V(IDENTIFIER, W(a)) ));
+    CASE(W(a!),         LIST( V(IDENTIFIER, W(a)), T(BOOLEAN_NEG) ));
+    EXPECT_THROW(check_tokens(W(a.b), LIST( V(IDENTIFIER, W(a)) )), LexerException);
+    EXPECT_THROW(check_tokens(W(a$), LIST( V(IDENTIFIER, W(a)) )), LexerException);
+}
+
+TEST(Expression, IntLiterals) {
+    CASE(W(0 007 1_000_000 2147483647), LIST( V(INTCONST, 0), V(INTCONST, 7), V(INTCONST, 1000000), V(INTCONST, 2147483647) ));
+    CASE(W(0xff 0X7F_FF 0b1010 0B1_0 0xFFFFFFFF), LIST( V(INTCONST, 255), V(INTCONST, 0x7fff), V(INTCONST, 10), V(INTCONST, 2), V(INTCONST, -1) ));
+    CASE(W(12a 0b102 0x1g), LIST( V(INTCONST, 12), V(IDENTIFIER, W(a)), V(INTCONST, 2), V(INTCONST, 2), V(INTCONST, 1), V(IDENTIFIER, W(g)) ));
+    EXPECT_THROW(check_tokens(W(2147483648), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(0x1_0000_0000), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(0x), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(0b_1), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(1_), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(1__0), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(0x_1), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(0xF_), LIST()), LexerException);
+    EXPECT_THROW(check_tokens(W(1_a), LIST()), LexerException);
+}
+
+TEST(Statement, Keywords) {
+    CASE(W(fn for while if elif else return let in extern),
+         LIST( T(KW_FN), T(KW_FOR), T(KW_WHILE), T(KW_IF), T(KW_ELIF), T(KW_ELSE), T(KW_RETURN), T(KW_LET), T(KW_IN),
+               T(KW_EXTERN) ));
+    CASE(W(fnn f iff els elsee returns _let in2 externs nf),
+         LIST( V(IDENTIFIER, W(fnn)), V(IDENTIFIER, W(f)), V(IDENTIFIER, W(iff)), V(IDENTIFIER, W(els)),
+               V(IDENTIFIER, W(elsee)), V(IDENTIFIER, W(returns)), V(IDENTIFIER, W(_let)), V(IDENTIFIER, W(in2)),
+               V(IDENTIFIER, W(externs)), V(IDENTIFIER, W(nf)) ));
+    CASE(W(return), LIST( T(KW_RETURN) ));
+}
+
 TEST(Statement, VarDeclaration) {
     CASE(W(let a=1 : int;), LIST( T(KW_LET), V(IDENTIFIER, W(a)), T(ASSIGN), V(INTCONST, 1), T(COLON), V(IDENTIFIER, W(int)), T(SEMICOLON) ));
     CASE(W(let a="str" : string;), LIST( T(KW_LET), V(IDENTIFIER, W(a)), T(ASSIGN), V(STRINGCONST, W(str)), T(COLON), V(IDENTIFIER, W(string)), T(SEMICOLON) ));
@@ -88,6 +156,301 @@ TEST(Other, SpaceAndComments) {
                 V(IDENTIFIER,W(c))));
 }
 
+TEST(Other, LongSpaceRuns) {
+    const std::string spaces = " \t\n\v\f\r";
+    for (std::size_t run = 0; run < 70; ++run) {
+        std::string text = "a";
+        for (std::size_t i = 0; i <= run; ++i) {
+            text += spaces[i % spaces.size()];
+        }
+        text += "b#" + std::string(run, '.') + "\xE2\x80\x83\n" + std::string(run, ' ') + "\xE2\x80\x83" "c";
+        CASE(text, LIST( V(IDENTIFIER, W(a)), V(IDENTIFIER, W(b)), V(IDENTIFIER, W(c)) ));
+    }
+}
+
+TEST(Other, MappedFile) {
+    const std::string path = "mapped_file_test.r";
+    std::ofstream(path) << "let z\xC5\xBC\xC3\xB3\xC5\x82w = \"\xC4\x85\" : string; # koment\xC4\x85rz\n" << "x";
+    Lexer lexer{ Source::from_file(path) };
+    const Lexem expected[] = { T(KW_LET), V(IDENTIFIER, u8"z\u017C\u00F3\u0142w"), T(ASSIGN), V(STRINGCONST, u8"\u0105"),
+        T(COLON), V(IDENTIFIER, W(string)), T(SEMICOLON) };
+    for (const auto &i : expected) {
+        EXPECT_EQ(next(lexer), i);
+    }
+    const Token last = lexer.next();
+    EXPECT_EQ(lexem(lexer, last), V(IDENTIFIER, W(x)));
+    EXPECT_EQ(where(lexer, last).line_number, 2);
+    EXPECT_EQ(lexer.get_lines(1, 2), L"let z\u017C\u00F3\u0142w = \"\u0105\" : string; # koment\u0105rz");
+    EXPECT_EQ(next(lexer), T(END_OF_FILE));
+    std::remove(path.c_str());
+}
+
+TEST(Other, LineTable) {
+    Lexer lexer{ Source::from_wstring(L"a\nbb\n\n  ccc") };
+    EXPECT_EQ(next(lexer), V(IDENTIFIER, W(a)));
+    EXPECT_EQ(next(lexer), V(IDENTIFIER, W(bb)));
+    const Token last = lexer.next();
+    EXPECT_EQ(where(lexer, last).line_number, 4);
+    EXPECT_EQ(where(lexer, last).column_number, 3);
+    EXPECT_EQ(next(lexer), T(END_OF_FILE));
+    EXPECT_EQ(lexer.get_line(1), L"a");
+    EXPECT_EQ(lexer.get_line(2), L"bb");
+    EXPECT_EQ(lexer.get_line(3), L"");
+    EXPECT_EQ(lexer.get_line(4), L"  ccc");
+    EXPECT_EQ(lexer.get_lines(2, 4), L"bb\n");
+
+    // Columns count characters, so the marker stays under the token after multi-byte ones.
+    Lexer wide{ Source::from_wstring(L"let z\u017C\u00F3\u0142w = \"\u0105\" : string;") };
+    for (int i = 0; i < 4; ++i) {
+        wide.next();
+    }
+    const Token colon = wide.next();
+    EXPECT_EQ(where(wide, colon).column_number, 17);
+    EXPECT_NE(wide.source_manager()->snippet(colon.position).find(std::wstring(16, L'-') + L"\033[1;31m^"),
+              std::wstring::npos);
+}
+
+TEST(Other, ChunkBoundaries) {
+    std::wstring text;
+    for (int i = 0; text.size() < 200000; ++i) {
+        text += L"fn identifier_" + std::to_wstring(i) + L" = \"str\\ting\" >= 12345; # comment \u0105\n";
+    }
+    const std::string path = "chunk_boundaries_test.r";
+    std::wofstream file(path);
+    file.imbue(std::locale(std::locale(), new std::codecvt_utf8<wchar_t>{}));
+    file << text;
+    file.close();
+
+    Lexer expected{ Source::from_wstring(text) };
+    Lexer lexer{ std::make_unique<FileSource>(path) };
+    Token token;
+    do {
+        token = lexer.next();
+        const Token other = expected.next();
+        EXPECT_EQ(token, other);
+        EXPECT_EQ(token.position.location, other.position.location);
+        if (token.type == TokenType::STRINGCONST) {
+            EXPECT_EQ(lexer.source_manager()->literal(token), expected.source_manager()->literal(other));
+        }
+    } while (token.type != TokenType::END_OF_FILE);
+    EXPECT_EQ(lexer.get_line(3000), expected.get_line(3000));
+    std::remove(path.c_str());
+}
+
+TEST(Other, InvalidUtf8) {
+    Lexer lexer{ Source::from_string("let a = \"\xC4\" : string;") };
+    EXPECT_THROW(lexer.next(), SourceException);
+
+    const std::string path = "invalid_utf8_test.r";
+    std::ofstream(path) << std::string(100000, ' ') << "\xF0\x9F\x98";
+    Lexer file_lexer{ std::make_unique<FileSource>(path) };
+    EXPECT_THROW(file_lexer.next(), SourceException);
+    std::remove(path.c_str());
+}
+
+TEST(Other, GzipFile) {
+    std::string text;
+    for (int i = 0; text.size() < 300000; ++i) {
+        text += "let zmienna_\xC4\x85" + std::to_string(i) + " = " + std::to_string(i) + " : int;\n";
+    }
+    const std::string path = "gzip_file_test.r.gz";
+    gzFile file = gzopen(path.c_str(), "wb");
+    gzwrite(file, text.data(), text.size());
+    gzclose(file);
+
+    Lexer expected{ Source::from_string(text) };
+    Lexer lexer{ Source::from_file(path, 128 * 1024) };
+    Token token;
+    do {
+        token = lexer.next();
+        EXPECT_EQ(token, expected.next());
+    } while (token.type != TokenType::END_OF_FILE);
+    const auto last_line = where(lexer, token).line_number - 1;
+    EXPECT_EQ(lexer.get_line(last_line), expected.get_line(last_line));
+    EXPECT_EQ(lexer.get_line(1), L"");
+
+    std::ofstream(path) << "\x1F\x8B\x08\x00 definitely not deflate";
+    Lexer corrupted{ Source::from_file(path) };
+    EXPECT_THROW(corrupted.next(), SourceException);
+    std::remove(path.c_str());
+}
+
+TEST(Other, SourceManager) {
+    auto sources = std::make_shared<SourceManager>();
+    Lexer lexer{ sources, sources->add(Source::from_string("a\n  b"), "first.r") };
+    const Token a = lexer.next();
+    const Token b = lexer.next();
+    EXPECT_EQ(next(lexer), T(END_OF_FILE));
+    lexer.change_source(Source::from_string("\n\nc"), "second.r");
+    const Token c = lexer.next();
+    EXPECT_EQ(lexem(lexer, c), V(IDENTIFIER, W(c)));
+
+    EXPECT_EQ(sizeof(Position), 4);
+    EXPECT_EQ(sources->buffer_count(), 2);
+    EXPECT_EQ(sources->decode(a.position).file, "first.r");
+    EXPECT_EQ(sources->decode(b.position).line_number, 2);
+    EXPECT_EQ(sources->decode(b.position).column_number, 3);
+    EXPECT_EQ(sources->decode(c.position).file, "second.r");
+    EXPECT_EQ(sources->decode(c.position).line_number, 3);
+    EXPECT_EQ(sources->decode(c.position).column_number, 1);
+    EXPECT_EQ(sources->get_line(b.position), L"  b");
+    EXPECT_EQ(sources->get_line(c.position), L"c");
+}
+
+TEST(Other, Interning) {
+    Lexer first{ Source::from_string("alpha beta zażółć") };
+    Lexer second{ Source::from_string("zażółć alpha") };
+    const auto alpha = *get_symbol(first.next());
+    const auto beta = *get_symbol(first.next());
+    const auto polish = *get_symbol(first.next());
+    EXPECT_EQ(*get_symbol(second.next()), polish);
+    EXPECT_EQ(*get_symbol(second.next()), alpha);
+    EXPECT_NE(alpha, beta);
+    EXPECT_EQ(alpha, intern("alpha"));
+    EXPECT_EQ(polish.str(), "zażółć");
+    EXPECT_EQ(concat(beta), L"beta");
+
+    // Threads intern into interners of their own unless handed one; well-known names agree between all of them.
+    auto &names = Interner::current();
+    std::thread([&]() {
+        EXPECT_NE(&Interner::current(), &names);
+        EXPECT_EQ(intern("main"), main_symbol);
+        EXPECT_EQ(intern("beta").id, 4);
+        Interner::Scope scope(names);
+        EXPECT_EQ(intern("beta"), beta);
+        EXPECT_EQ(polish.str(), "zażółć");
+    }).join();
+    Interner local;
+    {
+        Interner::Scope scope(local);
+        EXPECT_EQ(intern("string"), string_symbol);
+        EXPECT_EQ(local.size(), 4);
+    }
+    EXPECT_EQ(&Interner::current(), &names);
+}
+
+TEST(Other, StringLiterals) {
+    Lexer lexer{ Source::from_string("\"a\\tb\" \"q\\\"\" 7 name") };
+    const Token tab = lexer.next();
+    const Token quote = lexer.next();
+    EXPECT_EQ(lexer.source_manager()->literal(tab), "a\\tb");
+    EXPECT_EQ(unescape(lexer.source_manager()->literal(tab)), "a\tb");
+    EXPECT_EQ(unescape(lexer.source_manager()->literal(quote)), "q\"");
+    EXPECT_EQ(tab.length, 6);
+    EXPECT_EQ(quote.length, 5);
+    EXPECT_EQ(lexer.next().length, 1);
+    EXPECT_EQ(lexer.next().length, 4);
+    EXPECT_EQ(sizeof(Token), 16);
+    EXPECT_THROW(Lexer{ Source::from_string("\"open\\\"") }.next(), LexerException);
+}
+
+TEST(Other, TokenizeAll) {
+    const std::string text = "fn f(a : int) -> int { return a * 2; } # done";
+    Lexer expected{ Source::from_string(text) };
+    Lexer lexer{ Source::from_string(text) };
+    const TokenBuffer tokens = lexer.tokenize_all();
+    EXPECT_EQ(tokens.size(), 17);
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        const Token token = expected.next();
+        EXPECT_EQ(tokens[i], token);
+        EXPECT_EQ(tokens[i].position.location, token.position.location);
+    }
+    EXPECT_EQ(tokens[tokens.size() - 1].type, TokenType::END_OF_FILE);
+}
+
+TEST(Other, ParallelLexing) {
+    std::string code;
+    for (int i = 0; code.size() < (1 << 20); ++i) {
+        const auto n = std::to_string(i);
+        code += "fn f" + n + "() -> string { # \"not a string\n    return \"" + n + "\\n\" ; }\n";
+    }
+    // Every slice boundary lands inside this literal, so speculative lexing starts out of phase.
+    auto literal = [](const std::string &line) {
+        std::string text = "let s = \"";
+        while (text.size() < (3 << 20)) {
+            text += line;
+        }
+        return text + "\" : string;\n";
+    };
+
+    auto check = [](const std::string &input) {
+        Lexer serial{ Source::from_string(input) };
+        Lexer parallel{ Source::from_string(input) };
+        Interner serial_names, parallel_names;
+        const TokenBuffer expected = [&]() {
+            Interner::Scope scope(serial_names);
+            return serial.tokenize_all();
+        }();
+        const TokenBuffer tokens = [&]() {
+            Interner::Scope scope(parallel_names);
+            return parallel.tokenize_parallel(4);
+        }();
+        // Slices lexed out of phase leave no names behind.
+        EXPECT_EQ(parallel_names.size(), serial_names.size());
+        ASSERT_EQ(tokens.size(), expected.size());
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            ASSERT_EQ(tokens[i], expected[i]);
+            ASSERT_EQ(tokens[i].position.location, expected[i].position.location);
+            if (tokens[i].type == TokenType::STRINGCONST) {
+                ASSERT_EQ(parallel.source_manager()->literal(tokens[i]), serial.source_manager()->literal(expected[i]));
+            }
+        }
+    };
+    check(code + literal("  fn g() -> int { } # x\n") + code);
+    check(code + literal("  fn g() $ \\\" \n") + code);
+
+    // Errors found by a worker are lexed again by the serial lexer, so they point into the source like its own.
+    auto error = [](const std::string &input, bool parallel) {
+        Lexer lexer{ Source::from_string(input) };
+        try {
+            parallel ? lexer.tokenize_parallel(4) : lexer.tokenize_all();
+        } catch (const LexerException &e) {
+            return e.message();
+        }
+        return std::wstring();
+    };
+    const auto invalid = code + literal("\n") + code + "$";
+    EXPECT_NE(error(invalid, true).find(L"Error line"), std::wstring::npos);
+    EXPECT_EQ(error(invalid, true), error(invalid, false));
+    const auto unterminated = code + code + code + "let s = \"unterminated\n";
+    EXPECT_NE(error(unterminated, true).find(L"Error line"), std::wstring::npos);
+    EXPECT_EQ(error(unterminated, true), error(unterminated, false));
+}
+
+TEST(Other, StreamWindow) {
+    std::wstring text;
+    for (int i = 0; text.size() < 400000; ++i) {
+        text += L"let variable_" + std::to_wstring(i) + L" = " + std::to_wstring(i) + L" : int;\n";
+    }
+    const std::string path = "stream_window_test.r";
+    std::wofstream(path) << text;
+
+    Lexer expected{ Source::from_wstring(text) };
+    Lexer lexer{ std::make_unique<FileSource>(path, 128 * 1024) };
+    const Token first = lexer.next();
+    EXPECT_EQ(first, expected.next());
+    Token token = first;
+    do {
+        token = lexer.next();
+        EXPECT_EQ(token, expected.next());
+    } while (token.type != TokenType::END_OF_FILE);
+    EXPECT_EQ(lexer.get_line(1), L"");
+    // Positions in dropped text are not made up.
+    EXPECT_EQ(where(lexer, first).line_number, 0);
+    EXPECT_EQ(lexer.source_manager()->snippet(first.position), L"Location unavailable\n");
+    const auto last_line = where(lexer, token).line_number - 1;
+    EXPECT_EQ(lexer.get_line(last_line), expected.get_line(last_line));
+
+    // Regular files are streamed rather than mapped when a window is asked for.
+    Lexer windowed{ Source::from_file(path, 128 * 1024) };
+    do {
+        token = windowed.next();
+    } while (token.type != TokenType::END_OF_FILE);
+    EXPECT_EQ(windowed.get_line(1), L"");
+    EXPECT_EQ(windowed.get_line(last_line), expected.get_line(last_line));
+    std::remove(path.c_str());
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv); 
     return RUN_ALL_TESTS();
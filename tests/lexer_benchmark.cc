@@ -0,0 +1,22 @@
+#include "benchmark.hpp"
+#include "lexer.hpp"
+
+int main(int argc, char *argv[])
+{
+    for (const auto &input : benchmark_inputs(argc, argv)) {
+        std::size_t tokens = 0;
+        std::size_t allocations = 0;
+        const double seconds = best_time([&]() {
+            return timed(
+                [&]() {
+                    Lexer lexer{ Source::from_string(input.text) };
+                    tokens = 0;
+                    while (lexer.next().type != TokenType::END_OF_FILE) {
+                        ++tokens;
+                    }
+                },
+                allocations);
+        });
+        report("lexer_next", input, tokens, seconds, allocations);
+    }
+}
@@ -2,18 +2,28 @@
 #include "print_visitor.hpp"
 #include <algorithm>
 #include  <cctype>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <list>
+#include <thread>
 #define private public
 #include "parser.hpp"
+#include "flat_ast.hpp"
+#include "print.hpp"
+#include "semantic.hpp"
+#include "server.hpp"
 
 #define CAT(A, B)   A##B
 #define W(A)  CAT(L, #A)
 #define E(a,b) test_expr(a,b)
 
 template<typename Result, typename Func> 
-std::unique_ptr<Result> parse_stmt(const std::wstring& wstr, const Func& func);
-std::unique_ptr<Expression> parse_expr(const std::wstring& wstr);
+Result* parse_stmt(const std::wstring& wstr, const Func& func);
+Expression* parse_expr(const std::wstring& wstr);
 void test_expr(const std::wstring& input, std::wstring expected);
-std::wstring repr(const std::unique_ptr<Expression>& expr);
+std::wstring repr(const Expression* expr);
 
 TEST(Expression, Factor) {
     E(W(1), W((1)));
@@ -109,7 +119,7 @@ TEST(Expression, Combined) {
 
 TEST(Statement, Assignment) {
     auto stmt = parse_stmt<Statement>(W(a=b=c;), &Parser::parse_AssignStatement);
-    auto assign = dynamic_cast<AssignmentStatement*>(stmt.get());
+    auto assign = node_cast<AssignmentStatement>(stmt);
     auto expected = { L"(a)", L"(b)", L"(c)" };
     auto it = assign->parts.begin();
     EXPECT_EQ(expected.size(), assign->parts.size());
@@ -131,71 +141,71 @@ TEST(Statement, If) {
         auto & [ cond, block ] = *it++;
         EXPECT_EQ(repr(cond), i.first);
         EXPECT_EQ(block->statements.size(), 1);
-        EXPECT_EQ(repr(dynamic_cast<ExpressionStatement*>(block->statements.front().get())->expr), i.second);
+        EXPECT_EQ(repr(node_cast<ExpressionStatement>(block->statements.front())->expr), i.second);
     }
     EXPECT_TRUE(ifstmt->else_statement);
-    EXPECT_EQ(repr(dynamic_cast<ExpressionStatement*>((*ifstmt->else_statement)->statements.front().get())->expr), expect_else);
+    EXPECT_EQ(repr(node_cast<ExpressionStatement>(ifstmt->else_statement->statements.front())->expr), expect_else);
 }
 
 TEST(Statement, For) {
     auto forstmt = parse_stmt<ForStatement>(W(for i in a..b..c { d(); }), &Parser::parse_ForStatement);
-    EXPECT_EQ(forstmt->loop_variable, L"i");
+    EXPECT_EQ(forstmt->loop_variable.str(), "i");
     EXPECT_EQ(repr(forstmt->start), L"(a)");
     EXPECT_EQ(repr(forstmt->end),   L"(b)");
     EXPECT_TRUE(forstmt->increase);
-    EXPECT_EQ(repr(*forstmt->increase), L"(c)");
+    EXPECT_EQ(repr(forstmt->increase), L"(c)");
     EXPECT_EQ(forstmt->block->statements.size(), 1);
-    EXPECT_EQ(repr(dynamic_cast<ExpressionStatement*>(forstmt->block->statements.front().get())->expr), L"(d())");
+    EXPECT_EQ(repr(node_cast<ExpressionStatement>(forstmt->block->statements.front())->expr), L"(d())");
 }
 
 TEST(Statement, While) {
     auto whilestmt = parse_stmt<WhileStatement>(W(while a { b(); }), &Parser::parse_WhileStatement);
     EXPECT_EQ(repr(whilestmt->condition), L"(a)");
     EXPECT_EQ(whilestmt->block->statements.size(), 1);
-    EXPECT_EQ(repr(dynamic_cast<ExpressionStatement*>(whilestmt->block->statements.front().get())->expr), L"(b())");
+    EXPECT_EQ(repr(node_cast<ExpressionStatement>(whilestmt->block->statements.front())->expr), L"(b())");
 }
 
 TEST(Statement, VariableDeclaration) {
     auto var_decl = parse_stmt<VariableDecl>(W(let a : int;), &Parser::parse_VariableDecl);
     EXPECT_EQ(var_decl->var_decls.size(), 1);
-    EXPECT_EQ(var_decl->var_decls.front().name, L"a");
+    EXPECT_EQ(var_decl->var_decls.front().name.str(), "a");
     EXPECT_EQ(var_decl->var_decls.front().type, BuiltinType::Int);
     EXPECT_FALSE(var_decl->var_decls.front().initial_value);
 
     var_decl = parse_stmt<VariableDecl>(L"let a=1, b=2 : int;)", &Parser::parse_VariableDecl);
     EXPECT_EQ(var_decl->var_decls.size(), 2);
     
-    EXPECT_EQ(var_decl->var_decls.front().name, L"a");
+    EXPECT_EQ(var_decl->var_decls.front().name.str(), "a");
     EXPECT_EQ(var_decl->var_decls.front().type, BuiltinType::Int);
     EXPECT_TRUE(var_decl->var_decls.front().initial_value);
-    EXPECT_EQ(repr(*var_decl->var_decls.front().initial_value), L"(1)");
+    EXPECT_EQ(repr(var_decl->var_decls.front().initial_value), L"(1)");
 
-    EXPECT_EQ(var_decl->var_decls.back().name, L"b");
+    EXPECT_EQ(var_decl->var_decls.back().name.str(), "b");
     EXPECT_EQ(var_decl->var_decls.back().type, BuiltinType::Int);
     EXPECT_TRUE(var_decl->var_decls.back().initial_value);
-    EXPECT_EQ(repr(*var_decl->var_decls.back().initial_value), L"(2)");
+    EXPECT_EQ(repr(var_decl->var_decls.back().initial_value), L"(2)");
 }
 
 TEST(Statement, FunctionDeclaration) {
     auto func = parse_stmt<FunctionDecl>(L"fn a(b : int, c : int) -> int { d(); })", &Parser::parse_FunctionDecl);
-    EXPECT_EQ(func->func_name, L"a");
+    EXPECT_EQ(func->func_name.str(), "a");
 
     EXPECT_EQ(func->parameters.size(), 2);
-    EXPECT_EQ(func->parameters.front().name, L"b");
+    EXPECT_EQ(func->parameters.front().name.str(), "b");
     EXPECT_EQ(func->parameters.front().type, BuiltinType::Int);
-    EXPECT_EQ(func->parameters.back().name, L"c");
+    EXPECT_EQ(func->parameters.back().name.str(), "c");
     EXPECT_EQ(func->parameters.back().type, BuiltinType::Int);
 
     EXPECT_EQ(func->return_type, BuiltinType::Int);
-    EXPECT_EQ(repr(dynamic_cast<ExpressionStatement*>(func->block->statements.front().get())->expr), L"(d())");
+    EXPECT_EQ(repr(node_cast<ExpressionStatement>(func->block->statements.front())->expr), L"(d())");
 }
 
 TEST(Statement, ExternFunctionDeclaration) {
     auto stmt = parse_stmt<ExternFunctionDecl>(L"extern fn malloc(size : int) -> int*;", &Parser::parse_ExternFunctionDecl);
-    EXPECT_EQ(stmt->func_name, L"malloc");
+    EXPECT_EQ(stmt->func_name.str(), "malloc");
     EXPECT_EQ(stmt->return_type, BuiltinType::IntPointer);
     EXPECT_EQ(stmt->parameters.size(), 1);
-    EXPECT_EQ(stmt->parameters.front().name, L"size");
+    EXPECT_EQ(stmt->parameters.front().name.str(), "size");
     EXPECT_EQ(stmt->parameters.front().type, BuiltinType::Int);
 }
 
@@ -259,20 +269,476 @@ TEST(Invalid, IfStatement) {
     EXPECT_THROW(parse_stmt<Statement>(L"if a { } elif  else { }", &Parser::parse_IfStatement), std::runtime_error);
 }
 
+struct RecordingSink : DeclarationSink {
+    std::vector<std::string> names;
+    bool cancelled = false;
+
+    void declare(const ExternFunctionDecl& decl) override { names.push_back("extern " + std::string(decl.func_name.str())); }
+    void declare(const VariableDecl& decl) override { names.push_back("let " + std::string(decl.var_decls.front().name.str())); }
+    void declare(const FunctionDecl& decl) override { names.push_back("fn " + std::string(decl.func_name.str())); }
+    void cancel() noexcept override { cancelled = true; }
+};
+
+TEST(Other, Pipelined) {
+    std::wstring text = L"extern fn putwchar(chr : int) -> int;\nlet g = 0x10 : int;\n";
+    std::vector<std::string> expected{ "extern putwchar", "let g" };
+    for (int i = 0; i < 2000; ++i) {
+        text += L"fn f" + std::to_wstring(i) + L"(a : int) -> int { return a * \"s\" + g; }\n";
+        expected.push_back("fn f" + std::to_string(i));
+    }
+    text += L"let h : int;\n";
+    expected.push_back("let h");
+
+    RecordingSink sink;
+    Parser parser;
+    parser.attach_lexer(Lexer::from_source(Source::from_wstring(text)), true);
+    auto program = parser.parse(sink);
+    EXPECT_EQ(sink.names, expected);
+    EXPECT_FALSE(sink.cancelled);
+    EXPECT_EQ(program->functions.size(), 2000);
+    EXPECT_EQ(program->functions.back()->func_name.str(), "f1999");
+
+    RecordingSink failing;
+    parser.attach_lexer(Lexer::from_source(Source::from_wstring(text + L"fn broken( {")), true);
+    EXPECT_THROW(parser.parse(failing), ParserException);
+    EXPECT_TRUE(failing.cancelled);
+    EXPECT_EQ(failing.names, expected);
+
+    parser.attach_lexer(Lexer::from_source(Source::from_wstring(text + L"let $")), true);
+    EXPECT_THROW(parser.parse(), LexerException);
+
+    parser.attach_lexer(Lexer::from_source(Source::from_wstring(text + L"fn unfinished(")), true);
+    EXPECT_NO_THROW(parser.detach_lexer());
+}
+
+TEST(Other, PipelinedStreamWindow) {
+    // The sink holds the parser up while the lexer reads on, far past a window of the smallest size.
+    struct SlowSink : RecordingSink {
+        void declare(const VariableDecl& decl) override {
+            if (names.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+            RecordingSink::declare(decl);
+        }
+    };
+    std::wstring text;
+    for (int i = 0; i < 40000; ++i) {
+        text += i == 20000 ? L"let broken = : int;\n" : L"let v" + std::to_wstring(i) + L" = " + std::to_wstring(i) + L" : int;\n";
+    }
+    const std::string path = "pipelined_stream_window_test.r";
+    std::wofstream(path) << text;
+    auto error = [](std::unique_ptr<Source> source, bool pipelined) {
+        SlowSink sink;
+        Parser parser;
+        parser.attach_lexer(Lexer::from_source(std::move(source)), pipelined);
+        try {
+            parser.parse(sink);
+        } catch (const ParserException& e) {
+            return e.message();
+        }
+        return std::wstring();
+    };
+    const auto expected = error(Source::from_wstring(text), false);
+    EXPECT_NE(expected.find(L"Line 20001 column 14"), std::wstring::npos);
+    EXPECT_EQ(error(std::make_unique<FileSource>(path, 1), true), expected);
+    std::remove(path.c_str());
+}
+
+TEST(Other, PipelinedReadAhead) {
+    // While the parser is held up, the lexer reads no further than the window of two chunks holds.
+    struct SlowSink : RecordingSink {
+        const Source *source = nullptr;
+        std::size_t read = 0;
+        void declare(const VariableDecl& decl) override {
+            if (names.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                read = source->consumed_size();
+            }
+            RecordingSink::declare(decl);
+        }
+    };
+    const std::string path = "pipelined_read_ahead_test.r";
+    {
+        std::ofstream file(path);
+        for (int i = 0; i < 40000; ++i) {
+            file << "let v" << i << " = " << i << " : int;\n";
+        }
+    }
+    auto source = std::make_unique<FileSource>(path, 1);
+    SlowSink sink;
+    sink.source = source.get();
+    Parser parser;
+    parser.attach_lexer(Lexer::from_source(std::move(source)), true);
+    parser.parse(sink);
+    EXPECT_EQ(sink.names.size(), 40000u);
+    EXPECT_GT(sink.read, 0u);
+    EXPECT_LE(sink.read, std::size_t{ 3 } << 16);
+    std::remove(path.c_str());
+}
+
+TEST(Other, SpscQueue) {
+    // Values arrive in order while both ends keep finding the ring full or empty.
+    SpscQueue<int> queue(2);
+    std::thread producer([&queue] {
+        for (int i = 0; i < 100000; ++i) {
+            queue.push(i);
+        }
+    });
+    bool ordered = true;
+    for (int i = 0; i < 100000; ++i) {
+        ordered = ordered && queue.pop() == i;
+    }
+    producer.join();
+    EXPECT_TRUE(ordered);
+
+    // An end that has to wait long sleeps instead of taking a core.
+    const auto start = std::clock();
+    std::thread consumer([&queue] { queue.pop(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    queue.push(1);
+    consumer.join();
+    EXPECT_LT(std::clock() - start, CLOCKS_PER_SEC / 10);
+}
+
+TEST(Other, Flatten) {
+    Parser parser;
+    parser.attach_lexer(Lexer::from_source(Source::from_wstring(
+        L"extern fn f(a : int, b : int*) -> int;\nlet g = 2 : int;\n"
+        L"fn main() -> int { for i in 0..g { f(i * 3, &g); } if g { return 1; } return -g; }\n")));
+    auto program = parser.parse();
+    auto ast = flatten(*program);
+
+    ASSERT_EQ(ast.externs.size(), 1);
+    ASSERT_EQ(ast.global_vars.size(), 1);
+    ASSERT_EQ(ast.functions.size(), 1);
+    for (NodeIndex node = 0; node < ast.size(); ++node) {
+        if (ast.kinds[node] == NodeKind::BinaryExpression || ast.kinds[node] == NodeKind::IndexExpression) {
+            EXPECT_LT(ast.first[node], node);
+            EXPECT_LT(ast.second[node], node);
+        }
+    }
+
+    const auto func = ast.functions.front();
+    EXPECT_EQ(ast.kinds[func], NodeKind::FunctionDecl);
+    EXPECT_EQ(ast.symbol(func).str(), "main");
+    const auto body = ast.list(ast.first[ast.list(ast.second[func]).front()]);
+    ASSERT_EQ(body.size(), 3);
+
+    const auto loop = body[0];
+    EXPECT_EQ(ast.kinds[loop], NodeKind::ForStatement);
+    EXPECT_EQ(ast.symbol(loop).str(), "i");
+    EXPECT_EQ(ast.list(ast.second[loop])[2], no_node);
+    const auto call = ast.first[ast.list(ast.first[ast.list(ast.second[loop])[3]]).front()];
+    EXPECT_EQ(ast.kinds[call], NodeKind::FunctionCall);
+    const auto arguments = ast.list(ast.second[call]);
+    ASSERT_EQ(arguments.size(), 2);
+    EXPECT_EQ(ast.op<BinaryOperator>(arguments[0]), BinaryOperator::Multiply);
+    EXPECT_EQ(ast.op<UnaryOperator>(arguments[1]), UnaryOperator::Addrof);
+
+    EXPECT_EQ(ast.kinds[body[1]], NodeKind::IfStatement);
+    EXPECT_EQ(ast.second[body[1]], no_node);
+    EXPECT_EQ(ast.kinds[ast.first[body[2]]], NodeKind::UnaryExpression);
+
+    const auto parameters = ast.list(ast.second[ast.externs.front()]);
+    ASSERT_EQ(parameters.size(), 2);
+    EXPECT_EQ(ast.op<BuiltinType>(parameters[1]), BuiltinType::IntPointer);
+    const auto var = ast.list(ast.first[ast.global_vars.front()]).front();
+    EXPECT_EQ(ast.first[ast.second[var]], 2);
+}
+
+TEST(Other, ParallelParse) {
+    std::wstring text = L"extern fn puts(s : string) -> int;\n";
+    for (int i = 0; i < 9000; ++i) {
+        const auto n = std::to_wstring(i);
+        text += L"fn f" + n + L"(a : int) -> int { if a { puts(\"} {\"); } return a * " + n + L"; }\n";
+        if (i % 1000 == 0) {
+            text += L"let g" + n + L" = " + n + L" : int;\n";
+        }
+    }
+    // String constants point into the source, which lives as long as the parser.
+    auto parse = [](const std::wstring& text, std::size_t threads) {
+        Parser parser;
+        parser.attach_lexer(Lexer::from_source(Source::from_wstring(text)));
+        PrintVisitor printer;
+        printer.dispatch(*parser.parse(threads));
+        return printer.result();
+    };
+    EXPECT_EQ(parse(text, 3), parse(text, 1));
+
+    auto error = [&](const std::wstring& text, std::size_t threads) {
+        try {
+            parse(text, threads);
+        } catch (const ParserException& e) {
+            return e.message();
+        }
+        return std::wstring();
+    };
+    auto insert_line = [&](std::size_t at, const std::wstring& line) {
+        return std::wstring(text).insert(text.find(L'\n', at) + 1, line);
+    };
+    for (const auto& broken : { insert_line(text.size() / 2, L"}\n"), insert_line(text.size() * 3 / 4, L"let x = ;\n"),
+                                insert_line(text.size() / 3, L"fn g() -> int {\n"), text + L"fn late( {" }) {
+        const auto expected = error(broken, 1);
+        EXPECT_NE(expected, L"");
+        EXPECT_EQ(error(broken, 3), expected);
+    }
+}
+
+TEST(Other, StaticVisitor) {
+    struct Counter : StaticVisitor<Counter> {
+        std::size_t binary = 0, leaves = 0;
+        void visit(const BinaryExpression& expr) { ++binary; dispatch(*expr.lhs); dispatch(*expr.rhs); }
+        void visit(const UnaryExpression& expr) { dispatch(*expr.rhs); }
+        void visit(const ASTNode&) { ++leaves; }
+    } counter;
+    auto expr = parse_expr(L"a + -b * f(c)");
+    counter.dispatch(*expr);
+    EXPECT_EQ(counter.binary, 2);
+    EXPECT_EQ(counter.leaves, 3);
+
+    EXPECT_EQ(expr->kind, NodeKind::BinaryExpression);
+    EXPECT_TRUE(node_cast<BinaryExpression>(expr));
+    EXPECT_FALSE(node_cast<UnaryExpression>(expr));
+    EXPECT_FALSE(node_cast<IntConst>(static_cast<Expression*>(nullptr)));
+}
+
+TEST(Other, DepthLimit) {
+    auto parse = [](const std::wstring& body, std::size_t limit) {
+        Parser parser;
+        parser.set_depth_limit(limit);
+        parser.attach_lexer(Lexer::from_source(Source::from_wstring(L"fn main() -> int { " + body + L" }")));
+        return parser.parse(1);
+    };
+    auto repeat = [](const std::wstring& text, std::size_t count) {
+        std::wstring result;
+        for (std::size_t i = 0; i < count; ++i) {
+            result += text;
+        }
+        return result;
+    };
+    // Far deeper than the stack would take if every level recursed.
+    const std::size_t deep = 100000, limit = Parser::default_depth_limit;
+    EXPECT_NO_THROW(parse(L"return " + repeat(L"-", deep) + L"1;", limit));
+    EXPECT_NO_THROW(parse(L"return 1" + repeat(L" + 1", deep) + L";", limit));
+    EXPECT_NO_THROW(parse(L"return " + repeat(L"(", limit - 1) + L"1" + repeat(L")", limit - 1) + L";", limit));
+    EXPECT_THROW(parse(L"return " + repeat(L"(", deep) + L"1" + repeat(L")", deep) + L";", limit), ParserException);
+    EXPECT_THROW(parse(L"return " + repeat(L"f(", deep) + L"1" + repeat(L")", deep) + L";", limit), ParserException);
+    EXPECT_THROW(parse(L"return a" + repeat(L"[a", deep) + repeat(L"]", deep) + L";", limit), ParserException);
+    EXPECT_THROW(parse(repeat(L"if 1 { ", deep) + repeat(L"} ", deep) + L"return 1;", limit), ParserException);
+
+    // The function body is the first level; parentheses, calls, indices and blocks add one each, operators none.
+    EXPECT_NO_THROW(parse(L"return 1 + 2 * -3;", 1));
+    EXPECT_NO_THROW(parse(L"return (1 + (2 * 3));", 3));
+    EXPECT_THROW(parse(L"return ((1 + (2 * 3)));", 3), ParserException);
+    EXPECT_THROW(parse(L"return (1 + 2) * (3 + (4));", 2), ParserException);
+    EXPECT_NO_THROW(parse(L"if 1 { return f(1); }", 3));
+    EXPECT_THROW(parse(L"if 1 { return f(a[2]); }", 3), ParserException);
+    EXPECT_THROW(parse(L"if 1 { if 1 { return 1; } }", 2), ParserException);
+}
+
+TEST(Other, DeepExpressions) {
+    // Operator chains do not count against the depth limit, the passes walk them without recursing.
+    const std::size_t deep = 100000;
+    std::wstring chain = L"a", negations;
+    for (std::size_t i = 0; i < deep; ++i) {
+        chain += L" + a";
+        negations += L"-";
+    }
+    auto sources = std::make_shared<SourceManager>();
+    auto buffer = sources->add(Source::from_wstring(L"fn f(a : int) -> int { return a; }\n"
+        L"fn main() -> int { let a = 1 : int; a = " + chain + L"; return " + negations + L"f(a); }"), "deep.r");
+    Parser parser;
+    parser.attach_lexer(Lexer::from_source(sources, buffer));
+    auto program = parser.parse(1);
+
+    EXPECT_NO_THROW(analyse(program, sources));
+    auto ast = flatten(*program);
+    EXPECT_NO_THROW(analyse(ast, sources));
+}
+
+TEST(Other, DeepBlocks) {
+    // Statements are still visited recursively; the depth limit keeps the deepest nesting it lets through within the
+    // stack of every pass that recurses, sanitizers included.
+    auto nest = [](std::size_t levels) {
+        const wchar_t *openings[] = { L"if a { ", L"while a { ", L"for i in 0..a { " };
+        std::wstring nested;
+        for (std::size_t i = 0; i < levels; ++i) {
+            nested += openings[i % 3];
+        }
+        nested += L"let b = a : int; return b; ";
+        for (std::size_t i = 0; i < levels; ++i) {
+            nested += L"} ";
+        }
+        return nested;
+    };
+    const auto nested = nest(Parser::default_depth_limit - 1);
+    auto sources = std::make_shared<SourceManager>();
+    auto buffer = sources->add(Source::from_wstring(L"fn main() -> int { let a = 1 : int; " + nested + L"return a; }"),
+                               "blocks.r");
+    Parser parser;
+    parser.attach_lexer(Lexer::from_source(sources, buffer));
+    auto program = parser.parse(1);
+
+    EXPECT_NO_THROW(analyse(program, sources));
+    auto ast = flatten(*program);
+    EXPECT_NO_THROW(analyse(ast, sources));
+
+    // The printer indents every line by its depth, so at the limit it would print hundreds of megabytes.
+    Parser shallower;
+    shallower.attach_lexer(Lexer::from_source(Source::from_wstring(L"fn main() -> int { let a = 1 : int; " +
+                                                                    nest(Parser::default_depth_limit / 20) + L"}")));
+    PrintVisitor printer;
+    printer.dispatch(*shallower.parse(1));
+    EXPECT_FALSE(printer.result().empty());
+
+    // One level more and the program is rejected before any pass runs.
+    Parser deeper;
+    deeper.attach_lexer(Lexer::from_source(Source::from_wstring(L"fn main() -> int { if a { " + nested + L"} }")));
+    EXPECT_THROW(deeper.parse(1), ParserException);
+}
+
+TEST(Other, Document) {
+    std::string text = "extern fn putwchar(c : int) -> int;\nlet g = 1 : int;\n";
+    for (int i = 0; i < 50; ++i) {
+        text += "fn f" + std::to_string(i) + "(a : int) -> int {\n    return a + g;\n}\n";
+    }
+    text += "fn main() -> int {\n    return f49(1);\n}\n";
+    auto line_of = [](int function) { return std::size_t(2 + 3 * function); };
+    auto lines = [](const std::vector<Diagnostic>& diagnostics) {
+        std::vector<std::size_t> lines;
+        for (const auto& diagnostic : diagnostics) {
+            lines.push_back(diagnostic.start.line);
+        }
+        return lines;
+    };
+    // The message analyse() gives for the whole text, without the excerpt of the source.
+    auto analysed = [](const std::string& text) {
+        Parser parser;
+        parser.attach_lexer(Lexer::from_source(Source::from_string(text)));
+        auto program = parser.parse(1);
+        try {
+            analyse(program, nullptr);
+        } catch (const SemanticException& e) {
+            return e.description();
+        }
+        return std::wstring();
+    };
+
+    Document document(text);
+    EXPECT_EQ(document.text(), text);
+    EXPECT_TRUE(document.diagnostics().empty());
+
+    // A body edit reparses and checks only the function it is in.
+    document.edit({ line_of(10) + 1, 15 }, { line_of(10) + 1, 16 }, "\"s\"");
+    auto diagnostics = document.diagnostics();
+    ASSERT_EQ(diagnostics.size(), 1);
+    EXPECT_EQ(diagnostics[0].start.line, line_of(10) + 1);
+    EXPECT_EQ(diagnostics[0].start.character, 15);
+    EXPECT_EQ(diagnostics[0].message, analysed(document.text()));
+    document.edit({ line_of(10) + 1, 15 }, { line_of(10) + 1, 18 }, "g");
+    EXPECT_EQ(document.text(), text);
+    EXPECT_TRUE(document.diagnostics().empty());
+
+    // A changed signature checks the callers again.
+    document.edit({ line_of(49), 11 }, { line_of(49), 14 }, "string");
+    EXPECT_EQ(lines(document.diagnostics()), (std::vector<std::size_t>{ line_of(49) + 1, line_of(50) + 1 }));
+    document.edit({ line_of(49), 11 }, { line_of(49), 17 }, "int");
+    EXPECT_TRUE(document.diagnostics().empty());
+
+    // A function that stops parsing stays declared, so only the syntax error shows.
+    document.edit({ line_of(49) + 2, 0 }, { line_of(49) + 3, 0 }, "");
+    diagnostics = document.diagnostics();
+    ASSERT_EQ(diagnostics.size(), 1);
+    EXPECT_EQ(diagnostics[0].start.line, line_of(49) + 2);
+    document.edit({ line_of(49) + 2, 0 }, { line_of(49) + 2, 0 }, "}\n");
+    EXPECT_EQ(document.text(), text);
+    EXPECT_TRUE(document.diagnostics().empty());
+
+    // Functions only see those declared before them, which makes the later of two with one name a redeclaration.
+    document.edit({ line_of(0), 0 }, { line_of(0), 0 }, "fn h() -> int { return f49(1); }\nfn f7() -> int { return 7; }\n");
+    EXPECT_EQ(lines(document.diagnostics()), (std::vector<std::size_t>{ line_of(0), line_of(7) + 2 }));
+    EXPECT_EQ(document.diagnostics()[0].message, analysed(document.text()));
+
+    // Edits may span several items and split or merge them.
+    document.edit({ line_of(0), 0 }, { line_of(5) + 2, 0 }, "");
+    EXPECT_TRUE(document.diagnostics().empty());
+    document.edit({ 1, 0 }, { 1, 0 }, "let g : string;\n");
+    diagnostics = document.diagnostics();
+    EXPECT_EQ(diagnostics.size(), 46);
+    EXPECT_EQ(diagnostics[0].start.line, 2);
+    EXPECT_EQ(diagnostics[0].message, analysed(document.text()));
+    document.reset(text);
+    EXPECT_TRUE(document.diagnostics().empty());
+
+    // Names typed into the document do not pile up in the interner of the thread, nor in that of the document.
+    const std::string body = "fn main() -> int {\n    let x = 1 : int;\n    let s = \"" + std::string(64 << 10, 's') +
+                             "\" : string;\n    return 0;\n}\n";
+    const auto thread_names = Interner::current().size();
+    document.reset(body);
+    const int edits = 600;
+    for (int i = 0; i < edits; ++i) {
+        document.edit({ 1, 0 }, { 2, 0 }, "    let x" + std::to_string(i) + " = 1 : int;\n");
+    }
+    EXPECT_EQ(Interner::current().size(), thread_names);
+    EXPECT_LT(document.interned(), edits / 2);
+}
+
+TEST(Other, LanguageServer) {
+    auto message = [](const std::string& content) {
+        return "Content-Length: " + std::to_string(content.size()) + "\r\n\r\n" + content;
+    };
+    std::stringstream in, out;
+    in << message(R"({"jsonrpc":"2.0","id":1,"method":"initialize","params":{}})")
+       << message(R"({"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":{"uri":"file:///a.r",)"
+                  R"("languageId":"r","version":1,"text":"fn main() -> int {\n    return x;\n}\n"}}})")
+       << message(R"({"jsonrpc":"2.0","method":"textDocument/didChange","params":{"textDocument":{"uri":"file:///a.r",)"
+                  R"("version":2},"contentChanges":[{"range":{"start":{"line":1,"character":11},)"
+                  R"("end":{"line":1,"character":12}},"text":"0"}]}})")
+       << message(R"({"jsonrpc":"2.0","id":2,"method":"shutdown"})")
+       << message(R"({"jsonrpc":"2.0","method":"exit"})");
+    LanguageServer server(in, out);
+    EXPECT_EQ(server.run(), 0);
+    const auto output = out.str();
+    EXPECT_NE(output.find(R"("id":1,"result":{"capabilities")"), std::string::npos);
+    EXPECT_NE(output.find(R"("diagnostics":[{"range":{"start":{"line":1,"character":11},)"
+                          R"("end":{"line":1,"character":12}},"severity":1,"source":"rc",)"
+                          R"("message":"Error cannot find variable named `x` in scope."}]}})"),
+              std::string::npos);
+    EXPECT_NE(output.find(R"("diagnostics":[]}})"), std::string::npos);
+    EXPECT_NE(output.find(R"("id":2,"result":null)"), std::string::npos);
+
+    // Messages whose header or content cannot be read are answered with a parse error and the server goes on.
+    const std::string parse_error = R"("id":null,"error":{"code":-32700)";
+    const auto shutdown = message(R"({"jsonrpc":"2.0","id":3,"method":"shutdown"})");
+    for (const std::string& malformed : std::vector<std::string>{
+             "Content-Length: abc\r\n\r\n{}", "Content-Length: 99999999999999999999999\r\n\r\n{}",
+             "Content-Length: 2x\r\n\r\n{}\r\n", "Content-Type: text\r\n\r\n", message("{") }) {
+        std::stringstream in, out;
+        in << malformed << shutdown << message(R"({"jsonrpc":"2.0","method":"exit"})");
+        LanguageServer server(in, out);
+        EXPECT_EQ(server.run(), 0) << malformed;
+        const auto output = out.str();
+        EXPECT_NE(output.find(parse_error), std::string::npos) << malformed;
+        EXPECT_NE(output.find(R"("id":3,"result":null)"), std::string::npos) << malformed;
+    }
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
 
-std::unique_ptr<Expression> parse_expr(const std::wstring& wstr) {
+// Nodes live in the parser's arena, so the helpers share one parser that outlives the tests.
+static Parser parser;
+
+Expression* parse_expr(const std::wstring& wstr) {
     auto source = Source::from_wstring(wstr);
     auto lexer = Lexer::from_source(std::move(source));
-    Parser parser;
     parser.attach_lexer(std::move(lexer));
     return parser.parse_ConditionalExpression();
 }
 
-std::wstring repr(const std::unique_ptr<Expression>& expr) {
+std::wstring repr(const Expression* expr) {
     print_visitor_expr visitor;
     expr->accept(visitor);
     return visitor.result();
@@ -284,10 +750,9 @@ void test_expr(const std::wstring& input, std::wstring expected) {
 }
 
 template<typename Result, typename Func> 
-std::unique_ptr<Result> parse_stmt(const std::wstring& wstr, const Func& func){
+Result* parse_stmt(const std::wstring& wstr, const Func& func){
     auto source = Source::from_wstring(wstr);
     auto lexer = Lexer::from_source(std::move(source));
-    Parser parser;
     parser.attach_lexer(std::move(lexer));
     return std::invoke(func, &parser);
 }
@@ -0,0 +1,177 @@
+#include "benchmark.hpp"
+#include "parser.hpp"
+
+#include <iostream>
+
+// Visits every node of a program in the order the code generator does, dispatching on the kind of each node either
+// through StaticVisitor or through the virtual Visitor interface. The generator itself needs LLVM, so this measures
+// the traversal it is built on.
+template <bool through_vtable> class Walker : public Visitor, public StaticVisitor<Walker<through_vtable> > {
+public:
+    std::size_t nodes = 0;
+
+    void walk(const ASTNode *node)
+    {
+        if (!node) {
+            return;
+        }
+        if constexpr (through_vtable) {
+            node->accept(*this);
+        } else {
+            this->dispatch(*node);
+        }
+    }
+    void visit(const UnaryExpression &expr) override
+    {
+        ++nodes;
+        walk(expr.rhs);
+    }
+    void visit(const BinaryExpression &expr) override
+    {
+        ++nodes;
+        walk(expr.lhs);
+        walk(expr.rhs);
+    }
+    void visit(const IndexExpression &expr) override
+    {
+        ++nodes;
+        walk(expr.ptr);
+        walk(expr.index);
+    }
+    void visit(const VariableRef &) override
+    {
+        ++nodes;
+    }
+    void visit(const FunctionCall &call) override
+    {
+        ++nodes;
+        for (const auto *argument : call.arguments) {
+            walk(argument);
+        }
+    }
+    void visit(const IntConst &) override
+    {
+        ++nodes;
+    }
+    void visit(const StringConst &) override
+    {
+        ++nodes;
+    }
+    void visit(const Block &block) override
+    {
+        ++nodes;
+        for (const auto *statement : block.statements) {
+            walk(statement);
+        }
+    }
+    void visit(const FunctionDecl &function) override
+    {
+        ++nodes;
+        walk(function.block);
+    }
+    void visit(const VariableDecl &decl) override
+    {
+        ++nodes;
+        for (const auto &var : decl.var_decls) {
+            walk(var.initial_value);
+        }
+    }
+    void visit(const AssignmentStatement &assignment) override
+    {
+        ++nodes;
+        for (const auto *part : assignment.parts) {
+            walk(part);
+        }
+    }
+    void visit(const ReturnStatement &statement) override
+    {
+        ++nodes;
+        walk(statement.expr);
+    }
+    void visit(const ExpressionStatement &statement) override
+    {
+        ++nodes;
+        walk(statement.expr);
+    }
+    void visit(const IfStatement &statement) override
+    {
+        ++nodes;
+        for (const auto &[condition, block] : statement.blocks) {
+            walk(condition);
+            walk(block);
+        }
+        walk(statement.else_statement);
+    }
+    void visit(const ForStatement &statement) override
+    {
+        ++nodes;
+        walk(statement.start);
+        walk(statement.end);
+        walk(statement.increase);
+        walk(statement.block);
+    }
+    void visit(const WhileStatement &statement) override
+    {
+        ++nodes;
+        walk(statement.condition);
+        walk(statement.block);
+    }
+    void visit(const Program &program) override
+    {
+        for (const auto *decl : program.externs) {
+            walk(decl);
+        }
+        for (const auto *decl : program.global_vars) {
+            walk(decl);
+        }
+        for (const auto *decl : program.functions) {
+            walk(decl);
+        }
+    }
+    void visit(const ExternFunctionDecl &) override
+    {
+        ++nodes;
+    }
+};
+
+template <bool through_vtable>
+void benchmark_walk(const char *name, const BenchmarkInput &input, const Program &program, std::size_t tokens)
+{
+    std::size_t allocations = 0;
+    std::size_t nodes = 0;
+    const double seconds = best_time([&]() {
+        Walker<through_vtable> walker;
+        const double elapsed = timed([&]() { walker.walk(&program); }, allocations);
+        nodes = walker.nodes;
+        return elapsed;
+    });
+    if (!nodes) {
+        std::abort();
+    }
+    report(name, input, tokens, seconds, allocations);
+}
+
+// The input is tokenized once and the recorded stream is replayed, so only the parser is measured.
+int main(int argc, char *argv[])
+{
+    for (const auto &input : benchmark_inputs(argc, argv)) {
+        auto lexer = Lexer::from_source(Source::from_string(input.text));
+        const TokenBuffer recorded = lexer->tokenize_all();
+        Parser parser;
+        std::size_t allocations = 0;
+        try {
+            std::unique_ptr<Program> program;
+            const double seconds = best_time([&]() {
+                parser.attach_lexer(std::move(lexer), recorded);
+                const double elapsed = timed([&]() { program = parser.parse(); }, allocations);
+                lexer = parser.detach_lexer();
+                return elapsed;
+            });
+            report("parser_parse", input, recorded.size(), seconds, allocations);
+            benchmark_walk<true>("ast_walk_virtual", input, *program, recorded.size());
+            benchmark_walk<false>("ast_walk_static", input, *program, recorded.size());
+        } catch (const ParserException &e) {
+            std::wcerr << input.name.c_str() << L": " << e.message() << std::endl;
+        }
+    }
+}